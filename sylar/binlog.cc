@@ -0,0 +1,409 @@
+#include "binlog.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "log.h"
+
+namespace sylar {
+
+// 2: 段头增加进程启动时间 解码时据此还原%r
+static const uint32_t s_binlog_version = 2;
+
+// 调用点注册表 全局唯一 故意不释放 保证进程退出阶段仍可使用
+static Mutex &GetSiteMutex() {
+  static Mutex *s_mutex = new Mutex;
+  return *s_mutex;
+}
+
+static std::vector<BinLogSite *> &GetSites() {
+  static std::vector<BinLogSite *> *s_sites = new std::vector<BinLogSite *>;
+  return *s_sites;
+}
+
+const BinLogSite *BinLogSite::Register(const char *file, uint32_t line, const char *function, const char *fmt,
+                                       const char *types) {
+  BinLogSite *site = new BinLogSite;
+  site->line = line;
+  site->file = file;
+  site->function = function;
+  site->fmt = fmt;
+  site->types = types;
+  Mutex::Lock lock(GetSiteMutex());
+  site->id = GetSites().size();
+  GetSites().push_back(site);
+  return site;
+}
+
+static void PutU32(std::string &out, uint32_t v) { out.append((const char *)&v, sizeof(v)); }
+
+static void PutU64(std::string &out, uint64_t v) { out.append((const char *)&v, sizeof(v)); }
+
+static void PutString(std::string &out, const std::string &v) {
+  PutU32(out, v.size());
+  out.append(v);
+}
+
+// 条目: 类型 + 负载长度 + 负载
+static void PutEntry(std::string &out, char type, const std::string &payload) {
+  out.push_back(type);
+  PutU32(out, payload.size());
+  out.append(payload);
+}
+
+BinLogWriter::BinLogWriter(const std::string &filename, const std::string &name, const std::string &pattern,
+                           size_t buffer_size, uint64_t flush_interval, LogMetrics *metrics)
+    : m_filename(filename), m_name(name), m_pattern(pattern), m_metrics(metrics) {
+  m_fd = open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  m_writer.reset(new LogBufferWriter(
+      "binlog", buffer_size ? buffer_size : 256 * 1024, flush_interval,
+      std::bind(&BinLogWriter::writeBuffers, this, std::placeholders::_1, std::placeholders::_2)));
+}
+
+BinLogWriter::~BinLogWriter() {
+  m_writer->stop();
+  if (m_fd >= 0) {
+    close(m_fd);
+  }
+}
+
+void BinLogWriter::start() { m_writer->start(); }
+
+void BinLogWriter::stop() { m_writer->stop(); }
+
+void BinLogWriter::flush() { m_writer->flush(); }
+
+size_t BinLogWriter::getBufferSize() const { return m_writer->getBufferSize(); }
+
+uint64_t BinLogWriter::getFlushInterval() const { return m_writer->getFlushInterval(); }
+
+char *BinLogWriter::GetLargeBuffer(size_t size) {
+  static thread_local std::string t_buf;
+  if (t_buf.size() < size) {
+    t_buf.resize(size);
+  }
+  return &t_buf[0];
+}
+
+char *BinLogWriter::encodeHeader(char *p, size_t size, int level, const BinLogSite *site) {
+  uint32_t thread_id = GetThreadId();
+  uint32_t len = size - 5;
+  uint64_t time = GetFastTimeUS();
+  uint32_t fiber_id = GetFiberId();
+  *p = 'R';
+  memcpy(p + 1, &len, 4);
+  memcpy(p + 5, &site->id, 4);
+  memcpy(p + 9, &time, 8);
+  memcpy(p + 17, &thread_id, 4);
+  memcpy(p + 21, &fiber_id, 4);
+  p[25] = (char)level;
+  return p + kRecordHeaderSize;
+}
+
+void BinLogWriter::append(const char *data, size_t len) { m_writer->append(data, len); }
+
+void BinLogWriter::writeBuffers(const struct iovec *iov, int iovcnt) {
+  if (m_fd < 0) {
+    return;
+  }
+  std::string meta;
+  if (m_needHeader) {
+    std::string payload;
+    PutU32(payload, s_binlog_version);
+    PutString(payload, m_name);
+    PutString(payload, m_pattern);
+    PutU64(payload, GetProcessStartUS());
+    PutEntry(meta, 'H', payload);
+    m_needHeader = false;
+  }
+  {
+    // 记录在写入缓冲之前调用点已经注册 这里补写的调用点一定覆盖本批记录引用到的
+    Mutex::Lock lock(GetSiteMutex());
+    std::vector<BinLogSite *> &sites = GetSites();
+    for (; m_sitesWritten < sites.size(); ++m_sitesWritten) {
+      BinLogSite *site = sites[m_sitesWritten];
+      std::string payload;
+      PutU32(payload, site->id);
+      PutU32(payload, site->line);
+      PutString(payload, site->file);
+      PutString(payload, site->function);
+      PutString(payload, site->fmt);
+      PutString(payload, site->types);
+      PutEntry(meta, 'S', payload);
+    }
+  }
+  if (m_metrics) {
+    // 记录数在这里统计 写日志的线程不用再做一次原子加 一条记录不会跨越两块缓冲
+    uint64_t records = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+      const char *p = (const char *)iov[i].iov_base;
+      const char *end = p + iov[i].iov_len;
+      while (end - p >= 5) {
+        uint32_t len;
+        memcpy(&len, p + 1, sizeof(len));
+        records += *p == 'R';
+        p += 5 + len;
+      }
+    }
+    m_metrics->add(LogMetrics::EVENTS, records);
+  }
+  if (meta.empty()) {
+    WriteAll(m_fd, iov, iovcnt);
+    return;
+  }
+  std::vector<struct iovec> vec(iovcnt + 1);
+  vec[0].iov_base = &meta[0];
+  vec[0].iov_len = meta.size();
+  std::copy(iov, iov + iovcnt, vec.begin() + 1);
+  WriteAll(m_fd, &vec[0], vec.size());
+}
+
+// 按顺序读取条目负载的游标 越界后ok变为false
+struct BinLogCursor {
+  const char *p;
+  const char *end;
+  bool ok = true;
+
+  BinLogCursor(const char *data, size_t len) : p(data), end(data + len) {}
+
+  bool get(void *v, size_t len) {
+    if (!ok || (size_t)(end - p) < len) {
+      ok = false;
+      return false;
+    }
+    memcpy(v, p, len);
+    p += len;
+    return true;
+  }
+
+  template <class T>
+  T read() {
+    T v = T();
+    get(&v, sizeof(v));
+    return v;
+  }
+
+  std::string readString() {
+    uint32_t len = read<uint32_t>();
+    if (!ok || (size_t)(end - p) < len) {
+      ok = false;
+      return "";
+    }
+    std::string v(p, len);
+    p += len;
+    return v;
+  }
+};
+
+// 把一个转换说明的参数按实际记录的类型输出 长度修饰符以记录的类型为准
+static void AppendArg(std::string &out, const std::string &spec, char conv, char type, BinLogCursor &cur) {
+  char buf[128];
+  std::string f = spec;
+  int n = 0;
+  switch (type) {
+    case 'i':
+    case 'I':
+    case 'u':
+    case 'U': {
+      long long v = type == 'i' ? cur.read<int32_t>()
+                    : type == 'u' ? cur.read<uint32_t>()
+                    : type == 'U' ? (long long)cur.read<uint64_t>()
+                                  : cur.read<int64_t>();
+      if (conv == 'c') {
+        n = snprintf(buf, sizeof(buf), (f + 'c').c_str(), (int)v);
+      } else if (strchr("fFeEgGaA", conv)) {
+        n = snprintf(buf, sizeof(buf), (f + conv).c_str(), (double)v);
+      } else {
+        if (!strchr("diouxX", conv)) {
+          conv = (type == 'u' || type == 'U') ? 'u' : 'd';
+        }
+        n = snprintf(buf, sizeof(buf), (f + "ll" + conv).c_str(), v);
+      }
+      break;
+    }
+    case 'd': {
+      double v = cur.read<double>();
+      n = snprintf(buf, sizeof(buf), (f + (strchr("fFeEgGaA", conv) ? conv : 'g')).c_str(), v);
+      break;
+    }
+    case 'D': {
+      long double v = cur.read<long double>();
+      n = snprintf(buf, sizeof(buf), (f + 'L' + (strchr("fFeEgGaA", conv) ? conv : 'g')).c_str(), v);
+      break;
+    }
+    case 'p': {
+      uint64_t v = cur.read<uint64_t>();
+      n = snprintf(buf, sizeof(buf), (f + 'p').c_str(), (void *)(uintptr_t)v);
+      break;
+    }
+    case 's': {
+      std::string v = cur.readString();
+      if (f == "%") {
+        out.append(v);
+        return;
+      }
+      std::vector<char> tmp(v.size() + 128);
+      n = snprintf(&tmp[0], tmp.size(), (f + 's').c_str(), v.c_str());
+      out.append(&tmp[0], std::min((size_t)std::max(n, 0), tmp.size() - 1));
+      return;
+    }
+    default:
+      cur.ok = false;
+      return;
+  }
+  if (n > 0) {
+    out.append(buf, std::min((size_t)n, sizeof(buf) - 1));
+  }
+}
+
+std::string BinLogReader::FormatMessage(const std::string &fmt, const std::string &types, const char *data,
+                                        size_t len) {
+  std::string out;
+  BinLogCursor cur(data, len);
+  size_t arg = 0;
+  for (size_t i = 0; i < fmt.size(); ++i) {
+    if (fmt[i] != '%') {
+      out.push_back(fmt[i]);
+      continue;
+    }
+    if (i + 1 < fmt.size() && fmt[i + 1] == '%') {
+      out.push_back('%');
+      ++i;
+      continue;
+    }
+    // %[flags][width][.precision][length]conversion 宽度和精度为*时取一个整数参数
+    std::string spec = "%";
+    size_t j = i + 1;
+    while (j < fmt.size() && strchr("-+ #0", fmt[j])) {
+      spec.push_back(fmt[j++]);
+    }
+    for (int part = 0; part < 2; ++part) {
+      if (part == 1) {
+        if (j >= fmt.size() || fmt[j] != '.') {
+          break;
+        }
+        spec.push_back(fmt[j++]);
+      }
+      if (j < fmt.size() && fmt[j] == '*') {
+        long long v = 0;
+        if (arg < types.size()) {
+          char t = types[arg++];
+          v = t == 'i' ? cur.read<int32_t>() : t == 'u' ? cur.read<uint32_t>() : cur.read<int64_t>();
+        }
+        spec += std::to_string(v);
+        ++j;
+      } else {
+        while (j < fmt.size() && isdigit(fmt[j])) {
+          spec.push_back(fmt[j++]);
+        }
+      }
+    }
+    while (j < fmt.size() && strchr("hlLqjzt", fmt[j])) {
+      ++j;
+    }
+    if (j >= fmt.size()) {
+      out.append(fmt, i, std::string::npos);
+      break;
+    }
+    char conv = fmt[j];
+    i = j;
+    if (conv == 'n') {
+      continue;
+    }
+    if (arg >= types.size() || !cur.ok) {
+      out.append(spec).push_back(conv);  // 参数不够 原样输出
+      continue;
+    }
+    AppendArg(out, spec, conv, types[arg++], cur);
+  }
+  return out;
+}
+
+BinLogReader::BinLogReader(const std::string &pattern) : m_pattern(pattern) {}
+
+bool BinLogReader::decode(std::istream &is, std::ostream &os) {
+  struct Site {
+    uint32_t line = 0;
+    std::string file;
+    std::string function;
+    std::string fmt;
+    std::string types;
+  };
+  std::vector<Site> sites;
+  Logger::ptr logger;
+  LogFormatter::ptr formatter;
+  uint64_t start_us = 0;  // 写入进程的启动时间
+  std::string payload;
+  std::string line;
+
+  char head[5];
+  while (is.read(head, sizeof(head))) {
+    char type = head[0];
+    uint32_t len;
+    memcpy(&len, head + 1, sizeof(len));
+    payload.resize(len);
+    if (len && !is.read(&payload[0], len)) {
+      return false;  // 文件末尾的条目不完整
+    }
+    BinLogCursor cur(payload.data(), payload.size());
+    if (type == 'H') {
+      uint32_t version = cur.read<uint32_t>();
+      std::string name = cur.readString();
+      std::string pattern = cur.readString();
+      // 版本1没有启动时间 %r只能输出0
+      start_us = version >= 2 ? cur.read<uint64_t>() : 0;
+      if (!cur.ok || version == 0 || version > s_binlog_version) {
+        return false;
+      }
+      sites.clear();  // 新的段 调用点id重新编号
+      logger.reset(new Logger(name));
+      formatter.reset(new LogFormatter(m_pattern.empty() ? pattern : m_pattern));
+      if (formatter->isError()) {
+        return false;
+      }
+    } else if (type == 'S') {
+      uint32_t id = cur.read<uint32_t>();
+      Site site;
+      site.line = cur.read<uint32_t>();
+      site.file = cur.readString();
+      site.function = cur.readString();
+      site.fmt = cur.readString();
+      site.types = cur.readString();
+      if (!cur.ok) {
+        return false;
+      }
+      if (id >= sites.size()) {
+        sites.resize(id + 1);
+      }
+      sites[id] = site;
+    } else if (type == 'R') {
+      uint32_t id = cur.read<uint32_t>();
+      uint64_t time = cur.read<uint64_t>();
+      uint32_t thread_id = cur.read<uint32_t>();
+      uint32_t fiber_id = cur.read<uint32_t>();
+      uint8_t level = cur.read<uint8_t>();
+      if (!cur.ok || !formatter || id >= sites.size()) {
+        return false;
+      }
+      const Site &site = sites[id];
+      const char *basename = LogBasename(site.file.c_str());
+      LogSite log_site = {site.file.c_str(), basename, (uint32_t)strlen(basename), (int32_t)site.line,
+                          site.function.c_str()};
+      uint32_t elapse = start_us && time > start_us ? (time - start_us) / 1000 : 0;
+      LogEvent::ptr event =
+        LogEvent::Create(logger, &log_site, (LogLevel::Level)level, elapse, thread_id, fiber_id, time);
+      event->getSS() << FormatMessage(site.fmt, site.types, cur.p, cur.end - cur.p);
+      line.clear();
+      formatter->format(line, (LogLevel::Level)level, *event);
+      os.write(line.data(), line.size());
+    }
+    // 其他类型留给以后扩展 直接跳过
+  }
+  return is.eof();
+}
+
+}  // namespace sylar
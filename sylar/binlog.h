@@ -0,0 +1,202 @@
+#ifndef __SYLAR_BINLOG_H__
+#define __SYLAR_BINLOG_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "thread.h"
+
+// 二进制日志: 调用时只记录调用点id和参数的原始字节 格式化推迟到sylar_logdecode离线完成
+//
+// 文件由若干条目组成 每个条目: [u8 类型][u32 负载长度][负载] 整数都是本机字节序
+//   'H' 段头  u32 版本 + 日志器名称 + 日志格式(LogFormatter的pattern) 每次打开文件写一次 之后的调用点id重新编号
+//   'S' 调用点 u32 id + u32 行号 + 文件名 + 函数名 + printf格式 + 参数类型串 引用它的记录之前一定先写出
+//   'R' 记录  u32 调用点id + u64 时间(微秒) + u32 线程id + u32 协程id + u8 级别 + 参数
+// 字符串都是 u32 长度 + 内容 参数按类型串依次存放
+namespace sylar {
+
+class LogBufferWriter;
+class LogMetrics;
+
+// 参数类型 'i' int32 'I' int64 'u' uint32 'U' uint64 'd' double 'D' long double 's' 字符串 'p' 指针
+// 不支持的类型在编译期报错
+template <class T, class Enable = void>
+struct BinLogArg;
+
+template <class T, class Stored, char Type>
+struct BinLogFixedArg {
+  static const char type = Type;
+  static size_t Size(const T &) { return sizeof(Stored); }
+  static char *Encode(char *p, const T &v) {
+    Stored s = (Stored)v;
+    memcpy(p, &s, sizeof(s));
+    return p + sizeof(s);
+  }
+};
+
+template <class T>
+struct BinLogArg<T, typename std::enable_if<(std::is_integral<T>::value && std::is_signed<T>::value &&
+                                             sizeof(T) <= 4)>::type> : BinLogFixedArg<T, int32_t, 'i'> {};
+template <class T>
+struct BinLogArg<T, typename std::enable_if<(std::is_integral<T>::value && std::is_signed<T>::value &&
+                                             sizeof(T) > 4)>::type> : BinLogFixedArg<T, int64_t, 'I'> {};
+template <class T>
+struct BinLogArg<T, typename std::enable_if<(std::is_integral<T>::value && !std::is_signed<T>::value &&
+                                             sizeof(T) <= 4)>::type> : BinLogFixedArg<T, uint32_t, 'u'> {};
+template <class T>
+struct BinLogArg<T, typename std::enable_if<(std::is_integral<T>::value && !std::is_signed<T>::value &&
+                                             sizeof(T) > 4)>::type> : BinLogFixedArg<T, uint64_t, 'U'> {};
+template <class T>
+struct BinLogArg<T, typename std::enable_if<std::is_enum<T>::value>::type> : BinLogFixedArg<T, int64_t, 'I'> {};
+template <>
+struct BinLogArg<float> : BinLogFixedArg<float, double, 'd'> {};
+template <>
+struct BinLogArg<double> : BinLogFixedArg<double, double, 'd'> {};
+template <>
+struct BinLogArg<long double> : BinLogFixedArg<long double, long double, 'D'> {};
+
+template <class T>
+struct BinLogArg<T *> : BinLogFixedArg<T *, uint64_t, 'p'> {
+  static char *Encode(char *p, const void *v) {
+    uint64_t s = (uint64_t)(uintptr_t)v;
+    memcpy(p, &s, sizeof(s));
+    return p + sizeof(s);
+  }
+};
+
+struct BinLogStringArg {
+  static const char type = 's';
+  static size_t Size(const char *v) { return sizeof(uint32_t) + (v ? strlen(v) : 6); }
+  static size_t Size(const std::string &v) { return sizeof(uint32_t) + v.size(); }
+  static char *Encode(char *p, const char *v) { return v ? Encode(p, v, strlen(v)) : Encode(p, "(null)", 6); }
+  static char *Encode(char *p, const std::string &v) { return Encode(p, v.data(), v.size()); }
+  static char *Encode(char *p, const char *v, uint32_t len) {
+    memcpy(p, &len, sizeof(len));
+    memcpy(p + sizeof(len), v, len);
+    return p + sizeof(len) + len;
+  }
+};
+
+template <>
+struct BinLogArg<char *> : BinLogStringArg {};
+template <>
+struct BinLogArg<const char *> : BinLogStringArg {};
+template <>
+struct BinLogArg<std::string> : BinLogStringArg {};
+
+// 参数类型列表 只在decltype中使用 不会对参数求值
+template <class... Args>
+struct BinLogArgs {
+  static const char *Types() {
+    static const char s_types[] = {BinLogArg<typename std::decay<Args>::type>::type..., '\0'};
+    return s_types;
+  }
+};
+
+template <class... Args>
+BinLogArgs<Args...> BinLogArgsOf(const Args &...);
+
+inline size_t BinLogSize() { return 0; }
+
+template <class T, class... Rest>
+size_t BinLogSize(const T &v, const Rest &...rest) {
+  return BinLogArg<typename std::decay<T>::type>::Size(v) + BinLogSize(rest...);
+}
+
+inline char *BinLogEncode(char *p) { return p; }
+
+template <class T, class... Rest>
+char *BinLogEncode(char *p, const T &v, const Rest &...rest) {
+  return BinLogEncode(BinLogArg<typename std::decay<T>::type>::Encode(p, v), rest...);
+}
+
+// 调用点的静态描述 每个SYLAR_LOG_FMT_*展开处注册一次 之后只用id引用
+struct BinLogSite {
+  uint32_t id;
+  uint32_t line;
+  std::string file;
+  std::string function;
+  std::string fmt;
+  std::string types;
+
+  // 线程安全 调用点对象永不释放
+  static const BinLogSite *Register(const char *file, uint32_t line, const char *function, const char *fmt,
+                                    const char *types);
+};
+
+// 二进制日志文件 记录由各线程写入自己的缓冲 后台线程整块写出
+class BinLogWriter {
+ public:
+  typedef std::shared_ptr<BinLogWriter> ptr;
+
+  // 记录头: 类型 + 长度 + 调用点id + 时间 + 线程id + 协程id + 级别
+  static const size_t kRecordHeaderSize = 1 + 4 + 4 + 8 + 4 + 4 + 1;
+
+  // name和pattern写入段头 解码时用来还原日志器名称和每行的格式 进程启动时间也写入段头 用来还原%r
+  // metrics非空时 后台线程写出时把记录数计入EVENTS
+  BinLogWriter(const std::string &filename, const std::string &name, const std::string &pattern,
+               size_t buffer_size, uint64_t flush_interval, LogMetrics *metrics = nullptr);
+  ~BinLogWriter();
+
+  void start();
+  // 停止后台线程 缓冲中的记录都会写出 停止之后的记录直接写文件
+  void stop();
+  void flush();
+
+  template <class... Args>
+  void log(int level, const BinLogSite *site, const Args &...args) {
+    size_t size = kRecordHeaderSize + BinLogSize(args...);
+    char buf[512];
+    char *p = size <= sizeof(buf) ? buf : GetLargeBuffer(size);
+    BinLogEncode(encodeHeader(p, size, level, site), args...);
+    append(p, size);
+  }
+
+  const std::string &getFilename() const { return m_filename; }
+  size_t getBufferSize() const;
+  uint64_t getFlushInterval() const;
+
+ private:
+  static char *GetLargeBuffer(size_t size);
+  char *encodeHeader(char *p, size_t size, int level, const BinLogSite *site);
+  void append(const char *data, size_t len);
+  // 后台线程的输出回调 先补写新出现的调用点 再写记录
+  void writeBuffers(const struct iovec *iov, int iovcnt);
+
+ private:
+  std::string m_filename;
+  std::string m_name;
+  std::string m_pattern;
+  int m_fd = -1;
+  bool m_needHeader = true;
+  uint32_t m_sitesWritten = 0;  // 已写入文件的调用点数量 调用点id从0连续分配
+  LogMetrics *m_metrics;
+  std::shared_ptr<LogBufferWriter> m_writer;
+};
+
+// 把二进制日志还原成文本 每条记录构造成LogEvent后交给LogFormatter格式化
+class BinLogReader {
+ public:
+  // pattern非空时覆盖文件中记录的日志格式
+  explicit BinLogReader(const std::string &pattern = "");
+
+  // 返回false表示文件格式错误 已解码的内容仍然会输出
+  bool decode(std::istream &is, std::ostream &os);
+
+  // 按printf格式和参数类型串还原消息内容
+  static std::string FormatMessage(const std::string &fmt, const std::string &types, const char *data,
+                                   size_t len);
+
+ private:
+  std::string m_pattern;
+};
+
+}  // namespace sylar
+
+#endif  // __SYLAR_BINLOG_H__
@@ -1,12 +1,32 @@
 #include "log.h"
 
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <functional>
+#include <limits.h>
 #include <map>
+#include <math.h>
+#include <queue>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <tuple>
+#include <unistd.h>
 
 #include "config.h"
 #include "util.h"
 
+#ifdef SYLAR_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef SYLAR_HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
 namespace sylar {
 
 const char *LogLevel::ToString(LogLevel::Level level) {
@@ -57,139 +77,505 @@ std::string LogLevel::toString(const LogLevel::Level &level) {
 #undef XX
 }
 
-/**
- *  %m 消息体
- *  %p level
- *  %c 日志名称
- *  %t 线程id
- *  %n 回车换行
- *  %d 时间
- *  %f 文件名
- *  %l 行号
- */
-class MessageFormatItem : public LogFormatter::FormatItem {
- public:
-  MessageFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-    os << event->getContent();
+LogOverflow::Policy LogOverflow::FromString(const std::string &str) {
+  if (str == "drop_newest") {
+    return DROP_NEWEST;
+  } else if (str == "drop_oldest") {
+    return DROP_OLDEST;
+  } else if (str == "drop_below_level") {
+    return DROP_BELOW_LEVEL;
+  } else if (str == "spill") {
+    return SPILL;
   }
-};
+  return BLOCK;
+}
 
-class LevelFormatItem : public LogFormatter::FormatItem {
- public:
-  LevelFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-    os << LogLevel::ToString(level);
+const char *LogOverflow::ToString(Policy policy) {
+  switch (policy) {
+    case DROP_NEWEST:
+      return "drop_newest";
+    case DROP_OLDEST:
+      return "drop_oldest";
+    case DROP_BELOW_LEVEL:
+      return "drop_below_level";
+    case SPILL:
+      return "spill";
+    default:
+      return "block";
   }
-};
+}
 
-class NameFormatItem : public LogFormatter::FormatItem {
- public:
-  NameFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-    os << event->getLogger()->getName();  // event中是最原始的logger 否则可能是root写的
+static const char s_digitPairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+// 无符号整数转十进制 返回写入的长度 每次除以100查表输出两位
+static size_t FormatUint(char *buf, uint64_t val) {
+  char tmp[20];
+  char *p = tmp + sizeof(tmp);
+  while (val >= 100) {
+    const char *d = s_digitPairs + (val % 100) * 2;
+    val /= 100;
+    *--p = d[1];
+    *--p = d[0];
   }
-};
+  if (val >= 10) {
+    *--p = s_digitPairs[val * 2 + 1];
+    *--p = s_digitPairs[val * 2];
+  } else {
+    *--p = '0' + val;
+  }
+  size_t n = tmp + sizeof(tmp) - p;
+  memcpy(buf, p, n);
+  return n;
+}
 
-class ThreadIdFormatItem : public LogFormatter::FormatItem {
- public:
-  ThreadIdFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-    os << event->getThreadId();
+static size_t FormatInt(char *buf, int64_t val) {
+  if (val < 0) {
+    buf[0] = '-';
+    return 1 + FormatUint(buf + 1, 0 - (uint64_t)val);
   }
-};
+  return FormatUint(buf, val);
+}
 
-class FiberIdFormatItem : public LogFormatter::FormatItem {
- public:
-  FiberIdFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-    os << event->getFiberId();
+// json字符串中每个字节的转义方式 0表示不需要转义 'u'表示\u00XX
+static const struct JsonEscapeTable {
+  char map[256];
+  JsonEscapeTable() {
+    memset(map, 0, sizeof(map));
+    for (int i = 0; i < 0x20; ++i) {
+      map[i] = 'u';
+    }
+    map[(uint8_t)'"'] = '"';
+    map[(uint8_t)'\\'] = '\\';
+    map['\b'] = 'b';
+    map['\f'] = 'f';
+    map['\n'] = 'n';
+    map['\r'] = 'r';
+    map['\t'] = 't';
   }
-};
+} s_json_escape;
 
-class ElapseFormatItem : public LogFormatter::FormatItem {
- public:
-  ElapseFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-    os << event->getElapse();
+// 8个字节中是否可能有需要转义的字节(小于0x20 双引号 反斜杠) 可能误报但不会漏报
+static inline bool JsonWordNeedsEscape(const char *p) {
+  static const uint64_t s_ones = 0x0101010101010101ull;
+  static const uint64_t s_highs = 0x8080808080808080ull;
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+  uint64_t ctrl = (w - s_ones * 0x20) & ~w;
+  uint64_t quote = w ^ (s_ones * '"');
+  quote = (quote - s_ones) & ~quote;
+  uint64_t slash = w ^ (s_ones * '\\');
+  slash = (slash - s_ones) & ~slash;
+  return ((ctrl | quote | slash) & s_highs) != 0;
+}
+
+// json字符串转义 每次检查8个字节 不需要转义的连续内容整段拷贝 buf至少要有len * 6字节
+// 大于0x7f的字节(UTF-8)原样输出
+static size_t JsonEscape(char *buf, const char *data, size_t len) {
+  char *p = buf;
+  size_t i = 0;
+  while (i < len) {
+    size_t j = i;
+    while (true) {
+      while (j + 8 <= len && !JsonWordNeedsEscape(data + j)) {
+        j += 8;
+      }
+      size_t end = std::min(j + 8, len);
+      while (j < end && !s_json_escape.map[(uint8_t)data[j]]) {
+        ++j;
+      }
+      if (j < end || j >= len) {
+        break;
+      }
+    }
+    memcpy(p, data + i, j - i);
+    p += j - i;
+    if (j >= len) {
+      break;
+    }
+    char c = s_json_escape.map[(uint8_t)data[j]];
+    *p++ = '\\';
+    *p++ = c;
+    if (c == 'u') {
+      *p++ = '0';
+      *p++ = '0';
+      *p++ = "0123456789abcdef"[(uint8_t)data[j] >> 4];
+      *p++ = "0123456789abcdef"[(uint8_t)data[j] & 0xf];
+    }
+    i = j + 1;
   }
-};
+  return p - buf;
+}
 
-class DateTimeFormatItem : public LogFormatter::FormatItem {
+static void JsonAppendString(std::string &out, const char *data, size_t len) {
+  size_t old = out.size();
+  out.resize(old + len * 6 + 2);
+  char *p = &out[old];
+  *p++ = '"';
+  p += JsonEscape(p, data, len);
+  *p++ = '"';
+  out.resize(p - out.data());
+}
+
+// 定长内存块池 每个线程缓存少量空闲块 多出来的放进全局无锁队列供其他线程取用
+// 异步模式下事件在后台线程释放 内存块经由全局队列回到生产线程
+template <size_t BlockSize>
+class LogBlockPool {
  public:
-  DateTimeFormatItem(const std::string &format = "%Y-%m-%d %H:%M:%S") : m_format(format) {
-    if (m_format.empty()) {
-      m_format = "%Y-%m-%d %H:%M:%S";
+  static void *Alloc() {
+    LocalCache *local = GetLocal();
+    if (local && local->count) {
+      return local->blocks[--local->count];
     }
+    void *ptr = nullptr;
+    if (GetGlobal()->pop(ptr)) {
+      return ptr;
+    }
+    return ::operator new(BlockSize);
   }
 
-  void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-    struct tm tm;
-    time_t time = event->getTime();
-    localtime_r(&time, &tm);
-    char buf[64];
-    strftime(buf, sizeof(buf), m_format.c_str(), &tm);
-    os << buf;
+  static void Free(void *ptr) {
+    LocalCache *local = GetLocal();
+    if (local && local->count < s_local_size) {
+      local->blocks[local->count++] = ptr;
+      return;
+    }
+    if (!GetGlobal()->push(ptr)) {
+      ::operator delete(ptr);
+    }
   }
 
  private:
-  std::string m_format;
-};
+  static const size_t s_local_size = 32;
 
-class FilenameFormatItem : public LogFormatter::FormatItem {
- public:
-  FilenameFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-    os << event->getFile();
+  struct LocalCache {
+    ~LocalCache() {
+      Destroyed() = true;
+      for (size_t i = 0; i < count; ++i) {
+        if (!GetGlobal()->push(blocks[i])) {
+          ::operator delete(blocks[i]);
+        }
+      }
+    }
+    void *blocks[s_local_size];
+    size_t count = 0;
+  };
+
+  // 线程退出时线程局部缓存先析构 之后再释放的块直接走全局队列
+  static bool &Destroyed() {
+    static thread_local bool t_destroyed = false;
+    return t_destroyed;
   }
-};
 
-class LineFormatItem : public LogFormatter::FormatItem {
- public:
-  LineFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-    os << event->getLine();
+  static LocalCache *GetLocal() {
+    if (Destroyed()) {
+      return nullptr;
+    }
+    static thread_local LocalCache t_cache;
+    return &t_cache;
   }
-};
 
-class NewLineFormatItem : public LogFormatter::FormatItem {
- public:
-  NewLineFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-    os << std::endl;
+  // 进程退出时不释放 避免静态对象析构顺序的问题
+  static BoundedQueue<void *> *GetGlobal() {
+    static BoundedQueue<void *> *s_global = new BoundedQueue<void *>(4096);
+    return s_global;
   }
 };
 
-class StringFormatItem : public LogFormatter::FormatItem {
+// allocate_shared用的分配器 事件对象连同shared_ptr的控制块一起从内存块池分配
+template <class T>
+class LogEventAllocator {
  public:
-  StringFormatItem(const std::string &str) : m_format(str) {}
-  void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-    os << m_format;
+  typedef T value_type;
+
+  LogEventAllocator() {}
+  template <class U>
+  LogEventAllocator(const LogEventAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    if (n == 1) {
+      return (T *)LogBlockPool<sizeof(T)>::Alloc();
+    }
+    return (T *)::operator new(n * sizeof(T));
   }
 
- private:
-  std::string m_format;
+  void deallocate(T *ptr, size_t n) {
+    if (n == 1) {
+      LogBlockPool<sizeof(T)>::Free(ptr);
+    } else {
+      ::operator delete(ptr);
+    }
+  }
 };
 
-class TabFormatItem : public LogFormatter::FormatItem {
- public:
-  TabFormatItem(const std::string &str = "") {}
-  void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override {
-    os << "\t";
+template <class T, class U>
+bool operator==(const LogEventAllocator<T> &, const LogEventAllocator<U> &) {
+  return true;
+}
+
+template <class T, class U>
+bool operator!=(const LogEventAllocator<T> &, const LogEventAllocator<U> &) {
+  return false;
+}
+
+LogStream::~LogStream() {
+  if (m_data != m_inline) {
+    delete[] m_data;
   }
-};
+}
+
+void LogStream::grow(size_t len) {
+  size_t capacity = m_capacity * 2;
+  while (capacity < m_size + len) {
+    capacity *= 2;
+  }
+  char *data = new char[capacity];
+  memcpy(data, m_data, m_size);
+  if (m_data != m_inline) {
+    delete[] m_data;
+  }
+  m_data = data;
+  m_capacity = capacity;
+}
+
+LogStream &LogStream::operator<<(bool v) {
+  append(v ? "1" : "0", 1);  // 与ostream默认行为一致
+  return *this;
+}
+
+LogStream &LogStream::operator<<(char v) {
+  append(&v, 1);
+  return *this;
+}
+
+LogStream &LogStream::operator<<(long long v) {
+  if (m_base != 10) {
+    return *this << (unsigned long long)v;
+  }
+  char *p = reserve(21);
+  commit(FormatInt(p, v));
+  return *this;
+}
+
+LogStream &LogStream::operator<<(unsigned long long v) {
+  if (m_base == 16) {
+    appendHex(v);
+    return *this;
+  }
+  char *p = reserve(24);
+  if (m_base == 10) {
+    commit(FormatUint(p, v));
+  } else {
+    commit(snprintf(p, 24, "%llo", v));
+  }
+  return *this;
+}
+
+LogStream &LogStream::operator<<(double v) {
+  // 绝对值小于1e6的整数值 %g的结果就是整数本身
+  if (v > -1e6 && v < 1e6 && v == (double)(long long)v && !(v == 0 && std::signbit(v))) {
+    char *p = reserve(21);
+    commit(FormatInt(p, (long long)v));
+    return *this;
+  }
+  char *p = reserve(32);
+  int len = snprintf(p, 32, "%g", v);  // 与ostream默认的精度6一致
+  commit(std::min(len, 31));
+  return *this;
+}
+
+LogStream &LogStream::operator<<(long double v) {
+  char *p = reserve(48);
+  int len = snprintf(p, 48, "%Lg", v);
+  commit(std::min(len, 47));
+  return *this;
+}
+
+LogStream &LogStream::operator<<(const void *v) {
+  char *p = reserve(24);
+  int len = snprintf(p, 24, "%p", v);
+  commit(std::min(len, 23));
+  return *this;
+}
+
+LogStream &LogStream::operator<<(const char *v) {
+  if (v) {
+    append(v, strlen(v));
+  }
+  return *this;
+}
+
+void LogStream::appendHex(unsigned long long v) {
+  char tmp[16];
+  char *p = tmp + sizeof(tmp);
+  do {
+    *--p = "0123456789abcdef"[v & 0xf];
+    v >>= 4;
+  } while (v);
+  append(p, tmp + sizeof(tmp) - p);
+}
+
+void LogStream::appendFixed(double v, int precision) {
+  static const double s_pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+  // 放大后能用64位整数精确表示时直接按整数输出 舍入方式与printf相同(就近 恰好一半时取偶)
+  // 其他情况(精度过大 数值过大 nan inf)交给snprintf
+  if (precision > 9 || !(std::fabs(v) < 1e15 / s_pow10[precision])) {
+    char *p = reserve(64);
+    int len = snprintf(p, 64, "%.*f", std::min(precision, 17), v);
+    if (len >= 64) {
+      p = reserve(len + 1);
+      snprintf(p, len + 1, "%.*f", std::min(precision, 17), v);
+    }
+    commit(len);
+    return;
+  }
+  char *p = reserve(40);
+  char *begin = p;
+  if (std::signbit(v)) {
+    *p++ = '-';
+    v = -v;
+  }
+  uint64_t scaled = (uint64_t)std::nearbyint(v * s_pow10[precision]);
+  uint64_t unit = (uint64_t)s_pow10[precision];
+  p += FormatUint(p, scaled / unit);
+  if (precision > 0) {
+    *p++ = '.';
+    uint64_t frac = scaled % unit;
+    for (int i = precision - 1; i >= 0; --i) {
+      p[i] = '0' + frac % 10;
+      frac /= 10;
+    }
+    p += precision;
+  }
+  commit(p - begin);
+}
+
+const char *LogStream::nextPlaceholder(const char *fmt, FormatSpec &spec) {
+  const char *p = fmt;
+  while (*p) {
+    if ((p[0] == '{' && p[1] == '{') || (p[0] == '}' && p[1] == '}')) {
+      append(fmt, p + 1 - fmt);  // 输出一个花括号
+      p += 2;
+      fmt = p;
+    } else if (*p == '{') {
+      append(fmt, p - fmt);
+      const char *end = strchr(p, '}');
+      if (!end) {
+        append(p, strlen(p));
+        return nullptr;
+      }
+      spec.begin = p;
+      if (p[1] == ':') {
+        if (p[2] == 'x' && p + 3 == end) {
+          spec.hex = true;
+        } else if (p[2] == '.' && isdigit(p[3])) {
+          spec.precision = atoi(p + 3);
+        }
+      }
+      return end + 1;
+    } else {
+      ++p;
+    }
+  }
+  append(fmt, p - fmt);
+  return nullptr;
+}
+
+void LogStream::formatNext(const char *fmt) {
+  FormatSpec spec;
+  while (const char *next = nextPlaceholder(fmt, spec)) {
+    append(spec.begin, next - spec.begin);  // 没有对应参数的占位符原样输出
+    fmt = next;
+  }
+}
+
+void LogStream::appendFieldKey(const char *key) {
+  m_fields.push_back(',');
+  JsonAppendString(m_fields, key, strlen(key));
+  m_fields.push_back(':');
+}
+
+LogStream &LogStream::field(const char *key, const char *value) {
+  appendFieldKey(key);
+  if (value) {
+    JsonAppendString(m_fields, value, strlen(value));
+  } else {
+    m_fields.append("null");
+  }
+  return *this;
+}
+
+LogStream &LogStream::field(const char *key, const std::string &value) {
+  appendFieldKey(key);
+  JsonAppendString(m_fields, value.data(), value.size());
+  return *this;
+}
+
+LogStream &LogStream::field(const char *key, bool value) {
+  appendFieldKey(key);
+  m_fields.append(value ? "true" : "false");
+  return *this;
+}
+
+LogStream &LogStream::field(const char *key, double value) {
+  appendFieldKey(key);
+  if (std::isfinite(value)) {
+    char buf[32];
+    m_fields.append(buf, std::min(snprintf(buf, sizeof(buf), "%.17g", value), 31));
+  } else {
+    m_fields.append("null");  // json没有nan和inf
+  }
+  return *this;
+}
+
+LogStream &LogStream::fieldInt(const char *key, long long value) {
+  appendFieldKey(key);
+  char buf[24];
+  m_fields.append(buf, FormatInt(buf, value));
+  return *this;
+}
+
+LogStream &LogStream::fieldUint(const char *key, unsigned long long value) {
+  appendFieldKey(key);
+  char buf[24];
+  m_fields.append(buf, FormatUint(buf, value));
+  return *this;
+}
+
+LogStream &LogStream::operator<<(std::ostream &(*pf)(std::ostream &)) {
+  typedef std::ostream &(*Manip)(std::ostream &);
+  if (pf == (Manip)std::endl) {
+    append("\n", 1);
+  } else if (pf == (Manip)std::ends) {
+    append("\0", 1);
+  }
+  return *this;
+}
+
+LogStream &LogStream::operator<<(std::ios_base &(*pf)(std::ios_base &)) {
+  typedef std::ios_base &(*Manip)(std::ios_base &);
+  if (pf == (Manip)std::hex) {
+    m_base = 16;
+  } else if (pf == (Manip)std::oct) {
+    m_base = 8;
+  } else if (pf == (Manip)std::dec) {
+    m_base = 10;
+  }
+  return *this;
+}
 
 // C++类成员变量的初始化顺序与其在类中的声明顺序有关
-LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level, const char *file, int32_t line,
-                   uint32_t elapse, uint32_t threadId, uint32_t fiberId, uint64_t time)
-    : m_file(file),
-      m_line(line),
+LogEvent::LogEvent(std::shared_ptr<Logger> logger, const LogSite *site, LogLevel::Level level, uint32_t elapse,
+                   uint32_t threadId, uint32_t fiberId, uint64_t time)
+    : m_site(site),
       m_elapse(elapse),
       m_threadId(threadId),
       m_fiberId(fiberId),
+      m_level(level),
       m_time(time),
-      m_logger(logger),
-      m_level(level) {}
+      m_logger(std::move(logger)) {}
 
 void LogEvent::format(const char *fmt, ...) {
   va_list vl;
@@ -199,208 +585,3032 @@ void LogEvent::format(const char *fmt, ...) {
 }
 
 void LogEvent::format(const char *fmt, va_list vl) {
-  char *buf = nullptr;
-  int len = vasprintf(&buf, fmt, vl);  // 不需要识别参数的个数和每个参数的类型 只需要将可变列表拷贝到缓冲区
-  if (len != -1) {                     // va_arg则是通过设置的参数类型依次获取各个参数
-    m_ss << std::string(buf, len);
-    free(buf);
+  // 先直接写进内容缓冲的剩余空间 放不下时按需要的长度扩容后再格式化一次
+  va_list copy;
+  va_copy(copy, vl);
+  size_t avail = m_ss.available();
+  int len = vsnprintf(m_ss.reserve(0), avail, fmt, vl);
+  if (len >= 0 && (size_t)len >= avail) {
+    len = vsnprintf(m_ss.reserve(len + 1), len + 1, fmt, copy);
+  }
+  va_end(copy);
+  if (len > 0) {
+    m_ss.commit(len);
+  }
+}
+
+LogEvent::ptr LogEvent::Create(std::shared_ptr<Logger> logger, const LogSite *site, LogLevel::Level level,
+                               uint32_t elapse, uint32_t threadId, uint32_t fiberId, uint64_t time) {
+  return std::allocate_shared<LogEvent>(LogEventAllocator<LogEvent>(), std::move(logger), site, level, elapse,
+                                        threadId, fiberId, time);
+}
+
+LogEvent::ptr LogSampledEvent(std::shared_ptr<Logger> logger, const LogSite *site, LogLevel::Level level,
+                              uint64_t suppressed) {
+  if (suppressed) {
+    LogEvent::ptr summary = LogEvent::Create(logger, site, level);
+    summary->getSS() << "suppressed " << suppressed << " messages";
+    logger->log(level, summary);
   }
+  return LogEvent::Create(std::move(logger), site, level);
+}
+
+LogEvent::ptr LogEvent::Create(std::shared_ptr<Logger> logger, const LogSite *site, LogLevel::Level level) {
+  uint64_t now = GetFastTimeUS();
+  return Create(std::move(logger), site, level, GetElapsedMS(now), GetThreadId(), GetFiberId(), now);
 }
 
-LogEventWrap::LogEventWrap(LogEvent::ptr event) : m_event(event) {}
+LogEventWrap::LogEventWrap(LogEvent::ptr event) : m_event(std::move(event)) {}
 
 LogEventWrap::~LogEventWrap() { m_event->getLogger()->log(m_event->getLevel(), m_event); }
 
-std::ostream &LogEventWrap::getSS() { return m_event->getSS(); }
+LogStream &LogEventWrap::getSS() { return m_event->getSS(); }
 
-std::shared_ptr<LogEvent> LogEventWrap::getEvent() { return m_event; }
+const std::shared_ptr<LogEvent> &LogEventWrap::getEvent() { return m_event; }
 
-void LogAppender::setFormatter(LogFormatter::ptr formatter) {
-  MutexType::Lock lock(m_mutex);
-  m_formatter = formatter;
-  if (m_formatter) {
-    m_hasFormatter = true;
-  } else {
-    m_hasFormatter = false;
+// 当前线程是否是异步日志的后台线程 它每批处理完都会flush 文件的同步写入可以攒在用户态缓冲里
+// 其他线程的同步写入没有人定时flush 写完立即落到文件 进程崩溃也不会丢
+static thread_local bool t_async_batch = false;
+
+// 线程缓冲被占用的深度 appender写入时又写日志(例如在write里记录错误)会重入
+// 内层不能改动外层正在输出的内容 改用局部的缓冲
+class ThreadBufferGuard {
+ public:
+  ThreadBufferGuard(uint32_t &depth) : m_depth(depth), m_nested(depth++ > 0) {}
+  ~ThreadBufferGuard() { --m_depth; }
+  bool isNested() const { return m_nested; }
+
+ private:
+  uint32_t &m_depth;
+  bool m_nested;
+};
+
+// 每个线程复用的格式化缓冲 容量只增不减 稳态下格式化不再分配内存 重入时使用局部的std::string
+class ThreadFormatBuffer {
+ public:
+  ThreadFormatBuffer() : m_guard(Depth()) {
+    if (!m_guard.isNested()) {
+      Buffer().clear();
+    }
   }
-}
+  std::string &get() { return m_guard.isNested() ? m_local : Buffer(); }
 
-LogFormatter::ptr LogAppender::getFormatter() {
-  MutexType::Lock lock(m_mutex);
-  return m_formatter;
+ private:
+  static uint32_t &Depth() {
+    static thread_local uint32_t t_depth = 0;
+    return t_depth;
+  }
+  static std::string &Buffer() {
+    static thread_local std::string t_buf;
+    return t_buf;
+  }
+
+ private:
+  ThreadBufferGuard m_guard;
+  std::string m_local;
+};
+
+static std::atomic<uint64_t> s_buffer_writer_id{0};
+
+LogBufferWriter::LogBufferWriter(const std::string &name, size_t buffer_size, uint64_t flush_interval,
+                                 OutputCallback cb)
+    : m_id(++s_buffer_writer_id),
+      m_name(name),
+      m_bufferSize(buffer_size),
+      m_flushInterval(flush_interval ? flush_interval : 1),
+      m_cb(cb) {}
+
+LogBufferWriter::~LogBufferWriter() {
+  for (auto &i : m_full) {
+    delete i;
+  }
+  for (auto &i : m_free) {
+    delete i;
+  }
 }
 
-Logger::Logger(const std::string &name) : m_name(name), m_level(LogLevel::DEBUG) {
-  m_formatter.reset(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%T%m%n"));
+void LogBufferWriter::start() {
+  auto self = shared_from_this();
+  m_thread.reset(new Thread([self]() { self->run(); }, "logbuf"));
 }
 
-void Logger::addAppender(LogAppender::ptr appender) {
-  MutexType::Lock lock(m_mutex);
-  if (!appender->getFormatter()) {
-    MutexType::Lock ll(appender->m_mutex);
-    appender->m_formatter = m_formatter;  // 不改变m_hasFormatter的值 toYamlString的时候就不会输出父节点的formatter
+void LogBufferWriter::stop() {
+  if (m_stopping.exchange(true)) {
+    return;
+  }
+  m_semaphore.notify();
+  if (m_thread && Thread::GetThis() != m_thread.get()) {
+    m_thread->join();
   }
-  m_appenders.push_back(appender);
 }
 
-void Logger::delAppender(LogAppender::ptr appender) {
-  MutexType::Lock lock(m_mutex);
-  auto it = m_appenders.begin();
-  for (; it != m_appenders.end(); ++it) {
-    if (*it == appender) {
-      m_appenders.erase(it);
+LogBufferWriter::ThreadBuffer *LogBufferWriter::getThreadBuffer() {
+  // 上次用到的缓冲 平凡类型的thread_local访问时不用经过初始化检查
+  // 缓冲由t_buffers持有 writer的id不会重复 id相同时指针一定有效
+  static thread_local uint64_t t_last_id = 0;
+  static thread_local ThreadBuffer *t_last = nullptr;
+  if (t_last_id == m_id) {
+    return t_last;
+  }
+  // 线程局部的 writer id -> 缓冲 映射 一个线程一般只会写少数几个文件 线性查找即可
+  static thread_local std::vector<std::pair<uint64_t, ThreadBuffer::ptr>> t_buffers;
+  for (auto &i : t_buffers) {
+    if (i.first == m_id) {
+      t_last_id = m_id;
+      t_last = i.second.get();
+      return t_last;
+    }
+  }
+
+  ThreadBuffer::ptr tb(new ThreadBuffer);
+  {
+    MutexType::Lock lock(m_mutex);
+    m_threads.push_back(tb);
+  }
+  // 顺便清理已经析构的writer留下的缓冲
+  for (auto it = t_buffers.begin(); it != t_buffers.end();) {
+    if (it->second.unique()) {
+      it = t_buffers.erase(it);
+    } else {
+      ++it;
     }
   }
+  t_buffers.push_back(std::make_pair(m_id, tb));
+  t_last_id = m_id;
+  t_last = tb.get();
+  return t_last;
 }
 
-void Logger::clearAppenders() { 
-  MutexType::Lock lock(m_mutex);
-  m_appenders.clear();
+LogBufferWriter::Buffer *LogBufferWriter::acquireBuffer(size_t min_size) {
+  if (min_size <= m_bufferSize) {
+    MutexType::Lock lock(m_mutex);
+    if (!m_free.empty()) {
+      Buffer *buf = m_free.back();
+      m_free.pop_back();
+      return buf;
+    }
+  }
+  return new Buffer(std::max(min_size, m_bufferSize));
 }
 
-void Logger::setFormatter(const LogFormatter::ptr val) {
-  MutexType::Lock lock(m_mutex);
-  m_formatter = val;
-  // 更改父节点的formatter会影响到子节点的formatter
-  for (auto& i : m_appenders) {
-    // MutexType::Lock ll(i->m_mutex);
-    if (!i->m_hasFormatter) {
-      i->setFormatter(m_formatter);
+void LogBufferWriter::handOff(Buffer *buf) {
+  // 最多积压64块 后台线程跟不上时让生产线程等一等 避免内存无限增长
+  static const size_t s_max_pending = 64;
+  while (true) {
+    {
+      MutexType::Lock lock(m_mutex);
+      if (m_full.size() < s_max_pending || m_stopping) {
+        m_full.push_back(buf);
+        break;
+      }
     }
+    m_semaphore.notify();
+    sched_yield();
   }
+  m_semaphore.notify();
 }
 
-void Logger::setFormatter(const std::string &val) {
-  LogFormatter::ptr new_val(new LogFormatter(val));
-  if (new_val->isError()) {
+void LogBufferWriter::append(const char *data, size_t len, const LogIndex::Summary *summary) {
+  if (m_stopping) {
+    // 已经停止 直接输出
+    struct iovec iov;
+    iov.iov_base = (void *)data;
+    iov.iov_len = len;
+    LogIndex::Summary unknown;
+    MutexType::Lock lock(m_outputMutex);
+    m_cb(&iov, 1, summary ? summary : &unknown);
     return;
   }
-  setFormatter(new_val);
-}
 
-LogFormatter::ptr Logger::getFormatter() {
-  MutexType::Lock lock(m_mutex);
-  return m_formatter;
+  ThreadBuffer *tb = getThreadBuffer();
+  Buffer *full = nullptr;
+  {
+    CASLock::Lock lock(tb->mutex);
+    if (tb->current && tb->current->size + len > tb->current->capacity) {
+      full = tb->current;  // 写满了 换一块缓冲
+      tb->current = nullptr;
+    }
+    if (!tb->current) {
+      tb->current = acquireBuffer(len);
+    }
+    memcpy(tb->current->data + tb->current->size, data, len);
+    tb->current->size += len;
+    if (summary) {
+      tb->current->summary.merge(*summary);
+    }
+  }
+  if (full) {
+    handOff(full);
+  }
 }
 
-void Logger::log(LogLevel::Level level, LogEvent::ptr event) {
-  if (level >= m_level) {
-    auto self = shared_from_this();
+void LogBufferWriter::flush() { collect(true); }
+
+void LogBufferWriter::collect(bool collect_partial) {
+  MutexType::Lock output_lock(m_outputMutex);
+  std::vector<Buffer *> bufs;
+  {
     MutexType::Lock lock(m_mutex);
-    if (!m_appenders.empty()) {
-      for (auto &i : m_appenders) {
-        // MutexType::Lock ll(i->m_mutex);
-        i->log(self, level, event);
+    bufs.swap(m_full);
+  }
+
+  if (collect_partial) {
+    std::vector<ThreadBuffer::ptr> threads;
+    {
+      MutexType::Lock lock(m_mutex);
+      threads = m_threads;
+    }
+    for (auto &tb : threads) {
+      CASLock::Lock lock(tb->mutex);
+      if (tb->current && tb->current->size) {
+        bufs.push_back(tb->current);
+        tb->current = nullptr;
+      }
+    }
+    threads.clear();
+    {
+      // 线程已经退出的缓冲只剩这里一份引用 数据已经收集过了 可以丢掉
+      MutexType::Lock lock(m_mutex);
+      for (auto it = m_threads.begin(); it != m_threads.end();) {
+        if (it->unique()) {
+          it = m_threads.erase(it);
+        } else {
+          ++it;
+        }
       }
-    } else if (m_root) {
-      m_root->log(level, event);
     }
   }
-}
 
-std::string Logger::toYamlString() {
+  if (bufs.empty()) {
+    return;
+  }
+
+  std::vector<struct iovec> iov(bufs.size());
+  std::vector<LogIndex::Summary> summaries(bufs.size());
+  for (size_t i = 0; i < bufs.size(); ++i) {
+    iov[i].iov_base = bufs[i]->data;
+    iov[i].iov_len = bufs[i]->size;
+    summaries[i] = bufs[i]->summary;
+  }
+  m_cb(&iov[0], (int)iov.size(), &summaries[0]);
+
   MutexType::Lock lock(m_mutex);
-  YAML::Node node;
-  node["name"] = m_name;
+  for (auto &i : bufs) {
+    if (i->capacity == m_bufferSize && m_free.size() < 16) {
+      i->size = 0;
+      i->summary.clear();
+      m_free.push_back(i);
+    } else {
+      delete i;
+    }
+  }
+}
+
+void LogBufferWriter::run() {
+  while (!m_stopping) {
+    if (m_semaphore.timedWait(m_flushInterval)) {
+      collect(false);  // 有缓冲写满了 只写满的那些
+    } else {
+      collect(true);  // 超时 连同没写满的一起写出去
+    }
+  }
+  collect(true);
+}
+
+LogMetrics::LogMetrics() {
+  void *p = nullptr;
+  if (posix_memalign(&p, alignof(Slot), sizeof(Slot) * kSlots)) {
+    throw std::bad_alloc();
+  }
+  m_slots = static_cast<Slot *>(p);
+  for (size_t i = 0; i < kSlots; ++i) {
+    new (&m_slots[i]) Slot();
+  }
+}
+
+LogMetrics::~LogMetrics() { free(m_slots); }
+
+size_t LogMetrics::SlotIndex() {
+  // 线程按创建顺序轮流分配槽位 线程数超过kSlots时才会有线程共用一个槽位
+  static std::atomic<size_t> s_next{0};
+  static thread_local size_t t_slot = s_next.fetch_add(1, std::memory_order_relaxed) % kSlots;
+  return t_slot;
+}
+
+bool LogMetrics::SampleLatency() {
+  static thread_local uint32_t t_count = 0;
+  return (t_count++ & 15) == 0;
+}
+
+void LogMetrics::addLatency(uint64_t ns) {
+  size_t idx = ns ? 63 - __builtin_clzll(ns) : 0;
+  slot().latency[std::min(idx, kLatencyBuckets - 1)].fetch_add(1, std::memory_order_relaxed);
+}
+
+LogMetrics::Snapshot LogMetrics::snapshot() const {
+  Snapshot snap;
+  for (size_t i = 0; i < kSlots; ++i) {
+    for (size_t j = 0; j < COUNTER_NUM; ++j) {
+      snap.counters[j] += m_slots[i].counters[j].load(std::memory_order_relaxed);
+    }
+    for (size_t j = 0; j < kLatencyBuckets; ++j) {
+      snap.latency[j] += m_slots[i].latency[j].load(std::memory_order_relaxed);
+    }
+  }
+  return snap;
+}
+
+uint64_t LogMetrics::Snapshot::getLatencySamples() const {
+  uint64_t total = 0;
+  for (auto &i : latency) {
+    total += i;
+  }
+  return total;
+}
+
+uint64_t LogMetrics::Snapshot::getLatencyPercentile(double p) const {
+  uint64_t total = getLatencySamples();
+  if (!total) {
+    return 0;
+  }
+  uint64_t target = std::max((uint64_t)1, (uint64_t)ceil(p * total));
+  uint64_t sum = 0;
+  for (size_t i = 0; i < kLatencyBuckets; ++i) {
+    sum += latency[i];
+    if (sum >= target) {
+      return 2ull << i;
+    }
+  }
+  return 2ull << (kLatencyBuckets - 1);
+}
+
+static uint64_t MonotonicNS() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+bool LogAppender::append(LogLevel::Level level, const char *data, size_t len, const LogEvent *event) {
+  if (LogMetrics::SampleLatency()) {
+    uint64_t begin = MonotonicNS();
+    if (!(event ? writeEvent(level, *event, data, len) : write(level, data, len))) {
+      return false;
+    }
+    m_metrics.addLatency(MonotonicNS() - begin);
+  } else if (!(event ? writeEvent(level, *event, data, len) : write(level, data, len))) {
+    return false;
+  }
+  m_metrics.add(LogMetrics::EVENTS);
+  m_metrics.add(LogMetrics::BYTES, len);
+  return true;
+}
+
+void LogAppender::storeFormatter(const LogFormatter::ptr &formatter) {
+  if (m_formatter == formatter) {
+    return;
+  }
+  if (m_formatter) {
+    m_oldFormatters.push_back(m_formatter);
+  }
+  m_formatter = formatter;
+  m_rawFormatter.store(formatter.get(), std::memory_order_release);
+}
+
+void LogAppender::setFormatter(LogFormatter::ptr formatter) {
+  MutexType::Lock lock(m_mutex);
+  storeFormatter(formatter);
+  if (m_formatter) {
+    m_hasFormatter = true;
+  } else {
+    m_hasFormatter = false;
+  }
+}
+
+LogFormatter::ptr LogAppender::getFormatter() {
+  MutexType::Lock lock(m_mutex);
+  return m_formatter;
+}
+
+// 保护所有日志器之间的父子关系以及生效级别和输出目标的计算
+// LogManager可能在其他文件的全局变量初始化时就被用到 用函数内的静态变量保证使用前已经构造
+static Mutex &GetHierarchyMutex() {
+  static Mutex s_mutex;
+  return s_mutex;
+}
+
+Logger::Logger(const std::string &name)
+    : m_name(name),
+      m_indexBits(LogIndex::LoggerBits(name)),
+      m_level(LogLevel::DEBUG),
+      m_effectiveLevel(LogLevel::DEBUG),
+      m_sink(this) {
+  m_formatter.reset(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%T%m%n"));
+  m_appenders = std::make_shared<const AppenderList>();
+}
+
+Logger::~Logger() {
+  LogAsyncWorker::ptr async = std::atomic_load(&m_async);
+  if (async) {
+    async->stop();
+  }
+  // 二进制日志写出时会统计到m_metrics 在它析构之前写完
+  for (auto &i : m_binaryWriters) {
+    i->stop();
+  }
+  if (m_parent) {
+    Mutex::Lock lock(GetHierarchyMutex());
+    auto &children = m_parent->m_children;
+    children.erase(std::remove(children.begin(), children.end(), this), children.end());
+  }
+}
+
+void Logger::setLevel(LogLevel::Level level) {
+  Mutex::Lock lock(GetHierarchyMutex());
+  m_level = level;
+  resolve();
+}
+
+void Logger::setParent(const Logger::ptr &parent) {
+  if (m_parent) {
+    auto &children = m_parent->m_children;
+    children.erase(std::remove(children.begin(), children.end(), this), children.end());
+  }
+  m_parent = parent;
+  if (m_parent) {
+    m_parent->m_children.push_back(this);
+  }
+  resolve();
+}
+
+void Logger::resolve() {
+  m_effectiveLevel.store((m_level != LogLevel::UNKNOW || !m_parent) ? m_level : m_parent->getLevel(),
+                         std::memory_order_relaxed);
+  bool has_appenders = !std::atomic_load(&m_appenders)->empty();
+  m_sink.store((has_appenders || !m_parent) ? this : m_parent->m_sink.load(), std::memory_order_release);
+  for (auto &i : m_children) {
+    i->resolve();
+  }
+}
+
+void Logger::addAppender(LogAppender::ptr appender) {
+  MutexType::Lock lock(m_mutex);
+  if (!appender->getFormatter()) {
+    MutexType::Lock ll(appender->m_mutex);
+    appender->storeFormatter(m_formatter);  // 不改变m_hasFormatter的值 toYamlString的时候就不会输出父节点的formatter
+  }
+  // 在副本上修改后整体替换 正在写日志的线程继续使用它们手里的旧快照
+  std::shared_ptr<AppenderList> appenders(new AppenderList(*m_appenders));
+  appenders->push_back(appender);
+  std::atomic_store(&m_appenders, std::shared_ptr<const AppenderList>(std::move(appenders)));
+  Mutex::Lock ll(GetHierarchyMutex());
+  resolve();
+}
+
+void Logger::delAppender(LogAppender::ptr appender) {
+  MutexType::Lock lock(m_mutex);
+  std::shared_ptr<AppenderList> appenders(new AppenderList);
+  appenders->reserve(m_appenders->size());
+  for (auto &i : *m_appenders) {
+    if (i != appender) {
+      appenders->push_back(i);
+    }
+  }
+  std::atomic_store(&m_appenders, std::shared_ptr<const AppenderList>(std::move(appenders)));
+  Mutex::Lock ll(GetHierarchyMutex());
+  resolve();
+}
+
+void Logger::setAppenders(const AppenderList &appenders) {
+  MutexType::Lock lock(m_mutex);
+  for (auto &i : appenders) {
+    MutexType::Lock ll(i->m_mutex);
+    if (!i->m_formatter) {
+      i->storeFormatter(m_formatter);
+    }
+  }
+  std::atomic_store(&m_appenders, std::make_shared<const AppenderList>(appenders));
+  Mutex::Lock ll(GetHierarchyMutex());
+  resolve();
+}
+
+void Logger::clearAppenders() {
+  MutexType::Lock lock(m_mutex);
+  std::atomic_store(&m_appenders, std::make_shared<const AppenderList>());
+  Mutex::Lock ll(GetHierarchyMutex());
+  resolve();
+}
+
+void Logger::setFormatter(const LogFormatter::ptr val) {
+  MutexType::Lock lock(m_mutex);
+  m_formatter = val;
+  // 更改父节点的formatter会影响到子节点的formatter
+  for (auto &i : *m_appenders) {
+    if (!i->m_hasFormatter) {
+      i->setFormatter(m_formatter);
+    }
+  }
+}
+
+void Logger::setFormatter(const std::string &val) {
+  LogFormatter::ptr new_val(new LogFormatter(val));
+  if (new_val->isError()) {
+    return;
+  }
+  setFormatter(new_val);
+}
+
+LogFormatter::ptr Logger::getFormatter() {
+  MutexType::Lock lock(m_mutex);
+  return m_formatter;
+}
+
+void Logger::log(LogLevel::Level level, const LogEvent::ptr &event) {
+  if (level >= m_effectiveLevel.load(std::memory_order_relaxed)) {
+    m_metrics.add(LogMetrics::EVENTS);
+    LogAsyncWorker::ptr async = std::atomic_load(&m_async);
+    Logger *sink = m_sink.load(std::memory_order_acquire);
+    if (!async && sink != this) {
+      async = std::atomic_load(&sink->m_async);  // 借用输出目标的异步队列
+    }
+    if (async) {
+      async->push(shared_from_this(), level, event);
+    } else {
+      dispatch(level, event);
+    }
+  } else {
+    m_metrics.add(LogMetrics::FILTERED);
+  }
+}
+
+void Logger::dispatch(LogLevel::Level level, const LogEvent::ptr &event) {
+  // 自己没有appender时直接用输出目标的 不再逐级调用父日志器
+  Logger *sink = m_sink.load(std::memory_order_acquire);
+  // 只持有快照的引用计数 appender做I/O期间不占用m_mutex 其他线程可以同时写日志或修改配置
+  std::shared_ptr<const AppenderList> appenders = std::atomic_load(&sink->m_appenders);
+  if (appenders->size() == 1) {
+    const LogAppender::ptr &appender = appenders->front();
+    if (level < appender->getLevel()) {
+      appender->m_metrics.add(LogMetrics::FILTERED);
+    } else {
+      appender->log(shared_from_this(), level, event);
+    }
+  } else if (!appenders->empty()) {
+    dispatchShared(*appenders, level, event);
+  }
+}
+
+// 一次分发中用到的不同formatter的格式化结果 按formatter的id区分
+struct RenderCache {
+  static const size_t kMaxFormatters = 8;
+  uint64_t ids[kMaxFormatters];
+  std::string buffers[kMaxFormatters];
+};
+
+void Logger::dispatchShared(const AppenderList &appenders, LogLevel::Level level, const LogEvent::ptr &event) {
+  static thread_local RenderCache t_cache;
+  static thread_local uint32_t t_depth = 0;
+  // 重入时外层的格式化结果还在使用中 内层用临时的缓存
+  ThreadBufferGuard guard(t_depth);
+  std::unique_ptr<RenderCache> nested(guard.isNested() ? new RenderCache : nullptr);
+  RenderCache &cache = nested ? *nested : t_cache;
+  Logger::ptr self;
+  size_t count = 0;
+  for (auto &i : appenders) {
+    if (level < i->getLevel()) {
+      i->m_metrics.add(LogMetrics::FILTERED);
+      continue;
+    }
+    LogFormatter *formatter = i->getRawFormatter();
+    size_t n = 0;
+    while (n < count && cache.ids[n] != formatter->getId()) {
+      ++n;
+    }
+    if (n == count) {
+      if (count == RenderCache::kMaxFormatters) {  // formatter太多 剩下的appender各自格式化
+        i->log(self ? self : (self = shared_from_this()), level, event);
+        continue;
+      }
+      cache.ids[n] = formatter->getId();
+      cache.buffers[n].clear();
+      formatter->format(cache.buffers[n], level, *event);
+      ++count;
+    }
+    const std::string &buf = cache.buffers[n];
+    if (!i->append(level, buf.data(), buf.size(), event.get())) {
+      i->log(self ? self : (self = shared_from_this()), level, event);
+    }
+  }
+}
+
+void Logger::flush() {
+  Logger *sink = m_sink.load(std::memory_order_acquire);
+  std::shared_ptr<const AppenderList> appenders = std::atomic_load(&sink->m_appenders);
+  for (auto &i : *appenders) {
+    i->flush();
+  }
+}
+
+void Logger::setAsync(size_t queue_size, size_t batch_size, uint64_t flush_interval, LogOverflow::Policy overflow,
+                      LogLevel::Level overflow_level, const std::string &spill_file) {
+  LogAsyncWorker::ptr old;
+  {
+    MutexType::Lock lock(m_mutex);
+    if (m_async && m_async->getQueueSize() >= queue_size && m_async->getBatchSize() == batch_size &&
+        m_async->getFlushInterval() == flush_interval && m_async->getOverflow() == overflow &&
+        m_async->getOverflowLevel() == overflow_level && m_async->getSpillFile() == spill_file) {
+      return;
+    }
+    old = m_async;
+    LogAsyncWorker::ptr async(new LogAsyncWorker(m_name, queue_size, batch_size, flush_interval, overflow,
+                                                 overflow_level, spill_file));
+    async->start();
+    std::atomic_store(&m_async, async);
+  }
+  // 新队列已经生效 旧队列中剩余的事件由旧线程输出完再退出
+  if (old) {
+    old->stop();
+  }
+}
+
+void Logger::stopAsync() {
+  LogAsyncWorker::ptr old;
+  {
+    MutexType::Lock lock(m_mutex);
+    old = std::atomic_exchange(&m_async, LogAsyncWorker::ptr());
+  }
+  if (old) {
+    old->stop();
+  }
+}
+
+bool Logger::isAsync() { return !!std::atomic_load(&m_async); }
+
+void Logger::getQueueDepth(size_t &depth, size_t &capacity) {
+  LogAsyncWorker::ptr async = std::atomic_load(&m_async);
+  depth = async ? async->getQueueDepth() : 0;
+  capacity = async ? async->getQueueSize() : 0;
+}
+
+void Logger::setBinary(const std::string &file, size_t buffer_size, uint64_t flush_interval) {
+  BinLogWriter *old = nullptr;
+  {
+    MutexType::Lock lock(m_mutex);
+    old = m_binary.load();
+    if (old && old->getFilename() == file && old->getBufferSize() == buffer_size &&
+        old->getFlushInterval() == flush_interval) {
+      return;
+    }
+    BinLogWriter::ptr writer(
+      new BinLogWriter(file, m_name, m_formatter->getPattern(), buffer_size, flush_interval, &m_metrics));
+    writer->start();
+    m_binaryWriters.push_back(writer);
+    m_binary.store(writer.get());
+  }
+  // 旧文件中缓冲的记录写完后再退出 对象本身保留到日志器销毁
+  if (old) {
+    old->stop();
+  }
+}
+
+void Logger::stopBinary() {
+  BinLogWriter *old = nullptr;
+  {
+    MutexType::Lock lock(m_mutex);
+    old = m_binary.exchange(nullptr);
+  }
+  if (old) {
+    old->stop();
+  }
+}
+
+BinLogWriter::ptr Logger::getBinary() {
+  MutexType::Lock lock(m_mutex);
+  BinLogWriter *cur = m_binary.load();
+  for (auto &i : m_binaryWriters) {
+    if (i.get() == cur) {
+      return i;
+    }
+  }
+  return nullptr;
+}
+
+std::string Logger::toYamlString() {
+  MutexType::Lock lock(m_mutex);
+  YAML::Node node;
+  node["name"] = m_name;
+  if (m_level != LogLevel::UNKNOW) {
+    node["level"] = LogLevel::toString(m_level);
+  }
+  if (m_formatter) {
+    node["formatter"] = m_formatter->getPattern();
+  }
+  if (m_async) {
+    node["async"]["queue_size"] = m_async->getQueueSize();
+    node["async"]["batch_size"] = m_async->getBatchSize();
+    node["async"]["flush_interval"] = m_async->getFlushInterval();
+    if (m_async->getOverflow() != LogOverflow::BLOCK) {
+      node["async"]["overflow"] = LogOverflow::ToString(m_async->getOverflow());
+    }
+    if (m_async->getOverflow() == LogOverflow::DROP_BELOW_LEVEL) {
+      node["async"]["overflow_level"] = LogLevel::toString(m_async->getOverflowLevel());
+    }
+    if (m_async->getOverflow() == LogOverflow::SPILL) {
+      node["async"]["overflow_file"] = m_async->getSpillFile();
+    }
+  }
+  if (BinLogWriter *binary = m_binary.load()) {
+    node["binary"]["file"] = binary->getFilename();
+    node["binary"]["buffer_size"] = binary->getBufferSize();
+    node["binary"]["flush_interval"] = binary->getFlushInterval();
+  }
+  for (auto &i : *m_appenders) {
+    node["appenders"].push_back(YAML::Load(i->toYamlString()));
+  }
+  std::stringstream ss;
+  ss << node;
+  return ss.str();
+}
+
+LogAsyncWorker::LogAsyncWorker(const std::string &name, size_t queue_size, size_t batch_size,
+                               uint64_t flush_interval, LogOverflow::Policy overflow, LogLevel::Level overflow_level,
+                               const std::string &spill_file)
+    : m_name(name),
+      m_queue(queue_size),
+      m_batchSize(batch_size ? batch_size : 1),
+      m_flushInterval(flush_interval ? flush_interval : 1),
+      m_overflow(overflow),
+      m_overflowLevel(overflow_level),
+      m_spillFile(spill_file) {
+  if (m_overflow == LogOverflow::SPILL && m_spillFile.empty()) {
+    m_overflow = LogOverflow::BLOCK;  // 没有溢出文件时退回等待
+  }
+}
+
+void LogAsyncWorker::start() {
+  auto self = shared_from_this();
+  // 线程函数持有worker的引用 logger在后台线程中析构时worker依然有效
+  m_thread.reset(new Thread([self]() { self->run(); }, "log_" + m_name));
+}
+
+void LogAsyncWorker::stop() {
+  if (m_stopping.exchange(true)) {
+    return;
+  }
+  m_semaphore.notify();
+  if (m_thread && Thread::GetThis() != m_thread.get()) {
+    m_thread->join();
+    // 后台线程退出前刚被唤醒的等待者入队的事件
+    Item item;
+    while (m_queue.pop(item)) {
+      item.logger->dispatch(item.level, item.event);
+      item = Item();
+    }
+  }
+  for (uint32_t i = m_waiters.load(); i > 0; --i) {
+    m_spaceSemaphore.notify();
+  }
+}
+
+void LogAsyncWorker::wakeup() {
+  if (m_sleeping.load(std::memory_order_relaxed) && m_sleeping.exchange(false)) {
+    m_semaphore.notify();
+  }
+}
+
+void LogAsyncWorker::push(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
+  if (m_stopping || (m_thread && Thread::GetThis() == m_thread.get())) {
+    // 已经停止或在后台线程内部打日志(appender自己输出日志) 直接同步输出 避免自己等自己
+    logger->dispatch(level, event);
+    return;
+  }
+  Item item;
+  item.logger = std::move(logger);
+  item.level = level;
+  item.event = std::move(event);
+  if (!m_queue.push(std::move(item)) && !overflow(item)) {
+    return;
+  }
+  if (m_queue.size() >= m_batchSize) {
+    wakeup();
+  }
+}
+
+bool LogAsyncWorker::overflow(Item &item) {
+  // 不论怎样处理 都先叫醒后台线程尽快腾出空间
+  wakeup();
+  switch (m_overflow) {
+    case LogOverflow::DROP_NEWEST:
+      item.logger->m_metrics.add(LogMetrics::DROPPED);
+      return false;
+    case LogOverflow::DROP_OLDEST: {
+      Item oldest;
+      while (!m_queue.push(std::move(item))) {
+        // 队列是多消费者的 生产线程可以直接取走最早的一条
+        if (m_queue.pop(oldest)) {
+          oldest.logger->m_metrics.add(LogMetrics::DROPPED);
+          oldest = Item();
+        }
+      }
+      return true;
+    }
+    case LogOverflow::DROP_BELOW_LEVEL:
+      if (item.level < m_overflowLevel) {
+        item.logger->m_metrics.add(LogMetrics::DROPPED);
+        return false;
+      }
+      waitPush(item);
+      return true;
+    case LogOverflow::SPILL:
+      spill(item);
+      return false;
+    default:
+      waitPush(item);
+      return true;
+  }
+}
+
+void LogAsyncWorker::waitPush(Item &item) {
+  while (!m_queue.push(std::move(item))) {
+    if (m_stopping) {
+      // 后台线程可能已经处理完退出 入队就没人输出了 改为同步输出
+      item.logger->dispatch(item.level, item.event);
+      return;
+    }
+    // 先登记再重试一次 后台线程腾出空间后看到登记就会通知 两边交错时不会漏掉
+    m_waiters.fetch_add(1);
+    if (m_queue.push(std::move(item))) {
+      m_waiters.fetch_sub(1);
+      return;
+    }
+    wakeup();
+    m_spaceSemaphore.wait();
+    m_waiters.fetch_sub(1);
+  }
+}
+
+void LogAsyncWorker::spill(const Item &item) {
+  ThreadFormatBuffer tbuf;
+  std::string &buf = tbuf.get();
+  item.logger->getFormatter()->format(buf, item.level, *item.event);
+  Mutex::Lock lock(m_spillMutex);
+  if (!m_spill) {
+    m_spill.reset(new LogFile(m_spillFile));
+  }
+  m_spill->append(buf.data(), buf.size());
+  item.logger->m_metrics.add(LogMetrics::SPILLED);
+}
+
+void LogAsyncWorker::run() {
+  t_async_batch = true;
+  // 持有logger的引用 用户在刷新前释放了最后一个引用时logger依然有效
+  std::vector<Logger::ptr> touched;
+  Item item;
+  uint64_t last_flush = GetCoarseMonotonicUS();
+  while (true) {
+    size_t count = 0;
+    while (count < m_batchSize && m_queue.pop(item)) {
+      item.logger->dispatch(item.level, item.event);
+      if (std::find(touched.begin(), touched.end(), item.logger) == touched.end()) {
+        touched.push_back(item.logger);
+      }
+      item = Item();
+      ++count;
+    }
+    // 这一批腾出了空间 叫醒等待入队的线程 多发的通知只会让它们多试一次
+    if (count) {
+      for (uint32_t i = m_waiters.load(); i > 0; --i) {
+        m_spaceSemaphore.notify();
+      }
+    }
+    // 可能还有积压 没到刷新间隔时继续处理下一批 队列一直满也至少每个间隔刷新一次
+    uint64_t now = GetCoarseMonotonicUS();
+    if (count == m_batchSize && now - last_flush < m_flushInterval * 1000) {
+      continue;
+    }
+    last_flush = now;
+
+    for (auto &i : touched) {
+      i->flush();
+    }
+    // 这里可能释放logger的最后一个引用 ~Logger在本线程里stop() 下面检查m_stopping后退出
+    touched.clear();
+    if (m_overflow == LogOverflow::SPILL) {
+      Mutex::Lock lock(m_spillMutex);
+      if (m_spill) {
+        m_spill->flush();
+      }
+    }
+    if (count == m_batchSize) {
+      continue;
+    }
+
+    if (m_stopping) {
+      if (m_queue.empty()) {
+        break;
+      }
+      continue;
+    }
+    m_sleeping = true;
+    if (!m_queue.empty()) {  // 设置标志前有新事件入队 不能睡
+      m_sleeping = false;
+      continue;
+    }
+    m_semaphore.timedWait(m_flushInterval);
+    m_sleeping = false;
+  }
+}
+
+void Logger::debug(LogEvent::ptr event) { log(LogLevel::DEBUG, event); }
+
+void Logger::info(LogEvent::ptr event) { log(LogLevel::INFO, event); }
+
+void Logger::warn(LogEvent::ptr event) { log(LogLevel::WARN, event); }
+
+void Logger::error(LogEvent::ptr event) { log(LogLevel::ERROR, event); }
+
+void Logger::fatal(LogEvent::ptr event) { log(LogLevel::FATAL, event); }
+
+static const char s_index_magic[8] = {'S', 'Y', 'L', 'I', 'D', 'X', '\0', '\0'};
+
+void LogIndex::Summary::merge(const Summary &oth) {
+  minTime = std::min(minTime, oth.minTime);
+  maxTime = std::max(maxTime, oth.maxTime);
+  loggers |= oth.loggers;
+  levels |= oth.levels;
+}
+
+LogIndex::LogIndex(const std::string &filename, uint32_t block_size, uint64_t file_size)
+    : m_filename(IndexName(filename)),
+      m_blockSize(block_size ? block_size : 1),
+      m_blockStart(file_size),
+      m_blockEnd(file_size) {
+  open(file_size);
+}
+
+LogIndex::~LogIndex() {
+  finish();
+  flush();
+  if (m_fd >= 0) {
+    close(m_fd);
+  }
+}
+
+void LogIndex::open(uint64_t file_size) {
+  if (m_fd >= 0) {
+    close(m_fd);
+  }
+  m_runMax = 0;
+  m_fd = ::open(m_filename.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (m_fd < 0) {
+    return;
+  }
+  // 已有的索引版本相同 而且最后一段没有超出日志文件时接着写
+  Header header;
+  Entry last;
+  struct stat st;
+  if (file_size && fstat(m_fd, &st) == 0 && (uint64_t)st.st_size >= sizeof(header) &&
+      (st.st_size - sizeof(header)) % sizeof(Entry) == 0 &&
+      pread(m_fd, &header, sizeof(header), 0) == sizeof(header) &&
+      memcmp(header.magic, s_index_magic, sizeof(s_index_magic)) == 0 && header.version == kVersion) {
+    if ((uint64_t)st.st_size == sizeof(header)) {
+      return;
+    }
+    if (pread(m_fd, &last, sizeof(last), st.st_size - sizeof(last)) == sizeof(last) &&
+        last.offset + last.length <= file_size) {
+      m_runMax = last.runMax;
+      return;
+    }
+  }
+  // 新的日志文件 或者索引无法接着用 从头写
+  if (ftruncate(m_fd, 0)) {
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, s_index_magic, sizeof(s_index_magic));
+  header.version = kVersion;
+  header.blockSize = m_blockSize;
+  struct iovec iov;
+  iov.iov_base = &header;
+  iov.iov_len = sizeof(header);
+  WriteAll(m_fd, &iov, 1);
+}
+
+void LogIndex::add(uint64_t offset, uint64_t len, const Summary *summary) {
+  if (offset != m_blockEnd) {  // 中间有没经过索引的写入
+    finish();
+    m_blockStart = m_blockEnd = offset;
+  }
+  m_blockEnd += len;
+  if (summary && !summary->empty()) {
+    m_summary.merge(*summary);
+  } else {
+    // 内容未知 时间按现在算 级别和日志器全部命中
+    Summary unknown;
+    unknown.minTime = unknown.maxTime = GetCurrentUS();
+    unknown.loggers = ~0ull;
+    unknown.levels = ~0u;
+    m_summary.merge(unknown);
+  }
+  if (m_blockEnd - m_blockStart >= m_blockSize) {
+    finish();
+  }
+}
+
+void LogIndex::finish() {
+  if (m_blockEnd == m_blockStart) {
+    return;
+  }
+  Entry entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.offset = m_blockStart;
+  entry.length = m_blockEnd - m_blockStart;
+  entry.minTime = m_summary.minTime;
+  entry.maxTime = m_summary.maxTime;
+  m_runMax = std::max(m_runMax, m_summary.maxTime);
+  entry.runMax = m_runMax;
+  entry.loggers = m_summary.loggers;
+  entry.levels = m_summary.levels;
+  m_pending.append((const char *)&entry, sizeof(entry));
+  m_blockStart = m_blockEnd;
+  m_summary.clear();
+}
+
+void LogIndex::flush() {
+  if (m_pending.empty()) {
+    return;
+  }
+  if (m_fd >= 0) {
+    struct iovec iov;
+    iov.iov_base = &m_pending[0];
+    iov.iov_len = m_pending.size();
+    WriteAll(m_fd, &iov, 1);
+  }
+  m_pending.clear();
+}
+
+void LogIndex::reopen(uint64_t file_size) {
+  finish();
+  flush();
+  m_blockStart = m_blockEnd = file_size;
+  open(file_size);
+}
+
+void LogIndex::rotate(const std::string &archived) {
+  finish();
+  flush();
+  if (m_fd >= 0) {
+    close(m_fd);
+    m_fd = -1;
+  }
+  rename(m_filename.c_str(), IndexName(archived).c_str());
+}
+
+uint64_t LogIndex::NameBit(const std::string &name) {
+  // FNV-1a 与进程和编译器无关 sylar_logq查询时算出的位和写入时一致
+  uint64_t h = 14695981039346656037ull;
+  for (unsigned char c : name) {
+    h = (h ^ c) * 1099511628211ull;
+  }
+  return 1ull << (h >> 58);
+}
+
+uint64_t LogIndex::LoggerBits(const std::string &name) {
+  uint64_t bits = NameBit(name);
+  for (size_t pos = name.find('.'); pos != std::string::npos; pos = name.find('.', pos + 1)) {
+    bits |= NameBit(name.substr(0, pos));
+  }
+  return bits;
+}
+
+bool LogIndex::Search(const std::string &filename, uint64_t file_size, const Query &query,
+                      std::vector<std::pair<uint64_t, uint64_t>> &ranges) {
+  ranges.clear();
+  auto add = [&ranges, file_size](uint64_t begin, uint64_t end) {
+    end = std::min(end, file_size);
+    if (begin >= end) {
+      return;
+    }
+    if (!ranges.empty() && ranges.back().second >= begin) {
+      ranges.back().second = std::max(ranges.back().second, end);
+    } else {
+      ranges.push_back(std::make_pair(begin, end));
+    }
+  };
+
+  int fd = ::open(IndexName(filename).c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  Header header;
+  void *map = MAP_FAILED;
+  if (fd >= 0 && fstat(fd, &st) == 0 && (uint64_t)st.st_size >= sizeof(header) &&
+      pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+      memcmp(header.magic, s_index_magic, sizeof(s_index_magic)) == 0 && header.version == kVersion) {
+    map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (map == MAP_FAILED) {
+    add(0, file_size);
+    return false;
+  }
+
+  const Entry *entries = (const Entry *)((const char *)map + sizeof(Header));
+  const Entry *last = entries + (st.st_size - sizeof(Header)) / sizeof(Entry);
+  // runMax单调不减 first之前的段都早于查询的起点
+  const Entry *first = std::lower_bound(entries, last, query.begin,
+                                        [](const Entry &e, uint64_t t) { return e.runMax < t; });
+  uint64_t covered = first == entries ? 0 : (first - 1)->offset + (first - 1)->length;
+  for (const Entry *e = first; e < last; ++e) {
+    add(covered, e->offset);  // 中间没有索引的部分
+    if (e->maxTime >= query.begin && e->minTime <= query.end && (e->levels & query.levels) &&
+        (e->loggers & query.loggers) == query.loggers) {
+      add(e->offset, e->offset + e->length);
+    }
+    covered = std::max(covered, e->offset + e->length);
+  }
+  add(covered, file_size);
+  munmap(map, st.st_size);
+  return true;
+}
+
+LogFile::LogFile(const std::string &filename) : m_filename(filename) { reopen(); }
+
+LogFile::~LogFile() {
+  flushBuffer();
+  if (m_fd >= 0) {
+    close(m_fd);
+  }
+}
+
+void LogFile::setRotate(uint64_t max_size, Interval interval, uint32_t max_files) {
+  m_maxSize = max_size;
+  m_interval = interval;
+  m_maxFiles = max_files;
+  if (m_interval != NONE) {
+    m_periodStart = PeriodStart(m_interval, m_periodStart);
+    m_periodEnd = PeriodEnd(m_interval, m_periodStart);
+  }
+}
+
+bool LogFile::reopen() {
+  flushBuffer();
+  int fd = open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  if (m_fd >= 0) {
+    close(m_fd);
+  }
+  m_fd = fd;
+  struct stat st;
+  if (fstat(m_fd, &st) == 0) {
+    m_dev = st.st_dev;
+    m_ino = st.st_ino;
+    m_size = st.st_size;
+    // 已有内容的文件按最后修改时间归属时间段 昨天留下的文件今天第一次写入时就会被切分
+    m_periodStart = PeriodStart(m_interval, st.st_size ? st.st_mtime : time(0));
+  } else {
+    m_size = 0;
+    m_periodStart = PeriodStart(m_interval, time(0));
+  }
+  if (m_interval != NONE) {
+    m_periodEnd = PeriodEnd(m_interval, m_periodStart);
+  }
+  if (m_index) {
+    m_index->reopen(m_size);
+  }
+  return true;
+}
+
+void LogFile::setIndex(uint32_t block_size) {
+  if (!block_size) {
+    m_index.reset();
+  } else if (!m_index || m_index->getBlockSize() != block_size) {
+    flushBuffer();
+    m_index.reset();
+    m_index.reset(new LogIndex(m_filename, block_size, m_size));
+  }
+}
+
+void LogFile::check(size_t len) {
+  time_t now = time(0);
+  if (now != m_lastCheck) {
+    m_lastCheck = now;
+    // 每秒一次stat 文件被删除或者被移走(例如外部的logrotate)时才重新打开
+    struct stat st;
+    if (m_fd < 0 || stat(m_filename.c_str(), &st) != 0 || st.st_ino != m_ino || st.st_dev != m_dev) {
+      reopen();
+    }
+  }
+  if (m_interval != NONE && now >= m_periodEnd) {
+    if (m_size > 0) {
+      rotate(m_periodStart, false);
+    }
+    m_periodStart = PeriodStart(m_interval, now);
+    m_periodEnd = PeriodEnd(m_interval, m_periodStart);
+  }
+  if (m_maxSize && m_size > 0 && m_size + len > m_maxSize) {
+    rotate(now, true);
+  }
+}
+
+void LogFile::write(const struct iovec *iov, int iovcnt, const LogIndex::Summary *summaries) {
+  size_t len = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    len += iov[i].iov_len;
+  }
+  check(len);
+  if (m_fd >= 0) {
+    WriteAll(m_fd, iov, iovcnt);
+    if (m_index) {
+      uint64_t offset = m_size;
+      for (int i = 0; i < iovcnt; ++i) {
+        m_index->add(offset, iov[i].iov_len, summaries ? &summaries[i] : nullptr);
+        offset += iov[i].iov_len;
+      }
+      m_index->flush();
+    }
+    m_size += len;
+  }
+}
+
+void LogFile::append(const char *data, size_t len, const LogIndex::Summary *summary) {
+  check(len);
+  if (m_index) {
+    m_index->add(m_size, len, summary);
+  }
+  m_size += len;
+  if (m_buffer.size() + len > kBufferSize) {
+    flushBuffer();
+  }
+  if (len >= kBufferSize) {
+    struct iovec iov;
+    iov.iov_base = (void *)data;
+    iov.iov_len = len;
+    if (m_fd >= 0) {
+      WriteAll(m_fd, &iov, 1);
+    }
+    if (m_index) {
+      m_index->flush();
+    }
+    return;
+  }
+  m_buffer.append(data, len);
+}
+
+void LogFile::flush() { flushBuffer(); }
+
+void LogFile::flushBuffer() {
+  if (!m_buffer.empty()) {
+    if (m_fd >= 0) {
+      struct iovec iov;
+      iov.iov_base = &m_buffer[0];
+      iov.iov_len = m_buffer.size();
+      WriteAll(m_fd, &iov, 1);
+    }
+    m_buffer.clear();
+  }
+  // 索引在日志内容之后写出
+  if (m_index) {
+    m_index->flush();
+  }
+}
+
+time_t LogFile::PeriodStart(Interval interval, time_t t) {
+  if (interval == NONE) {
+    return t;
+  }
+  struct tm tm;
+  localtime_r(&t, &tm);
+  tm.tm_min = 0;
+  tm.tm_sec = 0;
+  if (interval == DAILY) {
+    tm.tm_hour = 0;
+  }
+  return mktime(&tm);
+}
+
+time_t LogFile::PeriodEnd(Interval interval, time_t start) {
+  if (interval == HOURLY) {
+    return start + 3600;
+  }
+  // 按天时用mktime计算下一个零点 兼容夏令时
+  struct tm tm;
+  localtime_r(&start, &tm);
+  tm.tm_mday += 1;
+  tm.tm_hour = 0;
+  tm.tm_min = 0;
+  tm.tm_sec = 0;
+  tm.tm_isdst = -1;
+  return mktime(&tm);
+}
+
+bool LogFile::Archive(const std::string &filename, Interval interval, time_t t, std::string *archived) {
+  // 按时间切分时后缀是被关闭的时间段 按大小切分时是切分的时刻 重名时再加序号
+  static const char *s_formats[] = {"%Y%m%d-%H%M%S", "%Y%m%d%H", "%Y%m%d"};
+  struct tm tm;
+  localtime_r(&t, &tm);
+  char suffix[64];
+  strftime(suffix, sizeof(suffix), s_formats[interval], &tm);
+  std::string name = filename + "." + suffix;
+  struct stat st;
+  for (int i = 1; stat(name.c_str(), &st) == 0; ++i) {
+    name = filename + "." + suffix + "." + std::to_string(i);
+  }
+  if (rename(filename.c_str(), name.c_str()) != 0) {
+    return false;
+  }
+  if (archived) {
+    *archived = name;
+  }
+  return true;
+}
+
+// 是否是Archive生成的后缀: %Y%m%d-%H%M%S %Y%m%d%H %Y%m%d 后面可以跟着重名时加的.序号
+// 其他同前缀的文件(用户的备份 溢出文件 分片文件等)都不是切分出来的 不能删
+static bool ParseArchiveSuffix(const char *p, std::string &stamp, uint32_t &seq) {
+  size_t digits = 0;
+  while (isdigit((unsigned char)p[digits])) {
+    ++digits;
+  }
+  size_t len = digits;
+  if (digits == 8 && p[8] == '-') {
+    size_t time_digits = 0;
+    while (isdigit((unsigned char)p[9 + time_digits])) {
+      ++time_digits;
+    }
+    if (time_digits != 6) {
+      return false;
+    }
+    len = 15;
+  } else if (digits != 8 && digits != 10) {
+    return false;
+  }
+  stamp.assign(p, len);
+  seq = 0;
+  p += len;
+  if (*p == '\0') {
+    return true;
+  }
+  if (*p != '.' || !isdigit((unsigned char)p[1])) {
+    return false;
+  }
+  for (++p; *p; ++p) {
+    if (!isdigit((unsigned char)*p)) {
+      return false;
+    }
+    seq = seq * 10 + (*p - '0');
+  }
+  return true;
+}
+
+void LogFile::Purge(const std::string &filename, uint32_t max_files) {
+  if (!max_files) {
+    return;
+  }
+  size_t pos = filename.rfind('/');
+  std::string dir = pos == std::string::npos ? "." : filename.substr(0, pos + 1);
+  std::string prefix = (pos == std::string::npos ? filename : filename.substr(pos + 1)) + ".";
+  DIR *d = opendir(dir.c_str());
+  if (!d) {
+    return;
+  }
+  // 按修改时间 后缀 序号排序 同一秒内切分出的多个文件也按生成的先后
+  std::vector<std::tuple<time_t, std::string, uint32_t, std::string>> files;
+  std::string stamp;
+  uint32_t seq = 0;
+  while (struct dirent *ent = readdir(d)) {
+    // 索引随日志文件删除 不单独计数 后缀对不上时自然被排除
+    if (strncmp(ent->d_name, prefix.c_str(), prefix.size()) != 0 ||
+        !ParseArchiveSuffix(ent->d_name + prefix.size(), stamp, seq)) {
+      continue;
+    }
+    std::string path = (pos == std::string::npos ? "" : dir) + ent->d_name;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      files.push_back(std::make_tuple(st.st_mtime, stamp, seq, path));
+    }
+  }
+  closedir(d);
+  if (files.size() <= max_files) {
+    return;
+  }
+  // 最旧的在前面
+  std::sort(files.begin(), files.end());
+  for (size_t i = 0; i < files.size() - max_files; ++i) {
+    unlink(std::get<3>(files[i]).c_str());
+    unlink(LogIndex::IndexName(std::get<3>(files[i])).c_str());
+  }
+}
+
+void LogFile::rotate(time_t t, bool by_size) {
+  flushBuffer();
+  std::string archived;
+  if (Archive(m_filename, by_size ? NONE : m_interval, t, &archived)) {
+    if (m_index) {
+      m_index->rotate(archived);
+    }
+    reopen();
+    m_size = 0;
+    Purge(m_filename, m_maxFiles);
+  }
+}
+
+LogFile::Interval LogFile::IntervalFromString(const std::string &str) {
+  if (str == "hourly") {
+    return HOURLY;
+  } else if (str == "daily") {
+    return DAILY;
+  }
+  return NONE;
+}
+
+const char *LogFile::IntervalToString(Interval interval) {
+  switch (interval) {
+    case HOURLY:
+      return "hourly";
+    case DAILY:
+      return "daily";
+    default:
+      return "none";
+  }
+}
+
+#if defined(SYLAR_HAVE_ZSTD) || defined(SYLAR_HAVE_LZ4)
+// 只支持连续输入的压缩接口 先把iov拼起来
+static const std::string &Gather(const struct iovec *iov, int iovcnt, std::string &buf) {
+  buf.clear();
+  for (int i = 0; i < iovcnt; ++i) {
+    buf.append((const char *)iov[i].iov_base, iov[i].iov_len);
+  }
+  return buf;
+}
+#endif
+
+#ifdef SYLAR_HAVE_ZSTD
+class ZstdCompressor : public LogCompressor {
+ public:
+  ZstdCompressor(int level) : LogCompressor(ZSTD, level ? level : 3), m_ctx(ZSTD_createCCtx()) {}
+  ~ZstdCompressor() { ZSTD_freeCCtx(m_ctx); }
+
+  bool compress(const struct iovec *iov, int iovcnt, std::string &out) override {
+    const std::string &src = Gather(iov, iovcnt, m_input);
+    size_t old = out.size();
+    out.resize(old + ZSTD_compressBound(src.size()));
+    size_t n = ZSTD_compressCCtx(m_ctx, &out[old], out.size() - old, src.data(), src.size(), m_level);
+    if (ZSTD_isError(n)) {
+      out.resize(old);
+      return false;
+    }
+    out.resize(old + n);
+    return true;
+  }
+
+ private:
+  ZSTD_CCtx *m_ctx;
+  std::string m_input;
+};
+#endif
+
+#ifdef SYLAR_HAVE_LZ4
+class Lz4Compressor : public LogCompressor {
+ public:
+  Lz4Compressor(int level) : LogCompressor(LZ4, level) {}
+
+  bool compress(const struct iovec *iov, int iovcnt, std::string &out) override {
+    const std::string &src = Gather(iov, iovcnt, m_input);
+    LZ4F_preferences_t prefs;
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.compressionLevel = m_level;
+    prefs.frameInfo.contentSize = src.size();
+    size_t old = out.size();
+    out.resize(old + LZ4F_compressFrameBound(src.size(), &prefs));
+    size_t n = LZ4F_compressFrame(&out[old], out.size() - old, src.data(), src.size(), &prefs);
+    if (LZ4F_isError(n)) {
+      out.resize(old);
+      return false;
+    }
+    out.resize(old + n);
+    return true;
+  }
+
+ private:
+  std::string m_input;
+};
+#endif
+
+LogCompressor::Codec LogCompressor::CodecFromString(const std::string &str) {
+  if (str == "zstd") {
+    return ZSTD;
+  } else if (str == "lz4") {
+    return LZ4;
+  } else if (str == "auto" || str == "true") {
+    return AUTO;
+  }
+  return NONE;
+}
+
+const char *LogCompressor::CodecToString(Codec codec) {
+  switch (codec) {
+    case ZSTD:
+      return "zstd";
+    case LZ4:
+      return "lz4";
+    case AUTO:
+      return "auto";
+    default:
+      return "none";
+  }
+}
+
+LogCompressor::ptr LogCompressor::Create(Codec codec, int level) {
+  switch (codec) {
+#ifdef SYLAR_HAVE_ZSTD
+    case ZSTD:
+      return std::make_shared<ZstdCompressor>(level);
+#endif
+#ifdef SYLAR_HAVE_LZ4
+    case LZ4:
+      return std::make_shared<Lz4Compressor>(level);
+#endif
+    case AUTO:
+#if defined(SYLAR_HAVE_ZSTD)
+      return std::make_shared<ZstdCompressor>(level);
+#elif defined(SYLAR_HAVE_LZ4)
+      return std::make_shared<Lz4Compressor>(level);
+#endif
+    default:
+      return nullptr;
+  }
+}
+
+FileAppender::FileAppender(const std::string &filename, size_t buffer_size, uint64_t flush_interval,
+                           LogCompressor::Codec compress, int compress_level)
+    : m_filename(filename), m_file(filename) {
+  if (compress != LogCompressor::NONE) {
+    m_compressor = LogCompressor::Create(compress, compress_level);
+    if (!m_compressor) {
+      std::cout << "log compression " << LogCompressor::CodecToString(compress) << " is not available" << std::endl;
+    } else if (!buffer_size) {
+      buffer_size = 256 * 1024;  // 压缩只在后台线程中按块进行
+    }
+  }
+  if (buffer_size) {
+    m_writer.reset(new LogBufferWriter(
+      m_filename, buffer_size, flush_interval,
+      std::bind(&FileAppender::writeBuffers, this, std::placeholders::_1, std::placeholders::_2,
+                std::placeholders::_3)));
+    m_writer->start();
+  }
+}
+
+FileAppender::~FileAppender() {
+  if (m_writer) {
+    m_writer->stop();
+  }
+}
+
+void FileAppender::writeBuffers(const struct iovec *iov, int iovcnt, const LogIndex::Summary *summaries) {
+  Mutex::Lock lock(m_fileMutex);
+  if (!m_compressor) {
+    m_file.write(iov, iovcnt, summaries);
+    return;
+  }
+  m_compressed.clear();
+  if (!m_compressor->compress(iov, iovcnt, m_compressed)) {
+    // 原样写入会让文件后面的内容都无法解压 丢弃这一块 每一帧都是独立压缩的 下一块不受影响
+    uint64_t lines = 0;
+    for (int i = 0; i < iovcnt; ++i) {
+      lines += std::count((const char *)iov[i].iov_base, (const char *)iov[i].iov_base + iov[i].iov_len, '\n');
+    }
+    m_metrics.add(LogMetrics::DROPPED, lines);
+    return;
+  }
+  // 压缩后的一帧作为索引中的一段
+  LogIndex::Summary summary;
+  for (int i = 0; i < iovcnt; ++i) {
+    if (summaries[i].empty()) {
+      summary.clear();
+      break;
+    }
+    summary.merge(summaries[i]);
+  }
+  struct iovec out;
+  out.iov_base = &m_compressed[0];
+  out.iov_len = m_compressed.size();
+  m_file.write(&out, 1, &summary);
+}
+
+void FileAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
+  if (level >= m_level) {
+    ThreadFormatBuffer tbuf;
+  std::string &buf = tbuf.get();
+    getRawFormatter()->format(buf, level, *event);
+    append(level, buf.data(), buf.size(), event.get());
+  }
+}
+
+bool FileAppender::write(LogLevel::Level level, const char *data, size_t len) { return output(data, len, nullptr); }
+
+bool FileAppender::writeEvent(LogLevel::Level level, const LogEvent &event, const char *data, size_t len) {
+  if (!m_indexed.load(std::memory_order_relaxed)) {
+    return output(data, len, nullptr);
+  }
+  LogIndex::Summary summary;
+  summary.add(event.getTimeUs(), level, event.getLogger() ? event.getLogger()->getIndexBits() : ~0ull);
+  return output(data, len, &summary);
+}
+
+bool FileAppender::output(const char *data, size_t len, const LogIndex::Summary *summary) {
+  if (m_writer) {
+    // 双缓冲模式 只是一次memcpy 不持有appender的锁
+    m_writer->append(data, len, summary);
+    return true;
+  }
+  Mutex::Lock lock(m_fileMutex);
+  m_file.append(data, len, summary);
+  if (!t_async_batch) {
+    m_file.flush();
+  }
+  return true;
+}
+
+void FileAppender::setIndex(uint32_t block_size) {
+  Mutex::Lock lock(m_fileMutex);
+  m_file.setIndex(block_size);
+  m_indexed = block_size > 0;
+}
+
+uint32_t FileAppender::getIndexBlockSize() {
+  Mutex::Lock lock(m_fileMutex);
+  return m_file.getIndexBlockSize();
+}
+
+std::string FileAppender::toYamlString() {
+  MutexType::Lock lock(m_mutex);
+  YAML::Node node;
+  node["type"] = "FileAppender";
+  node["file"] = m_filename;
+  if (m_writer) {
+    node["buffer"]["size"] = m_writer->getBufferSize();
+    node["buffer"]["flush_interval"] = m_writer->getFlushInterval();
+  }
+  if (m_compressor) {
+    node["compress"]["codec"] = LogCompressor::CodecToString(m_compressor->getCodec());
+    node["compress"]["level"] = m_compressor->getLevel();
+  }
+  if (uint32_t block_size = getIndexBlockSize()) {
+    node["index"]["block_size"] = block_size;
+  }
+  if (m_level != LogLevel::UNKNOW) {
+    node["level"] = LogLevel::toString(m_level);
+  }
+  if (m_hasFormatter && m_formatter) {
+    node["formatter"] = m_formatter->getPattern();
+  }
+  std::stringstream ss;
+  ss << node;
+  return ss.str();
+}
+
+void FileAppender::flush() {
+  if (m_compressor) {
+    // 每次输出都是一个独立的帧 频繁的小帧压缩率很差 由后台线程按缓冲写满或flush_interval输出
+    return;
+  }
+  if (m_writer) {
+    m_writer->flush();
+    return;
+  }
+  Mutex::Lock lock(m_fileMutex);
+  m_file.flush();
+}
+
+bool FileAppender::reopen() {
+  Mutex::Lock lock(m_fileMutex);
+  return m_file.reopen();
+}
+
+RotatingFileAppender::RotatingFileAppender(const std::string &filename, uint64_t max_size,
+                                           LogFile::Interval interval, uint32_t max_files, size_t buffer_size,
+                                           uint64_t flush_interval, LogCompressor::Codec compress,
+                                           int compress_level)
+    : FileAppender(filename, buffer_size, flush_interval, compress, compress_level) {
+  Mutex::Lock lock(m_fileMutex);
+  m_file.setRotate(max_size, interval, max_files);
+}
+
+std::string RotatingFileAppender::toYamlString() {
+  YAML::Node node = YAML::Load(FileAppender::toYamlString());
+  node["type"] = "RotatingFileAppender";
+  Mutex::Lock lock(m_fileMutex);
+  if (m_file.getMaxSize()) {
+    node["rotate"]["max_size"] = m_file.getMaxSize();
+  }
+  if (m_file.getInterval() != LogFile::NONE) {
+    node["rotate"]["interval"] = LogFile::IntervalToString(m_file.getInterval());
+  }
+  if (m_file.getMaxFiles()) {
+    node["rotate"]["max_files"] = m_file.getMaxFiles();
+  }
+  std::stringstream ss;
+  ss << node;
+  return ss.str();
+}
+
+// 头部记录当前窗口和它使用的槽 每个槽是一个窗口的写入位置 写日志时直接在槽上原子地累加
+// 进程崩溃后槽里的值仍在页缓存中 重新打开时就知道当前窗口写到了哪里 不用猜测末尾的0是不是日志内容
+struct MmapFileAppender::State {
+  static const uint64_t kMagic = 0x70616d6d72616c79ull;
+  static const uint32_t kClean = 0xffffffff;  // 文件已经截断到实际长度
+  static const uint32_t kScan = 0xfffffffe;   // 当前窗口没有槽 只能从末尾跳过0 不越过offset
+  static const int kSlots = 63;
+  struct Slot {
+    std::atomic<uint64_t> used;
+    char pad[56];
+  };
+  uint64_t magic;
+  std::atomic<uint32_t> slot;  // 当前窗口的槽 或者kClean kScan
+  uint32_t reserved;
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t offset;  // 当前窗口在文件中的偏移
+  uint64_t size;    // 当前窗口可写的字节数
+  char pad[16];
+  Slot slots[kSlots];
+};
+
+MmapFileAppender::MmapFileAppender(const std::string &filename, size_t window_size, uint64_t max_size,
+                                   LogFile::Interval interval, uint32_t max_files)
+    : m_filename(filename), m_maxSize(max_size), m_interval(interval), m_maxFiles(max_files) {
+  static_assert(sizeof(State) == 4096, "MmapFileAppender::State should be one page");
+  size_t page = sysconf(_SC_PAGESIZE);
+  if (m_maxSize && window_size > m_maxSize) {
+    window_size = m_maxSize;
+  }
+  m_windowSize = std::max(page, (window_size + page - 1) / page * page);
+  int fd = open(StateName(m_filename).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd >= 0) {
+    // 新建的状态文件全是0 magic对不上 按正常关闭处理
+    if (ftruncate(fd, sizeof(State)) == 0) {
+      void *map = mmap(nullptr, sizeof(State), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (map != MAP_FAILED) {
+        m_state = (State *)map;
+        m_freeSlots = (1ull << State::kSlots) - 1;
+      }
+    }
+    close(fd);
+  }
+  Mutex::Lock lock(m_switchMutex);
+  setError(!openFile());
+}
+
+MmapFileAppender::~MmapFileAppender() {
+  Mutex::Lock lock(m_switchMutex);
+  Window *w = m_window.load();
+  if (w && m_fd >= 0) {
+    // 截掉预分配但没有用到的部分 窗口没有打开时切换失败的地方已经截过了
+    if (ftruncate(m_fd, w->offset + std::min(w->used->load(), w->size))) {
+    }
+    markClean();
+  }
+  for (auto &i : m_windows) {
+    if (i->map) {
+      munmap(i->map, i->mapSize);
+    }
+  }
+  if (m_fd >= 0) {
+    close(m_fd);
+  }
+  if (m_state) {
+    munmap(m_state, sizeof(State));
+  }
+}
+
+void MmapFileAppender::setError(bool failed) {
+  if (failed && !m_openError) {
+    std::cout << "MmapFileAppender " << m_filename << ": " << strerror(errno) << ", logs are dropped" << std::endl;
+  }
+  m_openError = failed;
+}
+
+void MmapFileAppender::markClean() {
+  if (m_state) {
+    m_state->slot.store(State::kClean);
+  }
+}
+
+uint64_t MmapFileAppender::recoverEnd(int fd, const struct stat &st) {
+  uint64_t end = st.st_size;
+  uint64_t floor = 0;
+  if (m_state) {
+    uint32_t slot = m_state->slot.load();
+    if (m_state->magic != State::kMagic || m_state->dev != (uint64_t)st.st_dev ||
+        m_state->ino != (uint64_t)st.st_ino || slot == State::kClean) {
+      return end;  // 正常关闭过 或者状态记录的不是这个文件
+    }
+    floor = std::min(m_state->offset, end);
+    if (slot < (uint32_t)State::kSlots) {
+      uint64_t used = m_state->slots[slot].used.load();
+      if (used <= m_state->size) {
+        return std::min(end, m_state->offset + used);
+      }
+      // 窗口已满但还没来得及切换 有效内容的末尾不知道
+    }
+  }
+  // 只在当前窗口内从后往前跳过预分配的0
+  char buf[4096];
+  while (end > floor) {
+    size_t n = std::min((uint64_t)sizeof(buf), end - floor);
+    if (pread(fd, buf, n, end - n) != (ssize_t)n) {
+      break;
+    }
+    size_t i = n;
+    while (i > 0 && buf[i - 1] == '\0') {
+      --i;
+    }
+    end -= n - i;
+    if (i > 0) {
+      break;
+    }
+  }
+  return end;
+}
+
+bool MmapFileAppender::openFile(size_t need) {
+  m_window.store(nullptr);
+  int fd = open(m_filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  // 上次没有正常关闭时 文件末尾是预分配的0
+  uint64_t end = recoverEnd(fd, st);
+  if (end < (uint64_t)st.st_size && ftruncate(fd, end)) {
+  }
+  if (m_fd >= 0) {
+    close(m_fd);
+  }
+  m_fd = fd;
+  m_dev = st.st_dev;
+  m_ino = st.st_ino;
+  m_periodStart = LogFile::PeriodStart(m_interval, end ? st.st_mtime : time(0));
+  m_periodEnd = m_interval == LogFile::NONE ? 0 : LogFile::PeriodEnd(m_interval, m_periodStart);
+  if (m_state) {
+    m_state->slot.store(State::kScan);
+    m_state->magic = State::kMagic;
+    m_state->dev = st.st_dev;
+    m_state->ino = st.st_ino;
+  }
+  Window *w = mapWindow(end, need);
+  m_window.store(w);
+  return w != nullptr;
+}
+
+MmapFileAppender::Window *MmapFileAppender::mapWindow(uint64_t offset, size_t need) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  uint64_t aligned = offset / page * page;
+  uint64_t size = std::max<uint64_t>(m_windowSize, need);
+  if (m_maxSize) {
+    // 窗口不越过max_size 已经超过时只映射need字节 写满就切分
+    uint64_t left = offset < m_maxSize ? m_maxSize - offset : 0;
+    size = std::max<uint64_t>(std::min<uint64_t>(m_windowSize, left), std::max<size_t>(need, 1));
+  }
+  size_t map_size = offset - aligned + size;
+  // 先让状态指向新窗口 崩溃时最多在新窗口内跳过0
+  if (m_state) {
+    m_state->slot.store(State::kScan);
+    m_state->offset = offset;
+    m_state->size = size;
+  }
+  // 真正分配磁盘块 避免磁盘满时写映射触发SIGBUS
+  int rt = posix_fallocate(m_fd, aligned, map_size);
+  void *map = rt == 0 ? mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, aligned) : MAP_FAILED;
+  if (map == MAP_FAILED) {
+    if (rt) {
+      errno = rt;
+    }
+    int err = errno;
+    // 文件保持在实际长度
+    if (ftruncate(m_fd, offset)) {
+    }
+    markClean();
+    errno = err;
+    return nullptr;
+  }
+  std::unique_ptr<Window> w(new Window);
+  w->map = (char *)map;
+  w->mapSize = map_size;
+  w->base = w->map + (offset - aligned);
+  w->offset = offset;
+  w->size = size;
+  w->used = &w->localUsed;
+  if (m_state && m_freeSlots) {
+    w->slot = __builtin_ctzll(m_freeSlots);
+    m_freeSlots &= m_freeSlots - 1;
+    w->used = &m_state->slots[w->slot].used;
+    w->used->store(0);
+    m_state->slot.store(w->slot);
+  }
+  m_windows.push_back(std::move(w));
+  return m_windows.back().get();
+}
+
+void MmapFileAppender::switchWindow(Window *w, uint64_t end, size_t need) {
+  Mutex::Lock lock(m_switchMutex);
+  if (m_window.load() != w) {
+    return;  // 已经被其他线程切换过了
+  }
+  uint64_t file_end = w->offset + end;
+  time_t now = time(0);
+  struct stat st;
+  bool moved = stat(m_filename.c_str(), &st) != 0 || st.st_ino != m_ino || st.st_dev != m_dev;
+  bool by_time = m_interval != LogFile::NONE && now >= m_periodEnd.load();
+  bool by_size = m_maxSize && file_end > 0 && file_end + need > m_maxSize;
+  Window *next = nullptr;
+  if (moved || by_time || by_size) {
+    if (ftruncate(m_fd, file_end)) {
+    }
+    markClean();
+    // 被外部删除或移走时不再改名 直接在原路径重新创建
+    if (!moved && file_end > 0 && LogFile::Archive(m_filename, by_time ? m_interval : LogFile::NONE,
+                                                  by_time ? m_periodStart : now)) {
+      LogFile::Purge(m_filename, m_maxFiles);
+    }
+    openFile(need);
+    next = m_window.load();
+  } else {
+    next = mapWindow(file_end, need);
+  }
+  setError(!next);
+  m_window.store(next);
+  unmapRetired();
+}
+
+bool MmapFileAppender::checkFile(Window *w, size_t need, time_t now) {
+  time_t last = m_lastCheck.load(std::memory_order_relaxed);
+  if (now == last || !m_lastCheck.compare_exchange_strong(last, now)) {
+    return false;  // 这一秒已经有其他线程检查过了
+  }
+  Mutex::Lock lock(m_switchMutex);
+  if (m_window.load() != w) {
+    return false;
+  }
+  if (!w) {
+    setError(!openFile(need));
+    return false;
+  }
+  // 每秒一次stat 文件被删除或者被移走(例如外部的logrotate)时关闭窗口 切换时重新打开
+  struct stat st;
+  return stat(m_filename.c_str(), &st) != 0 || st.st_ino != m_ino || st.st_dev != m_dev;
+}
+
+void MmapFileAppender::unmapRetired() {
+  Window *cur = m_window.load();
+  for (auto &i : m_windows) {
+    if (i.get() != cur && i->map && i->writers.load() == 0) {
+      munmap(i->map, i->mapSize);
+      i->map = nullptr;
+      // 之后访问这个窗口的线程在登记后就会发现它不是当前窗口 不会再碰它的槽
+      if (i->slot >= 0) {
+        m_freeSlots |= 1ull << i->slot;
+        i->slot = -1;
+      }
+    }
+  }
+}
+
+void MmapFileAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
+  if (level >= m_level) {
+    ThreadFormatBuffer tbuf;
+  std::string &buf = tbuf.get();
+    getRawFormatter()->format(buf, level, *event);
+    append(level, buf.data(), buf.size(), event.get());
+  }
+}
+
+bool MmapFileAppender::write(LogLevel::Level level, const char *data, size_t len) {
+  static const uint64_t s_closed = 1ull << 62;
+  while (true) {
+    time_t now = time(0);
+    Window *w = m_window.load();
+    // 到了切分时间 或者文件被移走
+    bool close = (m_interval != LogFile::NONE && now >= m_periodEnd.load(std::memory_order_relaxed)) ||
+                 (now != m_lastCheck.load(std::memory_order_relaxed) && checkFile(w, len, now));
+    if (!w) {
+      if (m_window.load()) {
+        continue;  // 刚刚重新打开了
+      }
+      m_metrics.add(LogMetrics::DROPPED);
+      return true;
+    }
+    // 先登记再确认窗口仍是当前窗口 与unmapRetired的检查配对 保证访问期间窗口不会被解除映射 槽也不会被复用
+    w->writers.fetch_add(1);
+    if (m_window.load() != w) {
+      w->writers.fetch_sub(1);
+      continue;
+    }
+    if (close) {
+      // 先关闭窗口让后续的写入都进入等待 拿到关闭前位置的线程负责切换
+      uint64_t end = w->used->exchange(s_closed);
+      w->writers.fetch_sub(1);
+      if (end <= w->size) {
+        switchWindow(w, end, len);
+      } else {
+        Mutex::Lock lock(m_switchMutex);
+      }
+      continue;
+    }
+    uint64_t off = w->used->fetch_add(len);
+    if (off + len <= w->size) {
+      memcpy(w->base + off, data, len);
+      w->writers.fetch_sub(1);
+      return true;
+    }
+    w->writers.fetch_sub(1);
+    if (off <= w->size) {
+      // 第一个越过窗口末尾的线程 窗口的有效内容到off为止
+      switchWindow(w, off, len);
+    } else {
+      // 等待负责切换的线程完成
+      Mutex::Lock lock(m_switchMutex);
+    }
+  }
+}
+
+std::string MmapFileAppender::toYamlString() {
+  MutexType::Lock lock(m_mutex);
+  YAML::Node node;
+  node["type"] = "MmapFileAppender";
+  node["file"] = m_filename;
+  node["window_size"] = m_windowSize;
+  if (m_maxSize) {
+    node["rotate"]["max_size"] = m_maxSize;
+  }
+  if (m_interval != LogFile::NONE) {
+    node["rotate"]["interval"] = LogFile::IntervalToString(m_interval);
+  }
+  if (m_maxFiles) {
+    node["rotate"]["max_files"] = m_maxFiles;
+  }
+  if (m_level != LogLevel::UNKNOW) {
+    node["level"] = LogLevel::toString(m_level);
+  }
+  if (m_hasFormatter && m_formatter) {
+    node["formatter"] = m_formatter->getPattern();
+  }
+  std::stringstream ss;
+  ss << node;
+  return ss.str();
+}
+
+static std::atomic<uint64_t> s_ring_appender_id{0};
+// 信号处理函数中遍历的全局登记表 不能加锁 用固定大小的原子指针数组
+static const size_t s_max_ring_appenders = 16;
+static std::atomic<RingBufferAppender *> s_ring_appenders[s_max_ring_appenders];
+static const int s_fatal_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT};
+static const char *s_fatal_signal_names[] = {"SIGSEGV", "SIGBUS", "SIGFPE", "SIGILL", "SIGABRT"};
+static struct sigaction s_old_actions[sizeof(s_fatal_signals) / sizeof(s_fatal_signals[0])];
+// 导出信号原来的处理方式 按信号编号保存 导出后接着调用
+static struct sigaction s_old_dump_actions[NSIG];
+static std::atomic<bool> s_dump_installed[NSIG];
+// 致命信号处理函数使用的备用栈 栈溢出导致的SIGSEGV发生时原来的栈已经不能用了
+static const size_t s_alt_stack_size = 64 * 1024;
+
+static void RingBufferSignalHandler(int sig, siginfo_t *info, void *ctx) {
+  for (size_t i = 0; i < sizeof(s_fatal_signals) / sizeof(s_fatal_signals[0]); ++i) {
+    if (s_fatal_signals[i] == sig) {
+      RingBufferAppender::DumpAll(s_fatal_signal_names[i]);
+      // 恢复原来的处理方式后重新触发 让进程照常崩溃并生成core
+      sigaction(sig, &s_old_actions[i], nullptr);
+      raise(sig);
+      return;
+    }
+  }
+  if (sig <= 0 || sig >= NSIG) {
+    return;
+  }
+  RingBufferAppender::DumpAll(sig == SIGUSR1 ? "SIGUSR1" : sig == SIGUSR2 ? "SIGUSR2" : "signal");
+  // 应用程序自己也在用这个信号时 导出后交给它原来的处理函数 默认和忽略的处理方式不再执行
+  const struct sigaction &old = s_old_dump_actions[sig];
+  if (old.sa_flags & SA_SIGINFO) {
+    if (old.sa_sigaction) {
+      old.sa_sigaction(sig, info, ctx);
+    }
+  } else if (old.sa_handler != SIG_DFL && old.sa_handler != SIG_IGN) {
+    old.sa_handler(sig);
+  }
+}
+
+// 给当前线程装上备用栈 线程退出时释放 线程已经有备用栈时不动
+static void InstallAltStack() {
+  struct AltStack {
+    AltStack() {
+      stack_t old;
+      if (sigaltstack(nullptr, &old) == 0 && !(old.ss_flags & SS_DISABLE)) {
+        return;
+      }
+      data = new char[s_alt_stack_size];
+      stack_t st;
+      st.ss_sp = data;
+      st.ss_size = s_alt_stack_size;
+      st.ss_flags = 0;
+      if (sigaltstack(&st, nullptr) != 0) {
+        delete[] data;
+        data = nullptr;
+      }
+    }
+    ~AltStack() {
+      if (data) {
+        stack_t st;
+        memset(&st, 0, sizeof(st));
+        st.ss_flags = SS_DISABLE;
+        sigaltstack(&st, nullptr);
+        delete[] data;
+      }
+    }
+    char *data = nullptr;
+  };
+  static thread_local AltStack t_alt_stack;
+  (void)t_alt_stack;
+}
+
+RingBufferAppender::Ring::Ring(size_t size) : data(new char[size]) {
+  memset(data, 0, size);  // 提前触发缺页 写日志时不再有缺页中断
+}
+
+RingBufferAppender::RingBufferAppender(const std::string &filename, size_t ring_size, int dump_signal)
+    : m_id(++s_ring_appender_id), m_filename(filename), m_dumpSignal(dump_signal) {
+  m_ringSize = 4096;
+  while (m_ringSize < ring_size) {
+    m_ringSize <<= 1;
+  }
+  m_scratch = new char[m_ringSize];
+  for (auto &i : s_ring_appenders) {
+    RingBufferAppender *expected = nullptr;
+    if (i.compare_exchange_strong(expected, this)) {
+      m_registered = true;
+      break;
+    }
+  }
+  if (!m_registered) {
+    std::cout << "RingBufferAppender " << m_filename << ": more than " << s_max_ring_appenders
+              << " appenders, crashes and signals will not dump it" << std::endl;
+  }
+  InstallSignalHandlers(m_dumpSignal);
+  InstallAltStack();
+}
+
+RingBufferAppender::~RingBufferAppender() {
+  for (auto &i : s_ring_appenders) {
+    RingBufferAppender *expected = this;
+    i.compare_exchange_strong(expected, nullptr);
+  }
+  // 等待正在进行的导出结束
+  while (m_dumping.exchange(true)) {
+    sched_yield();
+  }
+  delete[] m_scratch;
+}
+
+void RingBufferAppender::InstallSignalHandlers(int dump_signal) {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = RingBufferSignalHandler;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_flags = SA_RESTART | SA_SIGINFO | SA_ONSTACK;
+  static bool s_installed = [&sa]() {
+    for (size_t i = 0; i < sizeof(s_fatal_signals) / sizeof(s_fatal_signals[0]); ++i) {
+      sigaction(s_fatal_signals[i], &sa, &s_old_actions[i]);
+    }
+    return true;
+  }();
+  (void)s_installed;
+  // 导出信号需要显式指定 每个信号只安装一次
+  if (dump_signal > 0 && dump_signal < NSIG && !s_dump_installed[dump_signal].exchange(true)) {
+    sigaction(dump_signal, &sa, &s_old_dump_actions[dump_signal]);
+  }
+}
+
+RingBufferAppender::Ring *RingBufferAppender::getThreadRing() {
+  static thread_local std::vector<std::pair<uint64_t, Ring::ptr>> t_rings;
+  for (auto &i : t_rings) {
+    if (i.first == m_id) {
+      return i.second.get();
+    }
+  }
+
+  // 第一次写这个appender的线程 顺带装上备用栈 它崩溃时也能导出
+  InstallAltStack();
+  Ring::ptr ring;
+  {
+    Mutex::Lock lock(m_ringMutex);
+    // 只被appender持有的缓冲 所属线程已经退出
+    for (auto &i : m_rings) {
+      if (i.unique()) {
+        ring = i;
+        break;
+      }
+    }
+    if (!ring) {
+      ring.reset(new Ring(m_ringSize));
+      m_rings.push_back(ring);
+      ring->next = m_ringList.load();
+      m_ringList.store(ring.get());
+    }
+  }
+  ring->threadId = GetThreadId();
+  for (auto it = t_rings.begin(); it != t_rings.end();) {
+    if (it->second.unique()) {
+      it = t_rings.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  t_rings.push_back(std::make_pair(m_id, ring));
+  return ring.get();
+}
+
+void RingBufferAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
+  if (level >= m_level) {
+    ThreadFormatBuffer tbuf;
+  std::string &buf = tbuf.get();
+    getRawFormatter()->format(buf, level, *event);
+    append(level, buf.data(), buf.size(), event.get());
+  }
+}
+
+bool RingBufferAppender::write(LogLevel::Level level, const char *data, size_t len) {
+  Ring *ring = getThreadRing();
+  if (len > m_ringSize) {  // 只保留末尾
+    data += len - m_ringSize;
+    len = m_ringSize;
+  }
+  uint64_t head = ring->head.load(std::memory_order_relaxed);
+  size_t pos = head & (m_ringSize - 1);
+  size_t first = std::min(len, m_ringSize - pos);
+  memcpy(ring->data + pos, data, first);
+  memcpy(ring->data, data + first, len - first);
+  // 内容拷贝完才推进head 导出时看到的都是完整的行
+  ring->head.store(head + len, std::memory_order_release);
+  return true;
+}
+
+// 导出时使用的写函数 只调用异步信号安全的write
+static void DumpWrite(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = ::write(fd, data, len);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return;
+    }
+    data += n;
+    len -= n;
+  }
+}
+
+void RingBufferAppender::dump(const char *reason) {
+  if (m_dumping.exchange(true)) {
+    return;
+  }
+  int fd = open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd >= 0) {
+    char header[128];
+    char *p = header;
+    size_t reason_len = std::min(strlen(reason), (size_t)64);
+    memcpy(p, "==== ring buffer dump: ", 23);
+    p += 23;
+    memcpy(p, reason, reason_len);
+    p += reason_len;
+    memcpy(p, " ====\n", 6);
+    p += 6;
+    DumpWrite(fd, header, p - header);
+
+    for (Ring *ring = m_ringList.load(); ring; ring = ring->next) {
+      uint64_t end = ring->head.load(std::memory_order_acquire);
+      uint64_t start = std::max(ring->dumped, end > m_ringSize ? end - m_ringSize : 0);
+      if (start == end) {
+        continue;
+      }
+      size_t len = end - start;
+      size_t pos = start & (m_ringSize - 1);
+      size_t first = std::min(len, m_ringSize - pos);
+      memcpy(m_scratch, ring->data + pos, first);
+      memcpy(m_scratch + first, ring->data, len - first);
+      // 拷贝期间所属线程可能覆盖了最旧的部分 跳过被覆盖的字节和随后不完整的一行
+      uint64_t now = ring->head.load(std::memory_order_acquire);
+      uint64_t valid = std::max(start, now > m_ringSize ? now - m_ringSize : 0);
+      size_t skip = std::min(valid, end) - start;
+      if (start != ring->dumped || valid != start) {
+        while (skip < len && m_scratch[skip] != '\n') {
+          ++skip;
+        }
+        skip = std::min(skip + 1, len);
+      }
+      ring->dumped = end;
+      if (skip >= len) {
+        continue;
+      }
+      p = header;
+      memcpy(p, "---- thread ", 12);
+      p += 12;
+      p += FormatUint(p, ring->threadId);
+      memcpy(p, " ----\n", 6);
+      p += 6;
+      DumpWrite(fd, header, p - header);
+      DumpWrite(fd, m_scratch + skip, len - skip);
+    }
+    close(fd);
+  }
+  m_dumping.store(false);
+}
+
+void RingBufferAppender::DumpAll(const char *reason) {
+  for (auto &i : s_ring_appenders) {
+    if (RingBufferAppender *appender = i.load()) {
+      appender->dump(reason);
+    }
+  }
+}
+
+std::string RingBufferAppender::toYamlString() {
+  MutexType::Lock lock(m_mutex);
+  YAML::Node node;
+  node["type"] = "RingBufferAppender";
+  node["file"] = m_filename;
+  node["ring_size"] = m_ringSize;
+  if (m_dumpSignal) {
+    node["dump_signal"] = m_dumpSignal;
+  }
+  if (m_level != LogLevel::UNKNOW) {
+    node["level"] = LogLevel::toString(m_level);
+  }
+  if (m_hasFormatter && m_formatter) {
+    node["formatter"] = m_formatter->getPattern();
+  }
+  std::stringstream ss;
+  ss << node;
+  return ss.str();
+}
+
+ShardedFileAppender::ShardedFileAppender(const std::string &filename, uint32_t shards) : m_filename(filename) {
+  if (!shards) {
+    long cpus = sysconf(_SC_NPROCESSORS_CONF);
+    shards = cpus > 0 ? cpus : 1;
+  }
+  for (uint32_t i = 0; i < shards; ++i) {
+    m_shards.emplace_back(new Shard(ShardName(m_filename, i)));
+  }
+}
+
+std::string ShardedFileAppender::ShardName(const std::string &filename, size_t idx) {
+  return filename + "." + std::to_string(idx);
+}
+
+void ShardedFileAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
+  if (level >= m_level) {
+    ThreadFormatBuffer tbuf;
+  std::string &buf = tbuf.get();
+    getRawFormatter()->format(buf, level, *event);
+    append(level, buf.data(), buf.size(), event.get());
+  }
+}
+
+bool ShardedFileAppender::write(LogLevel::Level level, const char *data, size_t len) {
+  static const char s_hex[] = "0123456789abcdef";
+  int cpu = sched_getcpu();
+  Shard &shard = *m_shards[(cpu >= 0 ? (size_t)cpu : (size_t)GetThreadId()) % m_shards.size()];
+  char key[kKeySize];
+  Mutex::Lock lock(shard.mutex);
+  // 在锁内取时间 同一个分片内的记录按时间递增 合并时只需要归并
+  uint64_t now = GetFastTimeUS();
+  for (int i = 15; i >= 0; --i, now >>= 4) {
+    key[i] = s_hex[now & 0xf];
+  }
+  key[16] = ' ';
+  shard.file.append(key, kKeySize);
+  shard.file.append(data, len);
+  if (!t_async_batch) {
+    shard.file.flush();
+  }
+  return true;
+}
+
+void ShardedFileAppender::flush() {
+  for (auto &i : m_shards) {
+    Mutex::Lock lock(i->mutex);
+    i->file.flush();
+  }
+}
+
+bool ShardedFileAppender::reopen() {
+  bool rt = true;
+  for (auto &i : m_shards) {
+    Mutex::Lock lock(i->mutex);
+    rt = i->file.reopen() && rt;
+  }
+  return rt;
+}
+
+std::string ShardedFileAppender::toYamlString() {
+  MutexType::Lock lock(m_mutex);
+  YAML::Node node;
+  node["type"] = "ShardedFileAppender";
+  node["file"] = m_filename;
+  node["shards"] = m_shards.size();
+  if (m_level != LogLevel::UNKNOW) {
+    node["level"] = LogLevel::toString(m_level);
+  }
+  if (m_hasFormatter && m_formatter) {
+    node["formatter"] = m_formatter->getPattern();
+  }
+  std::stringstream ss;
+  ss << node;
+  return ss.str();
+}
+
+// 合并时的一个分片 pending是已经读到的下一条记录的第一行
+struct ShardReader {
+  std::ifstream in;
+  std::string pending;
+  uint64_t key = 0;
+  bool eof = false;
+
+  static bool ParseKey(const std::string &line, uint64_t &key) {
+    if (line.size() < ShardedFileAppender::kKeySize || line[16] != ' ') {
+      return false;
+    }
+    key = 0;
+    for (size_t i = 0; i < 16; ++i) {
+      char c = line[i];
+      if (c >= '0' && c <= '9') {
+        key = (key << 4) | (c - '0');
+      } else if (c >= 'a' && c <= 'f') {
+        key = (key << 4) | (c - 'a' + 10);
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // 读到下一条记录的第一行 文件开头没有时间前缀的行(比如被截断的记录)直接跳过
+  void advance() {
+    std::string line;
+    while (std::getline(in, line)) {
+      if (ParseKey(line, key)) {
+        pending.swap(line);
+        return;
+      }
+    }
+    eof = true;
+  }
+
+  // 输出pending这条记录 包括后面的续行 然后读到下一条
+  void output(std::ostream &os, bool keep_key) {
+    os.write(pending.data() + (keep_key ? 0 : ShardedFileAppender::kKeySize),
+             pending.size() - (keep_key ? 0 : ShardedFileAppender::kKeySize));
+    os << '\n';
+    std::string line;
+    while (std::getline(in, line)) {
+      if (ParseKey(line, key)) {
+        pending.swap(line);
+        return;
+      }
+      os << line << '\n';
+    }
+    eof = true;
+  }
+};
+
+bool ShardedFileAppender::Merge(const std::vector<std::string> &files, std::ostream &os, bool keep_key) {
+  bool rt = true;
+  std::vector<std::unique_ptr<ShardReader>> readers;
+  for (auto &i : files) {
+    std::unique_ptr<ShardReader> reader(new ShardReader);
+    reader->in.open(i);
+    if (!reader->in) {
+      rt = false;
+      continue;
+    }
+    reader->advance();
+    readers.push_back(std::move(reader));
+  }
+  // 小顶堆 按(时间, 分片下标)排序
+  typedef std::pair<uint64_t, size_t> Item;
+  std::priority_queue<Item, std::vector<Item>, std::greater<Item>> heap;
+  for (size_t i = 0; i < readers.size(); ++i) {
+    if (!readers[i]->eof) {
+      heap.push(std::make_pair(readers[i]->key, i));
+    }
+  }
+  while (!heap.empty()) {
+    size_t idx = heap.top().second;
+    heap.pop();
+    ShardReader &reader = *readers[idx];
+    reader.output(os, keep_key);
+    if (!reader.eof) {
+      heap.push(std::make_pair(reader.key, idx));
+    }
+  }
+  return rt;
+}
+
+void StdoutAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {  // 此处加override会报错
+  if (level >= m_level) {
+    ThreadFormatBuffer tbuf;
+  std::string &buf = tbuf.get();
+    getRawFormatter()->format(buf, level, *event);
+    append(level, buf.data(), buf.size(), event.get());
+  }
+}
+
+StdoutAppender::StdoutAppender(size_t buffer_size, uint64_t flush_interval) {
+  // 终端上需要立即看到输出 只在重定向到管道或文件时才攒批
+  if (buffer_size && !isatty(STDOUT_FILENO)) {
+    m_writer.reset(new LogBufferWriter(
+      "stdout", buffer_size, flush_interval,
+      std::bind(&StdoutAppender::writeBuffers, this, std::placeholders::_1, std::placeholders::_2)));
+    m_writer->start();
+  }
+}
+
+StdoutAppender::~StdoutAppender() {
+  if (m_writer) {
+    m_writer->stop();
+  }
+}
+
+void StdoutAppender::writeBuffers(const struct iovec *iov, int iovcnt) {
+  Mutex::Lock lock(m_writeMutex);
+  WriteAll(STDOUT_FILENO, iov, iovcnt);
+}
+
+bool StdoutAppender::write(LogLevel::Level level, const char *data, size_t len) {
+  if (m_writer) {
+    m_writer->append(data, len);
+    return true;
+  }
+  struct iovec iov;
+  iov.iov_base = (void *)data;
+  iov.iov_len = len;
+  writeBuffers(&iov, 1);
+  return true;
+}
+
+void StdoutAppender::flush() {
+  if (m_writer) {
+    m_writer->flush();
+  }
+}
+
+std::string StdoutAppender::toYamlString() {
+  MutexType::Lock lock(m_mutex);
+  YAML::Node node;
+  node["type"] = "StdoutAppender";
+  if (m_writer) {
+    node["buffer"]["size"] = m_writer->getBufferSize();
+    node["buffer"]["flush_interval"] = m_writer->getFlushInterval();
+  }
   if (m_level != LogLevel::UNKNOW) {
     node["level"] = LogLevel::toString(m_level);
   }
-  if (m_formatter) {
+  if (m_hasFormatter && m_formatter) {
     node["formatter"] = m_formatter->getPattern();
   }
-  for (auto &i : m_appenders) {
-    node["appenders"].push_back(YAML::Load(i->toYamlString()));
-  }
   std::stringstream ss;
   ss << node;
   return ss.str();
 }
 
-void Logger::debug(LogEvent::ptr event) { log(LogLevel::DEBUG, event); }
+static std::atomic<uint64_t> s_formatter_id{0};
 
-void Logger::info(LogEvent::ptr event) { log(LogLevel::INFO, event); }
+LogFormatter::LogFormatter(const std::string &pattern) : m_pattern(pattern), m_id(++s_formatter_id) { init(); }
 
-void Logger::warn(LogEvent::ptr event) { log(LogLevel::WARN, event); }
+// 时间格式中秒以下的字段在编译时替换成这几个占位字符 strftime会原样输出
+static const char s_frac_ms = '\x01';  // %3N 毫秒
+static const char s_frac_us = '\x02';  // %6N 微秒
+static const char s_frac_ns = '\x03';  // %9N %N 纳秒
+static const size_t s_datetime_width = 128;
 
-void Logger::error(LogEvent::ptr event) { log(LogLevel::ERROR, event); }
+// 线程局部的时间渲染缓存 同一秒内直接复用渲染好的文本 只改写秒以下的数字
+// 避免每条日志都调用localtime_r(glibc中要拿时区锁)和strftime
+struct DateTimeCache {
+  uint64_t formatterId = 0;
+  uint32_t offset = 0;  // 时间格式在m_literals中的偏移 同一个formatter中可能有多个%d
+  int64_t second = -1;
+  size_t length = 0;
+  char text[s_datetime_width];
+  uint8_t fracCount = 0;
+  uint8_t fracPos[8];     // 秒以下数字在text中的位置
+  uint8_t fracDigits[8];  // 3 6 9
+};
 
-void Logger::fatal(LogEvent::ptr event) { log(LogLevel::FATAL, event); }
+static const size_t s_datetime_cache_size = 8;
+static thread_local DateTimeCache t_datetime_cache[s_datetime_cache_size];
+static thread_local size_t t_datetime_cache_next = 0;
+
+static void RefreshDateTimeCache(DateTimeCache *cache, const char *fmt, int64_t second) {
+  struct tm tm;
+  time_t time = second;
+  localtime_r(&time, &tm);
+  char buf[s_datetime_width];
+  size_t n = strftime(buf, sizeof(buf), fmt, &tm);
 
-FileAppender::FileAppender(const std::string &filename) : m_filename(filename) {
-  m_filestream.open(m_filename, std::ios::out | std::ios::app);
+  cache->second = second;
+  cache->length = 0;
+  cache->fracCount = 0;
+  for (size_t i = 0; i < n; ++i) {
+    int digits = 0;
+    if (buf[i] == s_frac_ms) {
+      digits = 3;
+    } else if (buf[i] == s_frac_us) {
+      digits = 6;
+    } else if (buf[i] == s_frac_ns) {
+      digits = 9;
+    }
+    if (!digits) {
+      if (cache->length < s_datetime_width) {
+        cache->text[cache->length++] = buf[i];
+      }
+      continue;
+    }
+    if (cache->length + digits > s_datetime_width || cache->fracCount >= sizeof(cache->fracPos)) {
+      continue;
+    }
+    cache->fracPos[cache->fracCount] = cache->length;
+    cache->fracDigits[cache->fracCount] = digits;
+    ++cache->fracCount;
+    memset(cache->text + cache->length, '0', digits);
+    cache->length += digits;
+  }
 }
 
-void FileAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
-  if (level >= m_level) {
-    uint64_t now = time(0);
-    if (now != m_lastTime) {
-      reopen();  // 每秒都reopen一下 避免日志文件不存在
-      m_lastTime = now;
+static size_t RenderDateTime(char *buf, const char *fmt, uint64_t formatter_id, uint32_t offset, uint64_t time_us) {
+  DateTimeCache *cache = nullptr;
+  for (size_t i = 0; i < s_datetime_cache_size; ++i) {
+    if (t_datetime_cache[i].formatterId == formatter_id && t_datetime_cache[i].offset == offset) {
+      cache = &t_datetime_cache[i];
+      break;
+    }
+  }
+  if (!cache) {  // 没有命中 轮流淘汰
+    cache = &t_datetime_cache[t_datetime_cache_next++ % s_datetime_cache_size];
+    cache->formatterId = formatter_id;
+    cache->offset = offset;
+    cache->second = -1;
+  }
+
+  int64_t second = time_us / 1000000;
+  if (cache->second != second) {
+    RefreshDateTimeCache(cache, fmt, second);
+  }
+  memcpy(buf, cache->text, cache->length);
+
+  uint32_t usec = time_us % 1000000;
+  for (uint8_t i = 0; i < cache->fracCount; ++i) {
+    char *p = buf + cache->fracPos[i];
+    uint32_t val = cache->fracDigits[i] == 3 ? usec / 1000 : usec;
+    int digits = cache->fracDigits[i] == 3 ? 3 : 6;  // 只有微秒精度 纳秒的后三位保持为0
+    for (int j = digits - 1; j >= 0; --j) {
+      p[j] = '0' + val % 10;
+      val /= 10;
     }
-    MutexType::Lock lock(m_mutex);
-    m_filestream << m_formatter->format(logger, level, event);
   }
+  return cache->length;
 }
 
-std::string FileAppender::toYamlString() {
-  MutexType::Lock lock(m_mutex);
-  YAML::Node node;
-  node["type"] = "FileAppender";
-  node["file"] = m_filename;
-  if (m_level != LogLevel::UNKNOW) {
-    node["level"] = LogLevel::toString(m_level);
+std::string LogFormatter::format(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
+  std::string str;
+  format(str, level, *event);
+  return str;
+}
+
+size_t LogFormatter::getMaxSize(const LogEvent &event) const {
+  size_t size = m_fixedSize;
+  for (auto &op : m_ops) {
+    switch (op.code) {
+    case OP_MESSAGE:
+      size += event.getContentSize();
+      break;
+    case OP_NAME:
+      size += event.getLogger()->getName().size();
+      break;
+    case OP_JSON_MESSAGE:
+      size += event.getContentSize() * 6;
+      break;
+    case OP_JSON_NAME:
+      size += event.getLogger()->getName().size() * 6;
+      break;
+    case OP_FIELDS:
+      size += event.getFields().size();
+      break;
+    case OP_FILENAME:
+      size += event.getSite()->basenameSize;
+      break;
+    default:
+      break;
+    }
   }
-  if (m_hasFormatter && m_formatter) {
-    node["formatter"] = m_formatter->getPattern();
+  return size;
+}
+
+size_t LogFormatter::format(char *buf, LogLevel::Level level, const LogEvent &event) const {
+  char *p = buf;
+  for (auto &op : m_ops) {
+    switch (op.code) {
+    case OP_LITERAL:
+      memcpy(p, m_literals.data() + op.offset, op.length);
+      p += op.length;
+      break;
+    case OP_MESSAGE:
+      memcpy(p, event.getContentData(), event.getContentSize());
+      p += event.getContentSize();
+      break;
+    case OP_LEVEL: {
+      const char *str = LogLevel::ToString(level);
+      size_t len = strlen(str);
+      memcpy(p, str, len);
+      p += len;
+      break;
+    }
+    case OP_NAME: {
+      const std::string &name = event.getLogger()->getName();  // event中是最原始的logger 否则可能是root写的
+      memcpy(p, name.data(), name.size());
+      p += name.size();
+      break;
+    }
+    case OP_THREAD_ID:
+      p += FormatUint(p, event.getThreadId());
+      break;
+    case OP_FIBER_ID:
+      p += FormatUint(p, event.getFiberId());
+      break;
+    case OP_ELAPSE:
+      p += FormatUint(p, event.getElapse());
+      break;
+    case OP_DATETIME:
+      p += RenderDateTime(p, m_literals.data() + op.offset, m_id, op.offset, event.getTimeUs());
+      break;
+    case OP_FILENAME:
+      memcpy(p, event.getBasename(), event.getSite()->basenameSize);
+      p += event.getSite()->basenameSize;
+      break;
+    case OP_LINE:
+      p += FormatInt(p, event.getLine());
+      break;
+    case OP_JSON_MESSAGE:
+      p += JsonEscape(p, event.getContentData(), event.getContentSize());
+      break;
+    case OP_JSON_NAME: {
+      const std::string &name = event.getLogger()->getName();
+      p += JsonEscape(p, name.data(), name.size());
+      break;
+    }
+    case OP_FIELDS: {
+      const std::string &fields = event.getFields();
+      memcpy(p, fields.data(), fields.size());
+      p += fields.size();
+      break;
+    }
+    default:
+      break;
+    }
   }
-  std::stringstream ss;
-  ss << node;
-  return ss.str();
+  return p - buf;
 }
 
-bool FileAppender::reopen() {
-  MutexType::Lock lock(m_mutex);
-  if (m_filestream) {
-    m_filestream.close();
+void LogFormatter::format(std::string &out, LogLevel::Level level, const LogEvent &event) const {
+  size_t old = out.size();
+  out.resize(old + getMaxSize(event));
+  size_t len = format(&out[old], level, event);
+  out.resize(old + len);
+}
+
+// 按编译后的时间格式解析 p指向以'\0'结尾的字符串 成功时返回解析到的位置
+static const char *ParseDateTime(const char *p, const char *fmt, uint64_t &time_us) {
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  uint64_t frac_us = 0;
+  std::string seg;
+  for (const char *f = fmt;; ++f) {
+    if (*f && *f != s_frac_ms && *f != s_frac_us && *f != s_frac_ns) {
+      seg.append(1, *f);
+      continue;
+    }
+    if (!seg.empty()) {
+      p = strptime(p, seg.c_str(), &tm);
+      if (!p) {
+        return nullptr;
+      }
+      seg.clear();
+    }
+    if (!*f) {
+      break;
+    }
+    int digits = *f == s_frac_ms ? 3 : (*f == s_frac_us ? 6 : 9);
+    uint64_t v = 0;
+    for (int i = 0; i < digits; ++i, ++p) {
+      if (*p < '0' || *p > '9') {
+        return nullptr;
+      }
+      v = v * 10 + (*p - '0');
+    }
+    frac_us = digits == 3 ? v * 1000 : (digits == 6 ? v : v / 1000);
   }
-  m_filestream.open(m_filename, std::ios::app);
-  return !!m_filestream;  // !!双向取反 m_filestream不为空则返回true否则返回false
+  tm.tm_isdst = -1;
+  time_t t = mktime(&tm);
+  if (t == (time_t)-1) {
+    return nullptr;
+  }
+  time_us = t * 1000000ull + frac_us;
+  return p;
 }
 
-void StdoutAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {  // 此处加override会报错
-  if (level >= m_level) {
-    MutexType::Lock lock(m_mutex);
-    std::cout << m_formatter->format(logger, level, event);
+bool LogFormatter::parse(const char *begin, const char *end, Fields &fields) const {
+  // strptime要求'\0'结尾 行尾统一补上换行 和格式末尾的%n对应
+  std::string line(begin, end);
+  if (line.empty() || line.back() != '\n') {
+    line.append(1, '\n');
+  }
+  fields = Fields();
+  size_t pos = 0;
+  for (size_t i = 0; i < m_ops.size(); ++i) {
+    const Op &op = m_ops[i];
+    if (op.code == OP_LITERAL) {
+      if (line.compare(pos, op.length, m_literals, op.offset, op.length) != 0) {
+        return false;
+      }
+      pos += op.length;
+      continue;
+    }
+    if (op.code == OP_DATETIME) {
+      const char *p = ParseDateTime(line.c_str() + pos, m_literals.c_str() + op.offset, fields.time);
+      if (!p) {
+        return false;
+      }
+      pos = p - line.c_str();
+      continue;
+    }
+    if (op.code == OP_THREAD_ID || op.code == OP_FIBER_ID || op.code == OP_LINE || op.code == OP_ELAPSE) {
+      size_t n = line.find_first_not_of("-0123456789", pos);
+      if (n == pos) {
+        return false;
+      }
+      pos = n;
+      continue;
+    }
+
+    // 变长字段 取到下一个字面量为止 下一个字面量是格式的结尾时取到行尾的这个字面量之前
+    size_t field_end = line.size() - 1;
+    if (i + 1 < m_ops.size() && m_ops[i + 1].code == OP_LITERAL) {
+      const Op &next = m_ops[i + 1];
+      std::string lit = m_literals.substr(next.offset, next.length);
+      if (i + 2 == m_ops.size()) {
+        if (line.size() < pos + lit.size() || line.compare(line.size() - lit.size(), lit.size(), lit) != 0) {
+          return false;
+        }
+        field_end = line.size() - lit.size();
+      } else if (op.code == OP_JSON_MESSAGE || op.code == OP_JSON_NAME) {
+        // 跳过转义的字符
+        for (field_end = pos; field_end < line.size(); ++field_end) {
+          if (line[field_end] == '\\') {
+            ++field_end;
+          } else if (line.compare(field_end, lit.size(), lit) == 0) {
+            break;
+          }
+        }
+      } else {
+        field_end = line.find(lit, pos);
+      }
+      if (field_end == std::string::npos || field_end >= line.size()) {
+        return false;
+      }
+    }
+    if (op.code == OP_LEVEL) {
+      fields.level = LogLevel::fromString(line.substr(pos, field_end - pos));
+      if (fields.level == LogLevel::UNKNOW) {
+        return false;
+      }
+    } else if (op.code == OP_NAME || op.code == OP_JSON_NAME) {
+      fields.name = line.substr(pos, field_end - pos);
+    }
+    pos = field_end;
   }
+  return pos + 1 >= line.size();  // 格式末尾没有%n时补上的换行不算
 }
 
-std::string StdoutAppender::toYamlString() {
-  MutexType::Lock lock(m_mutex);
-  YAML::Node node;
-  node["type"] = "StdoutAppender";
-  if (m_level != LogLevel::UNKNOW) {
-    node["level"] = LogLevel::toString(m_level);
+void LogFormatter::addLiteral(const std::string &str) {
+  if (str.empty()) {
+    return;
   }
-  if (m_hasFormatter && m_formatter) {
-    node["formatter"] = m_formatter->getPattern();
+  // 相邻的字面量合并成一条指令
+  if (!m_ops.empty() && m_ops.back().code == OP_LITERAL &&
+      m_ops.back().offset + m_ops.back().length == m_literals.size() && m_ops.back().length + str.size() <= UINT16_MAX) {
+    m_ops.back().length += str.size();
+    m_literals.append(str);
+    m_fixedSize += str.size();
+    return;
   }
-  std::stringstream ss;
-  ss << node;
-  return ss.str();
+  Op op;
+  op.code = OP_LITERAL;
+  op.width = 0;
+  op.offset = m_literals.size();
+  op.length = std::min(str.size(), (size_t)UINT16_MAX);
+  m_literals.append(str, 0, op.length);
+  m_fixedSize += op.length;
+  m_ops.push_back(op);
+}
+
+void LogFormatter::addDateTime(const std::string &fmt) {
+  // 把%3N %6N %9N %N换成占位字符 其余交给strftime
+  std::string str;
+  for (size_t i = 0; i < fmt.size(); ++i) {
+    if (fmt[i] != '%' || i + 1 >= fmt.size()) {
+      str.append(1, fmt[i]);
+      continue;
+    }
+    if (fmt[i + 1] == 'N') {
+      str.append(1, s_frac_ns);
+      ++i;
+    } else if (i + 2 < fmt.size() && fmt[i + 2] == 'N' &&
+               (fmt[i + 1] == '3' || fmt[i + 1] == '6' || fmt[i + 1] == '9')) {
+      str.append(1, fmt[i + 1] == '3' ? s_frac_ms : (fmt[i + 1] == '6' ? s_frac_us : s_frac_ns));
+      i += 2;
+    } else {  // 包括%% 原样保留两个字符
+      str.append(fmt, i, 2);
+      ++i;
+    }
+  }
+  addOp(OP_DATETIME, s_datetime_width, str);
 }
 
-LogFormatter::LogFormatter(const std::string &pattern) : m_pattern(pattern) { init(); }
+void LogFormatter::initJson(const std::string &datetime) {
+  // {"time":"...","level":"INFO","logger":"root","thread":1,"fiber":0,"file":"a.cc","line":1,"msg":"..."}
+  m_ops.clear();
+  m_literals.clear();
+  m_fixedSize = 0;
+  addLiteral("{\"time\":\"");
+  addDateTime(datetime);
+  addLiteral("\",\"level\":\"");
+  addOp(OP_LEVEL, 6);
+  addLiteral("\",\"logger\":\"");
+  addOp(OP_JSON_NAME, 0);
+  addLiteral("\",\"thread\":");
+  addOp(OP_THREAD_ID, 10);
+  addLiteral(",\"fiber\":");
+  addOp(OP_FIBER_ID, 10);
+  addLiteral(",\"file\":\"");
+  addOp(OP_FILENAME, 0);
+  addLiteral("\",\"line\":");
+  addOp(OP_LINE, 11);
+  addLiteral(",\"msg\":\"");
+  addOp(OP_JSON_MESSAGE, 0);
+  addLiteral("\"");
+  addOp(OP_FIELDS, 0);
+  addLiteral("}\n");
+}
 
-std::string LogFormatter::format(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
-  std::stringstream ss;
-  for (auto &i : m_items) {
-    i->format(ss, logger, level, event);
+void LogFormatter::addOp(uint8_t code, uint8_t width, const std::string &arg) {
+  Op op;
+  op.code = code;
+  op.width = width;
+  op.offset = m_literals.size();
+  op.length = arg.size();
+  if (!arg.empty()) {
+    m_literals.append(arg);
+    m_literals.append(1, '\0');
   }
-  return ss.str();
+  m_fixedSize += width;
+  m_ops.push_back(op);
 }
 
+/**
+ *  %m 消息体
+ *  %p level
+ *  %c 日志名称
+ *  %t 线程id
+ *  %F 协程id
+ *  %n 回车换行
+ *  %T 制表符
+ *  %d 时间 %d{%Y-%m-%d %H:%M:%S.%3N} 花括号内是strftime的格式 另外支持%3N毫秒 %6N微秒 %9N(%N)纳秒
+ *  %f 文件名
+ *  %l 行号
+ *  %r 程序启动后的毫秒数
+ *
+ *  json 每条日志一行json json{%Y-%m-%d %H:%M:%S} 指定其中时间的格式
+ */
 // %xxx %xxx{xxx} %%
 void LogFormatter::init() {
+  if (m_pattern == "json" || (m_pattern.compare(0, 5, "json{") == 0 && m_pattern.back() == '}')) {
+    initJson(m_pattern.size() > 4 ? m_pattern.substr(5, m_pattern.size() - 6) : "%Y-%m-%dT%H:%M:%S.%6N%z");
+    return;
+  }
   // str, format, type
   std::vector<std::tuple<std::string, std::string, int>> vec;
   std::string n_str;
@@ -474,32 +3684,33 @@ void LogFormatter::init() {
     vec.push_back(std::make_tuple(n_str, "", 0));
   }
 
-  static std::map<std::string, std::function<FormatItem::ptr(const std::string &str)>> s_format_items = {
-#define XX(str, C)                                                           \
-  {                                                                          \
-#str, [](const std::string &fmt) { return FormatItem::ptr(new C(fmt)); } \
-  }
-
-    XX(m, MessageFormatItem), XX(p, LevelFormatItem),    XX(c, NameFormatItem),     XX(t, ThreadIdFormatItem),
-    XX(n, NewLineFormatItem), XX(d, DateTimeFormatItem), XX(f, FilenameFormatItem), XX(l, LineFormatItem),
-    XX(T, TabFormatItem),     XX(F, FiberIdFormatItem)
-#undef XX
-  };
+  // 字母 -> (指令, 定长字段的最大宽度)
+  static std::map<std::string, std::pair<uint8_t, uint8_t>> s_format_ops = {
+    {"m", {OP_MESSAGE, 0}},  {"p", {OP_LEVEL, 6}},     {"c", {OP_NAME, 0}},      {"t", {OP_THREAD_ID, 10}},
+    {"d", {OP_DATETIME, 0}}, {"f", {OP_FILENAME, 0}}, {"l", {OP_LINE, 11}},     {"F", {OP_FIBER_ID, 10}},
+    {"r", {OP_ELAPSE, 10}}};
 
+  m_ops.clear();
+  m_literals.clear();
+  m_fixedSize = 0;
   for (auto &i : vec) {
     if (std::get<2>(i) == 0) {  // type为0的都是非字母的字符 直接输出
-      m_items.push_back(FormatItem::ptr(new StringFormatItem(std::get<0>(i))));
+      addLiteral(std::get<0>(i));
+    } else if (std::get<0>(i) == "n") {
+      addLiteral("\n");
+    } else if (std::get<0>(i) == "T") {
+      addLiteral("\t");
     } else {  // type为1的都是字母字符
-      auto it = s_format_items.find(std::get<0>(i));
-      if (it == s_format_items.end()) {  // 找不到该字母对应的处理函数
-        m_items.push_back(FormatItem::ptr(new StringFormatItem("<<error_format %" + std::get<0>(i) + ">>")));
+      auto it = s_format_ops.find(std::get<0>(i));
+      if (it == s_format_ops.end()) {  // 找不到该字母对应的指令
+        addLiteral("<<error_format %" + std::get<0>(i) + ">>");
         m_error = true;
+      } else if (it->second.first == OP_DATETIME) {
+        addDateTime(std::get<1>(i).empty() ? "%Y-%m-%d %H:%M:%S" : std::get<1>(i));
       } else {
-        m_items.push_back(it->second(std::get<1>(i)));
+        addOp(it->second.first, it->second.second);
       }
     }
-
-    // std::cout << std::get<0>(i) << " - " << std::get<1>(i) << " - " << std::get<2>(i) << std::endl;
   }
 }
 
@@ -507,10 +3718,19 @@ LogManager::LogManager() {
   m_root.reset(new Logger);
   m_root->addAppender(LogAppender::ptr(new StdoutAppender));
   m_loggers[m_root->m_name] = m_root;
+  insert(m_root);
 
   init();
 }
 
+LogManager::~LogManager() {
+  // 进程退出前把异步队列里的日志全部输出
+  MutexType::Lock lock(m_mutex);
+  for (auto &i : m_loggers) {
+    i.second->stopAsync();
+  }
+}
+
 std::string LogManager::toYamlString() {
   MutexType::Lock lock(m_mutex);
   YAML::Node node;
@@ -522,15 +3742,149 @@ std::string LogManager::toYamlString() {
   return ss.str();
 }
 
+std::vector<LogMetricsReport> LogManager::getMetrics() {
+  std::vector<Logger::ptr> loggers;
+  {
+    MutexType::Lock lock(m_mutex);
+    for (auto &i : m_loggers) {
+      loggers.push_back(i.second);
+    }
+  }
+  std::vector<LogMetricsReport> reports;
+  for (auto &logger : loggers) {
+    LogMetricsReport report;
+    report.name = logger->getName();
+    report.metrics = logger->getMetrics();
+    logger->getQueueDepth(report.queueDepth, report.queueSize);
+    for (auto &i : *logger->getAppenders()) {
+      YAML::Node node = YAML::Load(i->toYamlString());
+      std::string desc = node["type"].as<std::string>("");
+      if (node["file"].IsDefined()) {
+        desc += ":" + node["file"].as<std::string>();
+      }
+      report.appenders.push_back(std::make_pair(desc, i->getMetrics()));
+    }
+    reports.push_back(std::move(report));
+  }
+  return reports;
+}
+
+static void MetricsToYaml(YAML::Node node, const LogMetrics::Snapshot &snap) {
+  node["events"] = snap.get(LogMetrics::EVENTS);
+  node["filtered"] = snap.get(LogMetrics::FILTERED);
+  if (snap.get(LogMetrics::BYTES)) {
+    node["bytes"] = snap.get(LogMetrics::BYTES);
+  }
+  if (uint64_t samples = snap.getLatencySamples()) {
+    node["latency_ns"]["samples"] = samples;
+    node["latency_ns"]["p50"] = snap.getLatencyPercentile(0.5);
+    node["latency_ns"]["p99"] = snap.getLatencyPercentile(0.99);
+    node["latency_ns"]["p999"] = snap.getLatencyPercentile(0.999);
+  }
+}
+
+std::string LogManager::metricsToYamlString() {
+  YAML::Node node;
+  for (auto &report : getMetrics()) {
+    YAML::Node n;
+    n["name"] = report.name;
+    MetricsToYaml(n, report.metrics);
+    if (report.queueSize) {
+      n["async"]["queue_depth"] = report.queueDepth;
+      n["async"]["queue_size"] = report.queueSize;
+      n["async"]["dropped"] = report.metrics.get(LogMetrics::DROPPED);
+      n["async"]["spilled"] = report.metrics.get(LogMetrics::SPILLED);
+    }
+    for (auto &i : report.appenders) {
+      YAML::Node a;
+      a["appender"] = i.first;
+      MetricsToYaml(a, i.second);
+      n["appenders"].push_back(a);
+    }
+    node.push_back(n);
+  }
+  std::stringstream ss;
+  ss << node;
+  return ss.str();
+}
+
+static void MetricsToJson(std::string &out, const LogMetrics::Snapshot &snap) {
+  out += "\"events\":" + std::to_string(snap.get(LogMetrics::EVENTS));
+  out += ",\"filtered\":" + std::to_string(snap.get(LogMetrics::FILTERED));
+  out += ",\"bytes\":" + std::to_string(snap.get(LogMetrics::BYTES));
+  out += ",\"latency_ns\":{\"samples\":" + std::to_string(snap.getLatencySamples());
+  out += ",\"p50\":" + std::to_string(snap.getLatencyPercentile(0.5));
+  out += ",\"p99\":" + std::to_string(snap.getLatencyPercentile(0.99));
+  out += ",\"p999\":" + std::to_string(snap.getLatencyPercentile(0.999));
+  // 完整的分布 下标i对应[2^i, 2^(i+1))纳秒
+  out += ",\"buckets\":[";
+  for (size_t i = 0; i < LogMetrics::kLatencyBuckets; ++i) {
+    out += (i ? "," : "") + std::to_string(snap.latency[i]);
+  }
+  out += "]}";
+}
+
+std::string LogManager::metricsToJsonString() {
+  std::string out = "[";
+  for (auto &report : getMetrics()) {
+    out += out.size() > 1 ? ",{\"name\":" : "{\"name\":";
+    JsonAppendString(out, report.name.data(), report.name.size());
+    out += ",";
+    MetricsToJson(out, report.metrics);
+    out += ",\"async\":{\"queue_depth\":" + std::to_string(report.queueDepth);
+    out += ",\"queue_size\":" + std::to_string(report.queueSize);
+    out += ",\"dropped\":" + std::to_string(report.metrics.get(LogMetrics::DROPPED));
+    out += ",\"spilled\":" + std::to_string(report.metrics.get(LogMetrics::SPILLED)) + "}";
+    out += ",\"appenders\":[";
+    for (size_t i = 0; i < report.appenders.size(); ++i) {
+      out += i ? ",{\"appender\":" : "{\"appender\":";
+      JsonAppendString(out, report.appenders[i].first.data(), report.appenders[i].first.size());
+      out += ",";
+      MetricsToJson(out, report.appenders[i].second);
+      out += "}";
+    }
+    out += "]}";
+  }
+  out += "]";
+  return out;
+}
+
 struct LogAppenderDefine {
-  int type = 0;  // 1 FileAppender 2 StdoutAppender
+  // 1 FileAppender 2 StdoutAppender 3 RotatingFileAppender 4 MmapFileAppender 5 RingBufferAppender
+  // 6 ShardedFileAppender
+  int type = 0;
   LogLevel::Level level = LogLevel::Level::UNKNOW;
   std::string file;
   std::string formatter;
+  uint32_t buffer_size = 0;                             // FileAppender StdoutAppender每个线程的缓冲大小 0表示同步写入
+  uint32_t flush_interval = 1000;                       // 缓冲模式下的最长写入间隔(毫秒)
+  uint64_t max_size = 0;                                // RotatingFileAppender单个文件的最大字节数
+  LogFile::Interval rotate_interval = LogFile::NONE;    // 按小时或者按天切分
+  uint32_t max_files = 0;                               // 保留的历史文件个数
+  uint32_t window_size = 16 * 1024 * 1024;              // MmapFileAppender每次映射的字节数
+  uint32_t ring_size = 1024 * 1024;                     // RingBufferAppender每个线程的缓冲大小
+  int dump_signal = 0;                                  // RingBufferAppender收到后导出的信号 0表示不接管信号
+  uint32_t shards = 0;                                  // ShardedFileAppender的分片数 0表示CPU个数
+  LogCompressor::Codec compress = LogCompressor::NONE;  // FileAppender RotatingFileAppender的压缩算法
+  int compress_level = 0;                               // 压缩级别 0表示算法的默认值
+  uint32_t index_block = 0;                             // FileAppender RotatingFileAppender时间索引的段大小 0表示不建
 
   bool operator==(const LogAppenderDefine &oth) const {
     return this->type == oth.type && this->level == oth.level && this->file == oth.file &&
-           this->formatter == oth.formatter;
+           this->formatter == oth.formatter && this->buffer_size == oth.buffer_size &&
+           this->flush_interval == oth.flush_interval && this->max_size == oth.max_size &&
+           this->rotate_interval == oth.rotate_interval && this->max_files == oth.max_files &&
+           this->window_size == oth.window_size && this->ring_size == oth.ring_size &&
+           this->dump_signal == oth.dump_signal && this->shards == oth.shards &&
+           this->compress == oth.compress && this->compress_level == oth.compress_level &&
+           this->index_block == oth.index_block;
+  }
+
+  // 除了级别以外都相同 重新加载配置时可以继续使用已经打开的appender 只修改级别
+  bool sameOutput(const LogAppenderDefine &oth) const {
+    LogAppenderDefine tmp = oth;
+    tmp.level = level;
+    return *this == tmp;
   }
 };
 
@@ -539,10 +3893,25 @@ struct LogDefine {
   LogLevel::Level level = LogLevel::Level::UNKNOW;
   std::string formatter;
   std::vector<LogAppenderDefine> appenders;
+  bool async = false;                                 // 是否开启异步模式
+  uint32_t queue_size = 8192;                         // 异步队列容量
+  uint32_t batch_size = 128;                          // 后台线程每批处理的事件数
+  uint32_t flush_interval = 100;                      // 队列空闲时的刷新间隔(毫秒)
+  LogOverflow::Policy overflow = LogOverflow::BLOCK;  // 队列满时的处理方式
+  LogLevel::Level overflow_level = LogLevel::ERROR;   // drop_below_level时保留的最低级别
+  std::string overflow_file;                          // spill时的溢出文件
+  std::string binary_file;                            // 二进制日志文件 为空表示不开启二进制模式
+  uint32_t binary_buffer_size = 256 * 1024;           // 每个线程的二进制缓冲大小
+  uint32_t binary_flush_interval = 1000;              // 二进制缓冲的最长写入间隔(毫秒)
 
   bool operator==(const LogDefine &oth) const {
     return this->name == oth.name && this->level == oth.level && this->formatter == oth.formatter &&
-           this->appenders == oth.appenders;
+           this->appenders == oth.appenders && this->async == oth.async && this->queue_size == oth.queue_size &&
+           this->batch_size == oth.batch_size && this->flush_interval == oth.flush_interval &&
+           this->overflow == oth.overflow && this->overflow_level == oth.overflow_level &&
+           this->overflow_file == oth.overflow_file && this->binary_file == oth.binary_file &&
+           this->binary_buffer_size == oth.binary_buffer_size &&
+           this->binary_flush_interval == oth.binary_flush_interval;
   }
 
   bool operator<(const LogDefine &val) const { return this->name < val.name; }
@@ -554,13 +3923,54 @@ class LexicalCast<LogAppenderDefine, std::string> {
   std::string operator()(const LogAppenderDefine &lad) {
     YAML::Node node;
     node["level"] = LogLevel::toString(lad.level);
-    if (lad.type == 1) {  // FileAppender
-      node["type"] = "FileAppender";
+    if (lad.type == 1 || lad.type == 3 || lad.type == 4) {  // FileAppender RotatingFileAppender MmapFileAppender
+      node["type"] = lad.type == 1 ? "FileAppender" : (lad.type == 3 ? "RotatingFileAppender" : "MmapFileAppender");
       if (!lad.file.empty()) {
         node["file"] = lad.file;
       }
+      if (lad.type == 4) {
+        node["window_size"] = lad.window_size;
+      } else if (lad.buffer_size) {
+        node["buffer"]["size"] = lad.buffer_size;
+        node["buffer"]["flush_interval"] = lad.flush_interval;
+      }
+      if (lad.max_size) {
+        node["rotate"]["max_size"] = lad.max_size;
+      }
+      if (lad.rotate_interval != LogFile::NONE) {
+        node["rotate"]["interval"] = LogFile::IntervalToString(lad.rotate_interval);
+      }
+      if (lad.max_files) {
+        node["rotate"]["max_files"] = lad.max_files;
+      }
+      if (lad.type != 4 && lad.compress != LogCompressor::NONE) {
+        node["compress"]["codec"] = LogCompressor::CodecToString(lad.compress);
+        if (lad.compress_level) {
+          node["compress"]["level"] = lad.compress_level;
+        }
+      }
+      if (lad.type != 4 && lad.index_block) {
+        node["index"]["block_size"] = lad.index_block;
+      }
     } else if (lad.type == 2) {  // StdoutAppender
       node["type"] = "StdoutAppender";
+      if (lad.buffer_size) {
+        node["buffer"]["size"] = lad.buffer_size;
+        node["buffer"]["flush_interval"] = lad.flush_interval;
+      }
+    } else if (lad.type == 5) {  // RingBufferAppender
+      node["type"] = "RingBufferAppender";
+      node["file"] = lad.file;
+      node["ring_size"] = lad.ring_size;
+      if (lad.dump_signal) {
+        node["dump_signal"] = lad.dump_signal;
+      }
+    } else if (lad.type == 6) {  // ShardedFileAppender
+      node["type"] = "ShardedFileAppender";
+      node["file"] = lad.file;
+      if (lad.shards) {
+        node["shards"] = lad.shards;
+      }
     }
 
     if (!lad.formatter.empty()) {
@@ -579,13 +3989,87 @@ class LexicalCast<std::string, LogAppenderDefine> {
     YAML::Node node = YAML::Load(str);
     LogAppenderDefine lad;
     auto type = node["type"].as<std::string>();
-    if (type == "FileAppender") {
-      lad.type = 1;
+    if (type == "FileAppender" || type == "RotatingFileAppender" || type == "MmapFileAppender") {
+      lad.type = type == "FileAppender" ? 1 : (type == "RotatingFileAppender" ? 3 : 4);
       if (node["file"].IsDefined()) {
         lad.file = node["file"].as<std::string>();
       }
+      if (node["window_size"].IsDefined()) {
+        lad.window_size = node["window_size"].as<uint32_t>();
+      }
+      // rotate: {max_size: 104857600, interval: daily, max_files: 7} interval可以是hourly daily
+      auto rotate = node["rotate"];
+      if (lad.type != 1 && rotate.IsMap()) {
+        if (rotate["max_size"].IsDefined()) {
+          lad.max_size = rotate["max_size"].as<uint64_t>();
+        }
+        if (rotate["interval"].IsDefined()) {
+          lad.rotate_interval = LogFile::IntervalFromString(rotate["interval"].as<std::string>());
+        }
+        if (rotate["max_files"].IsDefined()) {
+          lad.max_files = rotate["max_files"].as<uint32_t>();
+        }
+      }
+      // compress: zstd 或者 compress: {codec: lz4, level: 1} codec可以是zstd lz4 auto
+      auto compress = node["compress"];
+      if (lad.type != 4 && compress.IsScalar()) {
+        lad.compress = LogCompressor::CodecFromString(compress.as<std::string>());
+      } else if (lad.type != 4 && compress.IsMap()) {
+        lad.compress = LogCompressor::AUTO;
+        if (compress["codec"].IsDefined()) {
+          lad.compress = LogCompressor::CodecFromString(compress["codec"].as<std::string>());
+        }
+        if (compress["level"].IsDefined()) {
+          lad.compress_level = compress["level"].as<int>();
+        }
+      }
+      // index: true 或者 index: {block_size: 65536}
+      auto index = node["index"];
+      if (lad.type != 4 && index.IsScalar() && index.as<bool>()) {
+        lad.index_block = 64 * 1024;
+      } else if (lad.type != 4 && index.IsMap()) {
+        lad.index_block = 64 * 1024;
+        if (index["block_size"].IsDefined()) {
+          lad.index_block = index["block_size"].as<uint32_t>();
+        }
+      }
     } else if (type == "StdoutAppender") {
       lad.type = 2;
+    } else if (type == "RingBufferAppender") {
+      lad.type = 5;
+      if (node["file"].IsDefined()) {
+        lad.file = node["file"].as<std::string>();
+      }
+      if (node["ring_size"].IsDefined()) {
+        lad.ring_size = node["ring_size"].as<uint32_t>();
+      }
+      // dump_signal: SIGUSR1 或者信号编号
+      if (node["dump_signal"].IsDefined()) {
+        std::string sig = node["dump_signal"].as<std::string>();
+        lad.dump_signal = sig == "SIGUSR1" ? SIGUSR1 : sig == "SIGUSR2" ? SIGUSR2 : atoi(sig.c_str());
+      }
+    } else if (type == "ShardedFileAppender") {
+      lad.type = 6;
+      if (node["file"].IsDefined()) {
+        lad.file = node["file"].as<std::string>();
+      }
+      if (node["shards"].IsDefined()) {
+        lad.shards = node["shards"].as<uint32_t>();
+      }
+    }
+
+    // buffer: true 或者 buffer: {size: 262144, flush_interval: 1000}
+    auto buffer = node["buffer"];
+    if (buffer.IsScalar() && buffer.as<bool>()) {
+      lad.buffer_size = 256 * 1024;
+    } else if (buffer.IsMap()) {
+      lad.buffer_size = 256 * 1024;
+      if (buffer["size"].IsDefined()) {
+        lad.buffer_size = buffer["size"].as<uint32_t>();
+      }
+      if (buffer["flush_interval"].IsDefined()) {
+        lad.flush_interval = buffer["flush_interval"].as<uint32_t>();
+      }
     }
 
     if (node["formatter"].IsDefined()) {
@@ -612,6 +4096,23 @@ class LexicalCast<LogDefine, std::string> {
     if (!ld.appenders.empty()) {
       node["appenders"] = LexicalCast<std::vector<LogAppenderDefine>, std::string>()(ld.appenders);
     }
+    if (ld.async) {
+      node["async"]["queue_size"] = ld.queue_size;
+      node["async"]["batch_size"] = ld.batch_size;
+      node["async"]["flush_interval"] = ld.flush_interval;
+      node["async"]["overflow"] = LogOverflow::ToString(ld.overflow);
+      if (ld.overflow == LogOverflow::DROP_BELOW_LEVEL) {
+        node["async"]["overflow_level"] = LogLevel::toString(ld.overflow_level);
+      }
+      if (ld.overflow == LogOverflow::SPILL) {
+        node["async"]["overflow_file"] = ld.overflow_file;
+      }
+    }
+    if (!ld.binary_file.empty()) {
+      node["binary"]["file"] = ld.binary_file;
+      node["binary"]["buffer_size"] = ld.binary_buffer_size;
+      node["binary"]["flush_interval"] = ld.binary_flush_interval;
+    }
     std::stringstream ss;
     ss << node;
     return ss.str();
@@ -634,6 +4135,46 @@ class LexicalCast<std::string, LogDefine> {
       ss << node["appenders"];
       ld.appenders = LexicalCast<std::string, std::vector<LogAppenderDefine>>()(ss.str());
     }
+    // async: true 或者 async: {queue_size: 8192, batch_size: 128, flush_interval: 100}
+    // 队列满时 overflow: block(默认) drop_newest drop_oldest spill(配合overflow_file)
+    // 或者drop_below_level(配合overflow_level 低于它的丢弃 其余的等待)
+    auto async = node["async"];
+    if (async.IsScalar()) {
+      ld.async = async.as<bool>();
+    } else if (async.IsMap()) {
+      ld.async = true;
+      if (async["queue_size"].IsDefined()) {
+        ld.queue_size = async["queue_size"].as<uint32_t>();
+      }
+      if (async["batch_size"].IsDefined()) {
+        ld.batch_size = async["batch_size"].as<uint32_t>();
+      }
+      if (async["flush_interval"].IsDefined()) {
+        ld.flush_interval = async["flush_interval"].as<uint32_t>();
+      }
+      if (async["overflow"].IsDefined()) {
+        ld.overflow = LogOverflow::FromString(async["overflow"].as<std::string>());
+      }
+      if (async["overflow_level"].IsDefined()) {
+        ld.overflow_level = LogLevel::fromString(async["overflow_level"].as<std::string>());
+      }
+      if (async["overflow_file"].IsDefined()) {
+        ld.overflow_file = async["overflow_file"].as<std::string>();
+      }
+    }
+    // binary: app.bin 或者 binary: {file: app.bin, buffer_size: 262144, flush_interval: 1000}
+    auto binary = node["binary"];
+    if (binary.IsScalar()) {
+      ld.binary_file = binary.as<std::string>();
+    } else if (binary.IsMap()) {
+      ld.binary_file = binary["file"].as<std::string>();
+      if (binary["buffer_size"].IsDefined()) {
+        ld.binary_buffer_size = binary["buffer_size"].as<uint32_t>();
+      }
+      if (binary["flush_interval"].IsDefined()) {
+        ld.binary_flush_interval = binary["flush_interval"].as<uint32_t>();
+      }
+    }
     return ld;
   }
 };
@@ -641,24 +4182,81 @@ class LexicalCast<std::string, LogDefine> {
 sylar::ConfigVar<std::set<LogDefine>>::ptr log_set_ptr =
   sylar::Config::Lookup("logs", std::set<LogDefine>{}, "logs config");
 
+static LogAppender::ptr CreateAppender(const LogAppenderDefine &appender) {
+  LogAppender::ptr app;
+  if (appender.type == 1) {  // FileAppender
+    app.reset(new FileAppender(appender.file, appender.buffer_size, appender.flush_interval, appender.compress,
+                               appender.compress_level));
+  } else if (appender.type == 2) {  // StdoutAppender
+    app.reset(new StdoutAppender(appender.buffer_size, appender.flush_interval));
+  } else if (appender.type == 3) {  // RotatingFileAppender
+    app.reset(new RotatingFileAppender(appender.file, appender.max_size, appender.rotate_interval,
+                                       appender.max_files, appender.buffer_size, appender.flush_interval,
+                                       appender.compress, appender.compress_level));
+  } else if (appender.type == 4) {  // MmapFileAppender
+    app.reset(new MmapFileAppender(appender.file, appender.window_size, appender.max_size, appender.rotate_interval,
+                                   appender.max_files));
+  } else if (appender.type == 5) {  // RingBufferAppender
+    app.reset(new RingBufferAppender(appender.file, appender.ring_size, appender.dump_signal));
+  } else if (appender.type == 6) {  // ShardedFileAppender
+    app.reset(new ShardedFileAppender(appender.file, appender.shards));
+  } else {
+    return nullptr;
+  }
+  if (appender.index_block && (appender.type == 1 || appender.type == 3)) {
+    std::static_pointer_cast<FileAppender>(app)->setIndex(appender.index_block);
+  }
+  if (!appender.formatter.empty()) {
+    LogFormatter::ptr format(new LogFormatter(appender.formatter));
+    if (!format->isError()) {
+      app->setFormatter(format);
+    } else {
+      std::cout << "formatter " << format->getPattern() << " is invalid." << std::endl;
+    }
+  }
+  return app;
+}
+
 // main之前和之后执行东西
 // 全局对象在main函数之前初始化 初始化为函数指针
 struct LogIniter {
+  typedef std::vector<std::pair<LogAppenderDefine, LogAppender::ptr>> AppenderDefines;
+
+  // 按新的配置生成日志器的appender集合 输出地没变的appender直接沿用 不重新打开文件
+  Logger::AppenderList buildAppenders(const std::string &name, const std::vector<LogAppenderDefine> &defines) {
+    AppenderDefines &old = m_appenders[name];
+    AppenderDefines cur;
+    Logger::AppenderList list;
+    for (auto &define : defines) {
+      LogAppender::ptr app;
+      for (auto &i : old) {
+        if (i.second && i.first.sameOutput(define)) {
+          app.swap(i.second);  // 每个旧的appender只沿用一次
+          break;
+        }
+      }
+      if (!app && !(app = CreateAppender(define))) {
+        continue;
+      }
+      app->setLevel(define.level);
+      cur.push_back(std::make_pair(define, app));
+      list.push_back(app);
+    }
+    old.swap(cur);
+    return list;
+  }
+
   LogIniter() {
-    log_set_ptr->addListener([](const std::set<LogDefine> &old_val, const std::set<LogDefine> &new_val) {
+    log_set_ptr->addListener([this](const std::set<LogDefine> &old_val, const std::set<LogDefine> &new_val) {
       SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "on_log_config_changed";
+      Mutex::Lock lock(m_mutex);
       for (auto &i : new_val) {
         auto it = old_val.find(i);
-        Logger::ptr logger;
-        if (it == old_val.end()) {
-          // 新增
-          logger = SYLAR_LOG_NAME(i.name);
-        } else {
-          if (!(i == *it)) {
-            // 修改
-            logger = SYLAR_LOG_NAME(i.name);
-          }
+        if (it != old_val.end() && i == *it) {
+          continue;  // 未修改
         }
+        // 新增或修改
+        Logger::ptr logger = SYLAR_LOG_NAME(i.name);
         if (i.level != LogLevel::UNKNOW) {
           logger->setLevel(i.level);
         }
@@ -666,24 +4264,21 @@ struct LogIniter {
           logger->setFormatter(i.formatter);
         }
 
-        logger->clearAppenders();
-        for (auto &appender : i.appenders) {
-          LogAppender::ptr app;
-          if (appender.type == 1) {  // FileAppender
-            app.reset(new FileAppender(appender.file));
-          } else if (appender.type == 2) {  // StdoutAppender
-            app.reset(new StdoutAppender());
-          }
-          app->setLevel(appender.level);
-          if (!appender.formatter.empty()) {
-            LogFormatter::ptr format(new LogFormatter(appender.formatter));
-            if (!format->isError()) {
-              app->setFormatter(format);
-            } else {
-              std::cout << "formatter " << format->getPattern() << " is invalid." << std::endl;
-            }
-          }
-          logger->addAppender(app);
+        // 整体替换 写日志的线程要么用旧集合要么用新集合 没有appender为空而落到root的空窗
+        // 被替换掉的appender在最后一个使用者释放后才析构 缓冲中的内容会写完
+        logger->setAppenders(buildAppenders(i.name, i.appenders));
+
+        if (i.async) {
+          logger->setAsync(i.queue_size, i.batch_size, i.flush_interval, i.overflow, i.overflow_level,
+                           i.overflow_file);
+        } else {
+          logger->stopAsync();
+        }
+
+        if (!i.binary_file.empty()) {
+          logger->setBinary(i.binary_file, i.binary_buffer_size, i.binary_flush_interval);
+        } else {
+          logger->stopBinary();
         }
       }
 
@@ -691,13 +4286,21 @@ struct LogIniter {
         auto it = new_val.find(i);
         if (it == new_val.end()) {
           // 删除
+          // 恢复成没有配置过的样子 级别继承父日志器 没有appender时输出到最近的有appender的祖先
+          // 子日志器的级别和输出目标随之重新计算 不会被一起屏蔽
           auto logger = SYLAR_LOG_NAME(i.name);
-          logger->setLevel((LogLevel::Level)100);  // 设置一个比较大的Level值 使得当前logger无法使用
+          logger->setLevel(logger == SYLAR_LOG_ROOT() ? LogLevel::DEBUG : LogLevel::UNKNOW);
+          logger->stopAsync();
+          logger->stopBinary();
           logger->clearAppenders();
+          m_appenders.erase(i.name);
         }
       }
     });
   }
+
+  Mutex m_mutex;
+  std::map<std::string, AppenderDefines> m_appenders;  // 按配置创建的appender 按日志器名称
 };  // namespace sylar
 
 // 全局对象在main函数之前初始化
@@ -705,16 +4308,96 @@ static LogIniter __log_init;
 
 void LogManager::init() {}
 
+LogManager::LoggerTable::LoggerTable(size_t capacity)
+    : mask(capacity - 1), slots(new std::atomic<LoggerEntry *>[capacity]) {
+  for (size_t i = 0; i < capacity; ++i) {
+    slots[i].store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+Logger::ptr LogManager::lookup(const std::string &name, size_t hash) const {
+  LoggerTable *table = m_table.load(std::memory_order_acquire);
+  if (!table) {
+    return nullptr;
+  }
+  for (size_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+    LoggerEntry *entry = table->slots[i].load(std::memory_order_acquire);
+    if (!entry) {
+      return nullptr;
+    }
+    if (entry->hash == hash && entry->name == name) {
+      return entry->logger;
+    }
+  }
+}
+
+void LogManager::insert(const Logger::ptr &logger) {
+  std::unique_ptr<LoggerEntry> entry(new LoggerEntry);
+  entry->name = logger->getName();
+  entry->hash = std::hash<std::string>()(entry->name);
+  entry->logger = logger;
+
+  LoggerTable *table = m_table.load(std::memory_order_relaxed);
+  if (!table || (table->count + 1) * 2 > table->mask + 1) {
+    // 在新表中放好所有entry后再发布 查找的线程看到的总是完整的表
+    std::unique_ptr<LoggerTable> bigger(new LoggerTable(table ? (table->mask + 1) * 2 : 64));
+    for (auto &i : m_entries) {
+      size_t idx = i->hash & bigger->mask;
+      while (bigger->slots[idx].load(std::memory_order_relaxed)) {
+        idx = (idx + 1) & bigger->mask;
+      }
+      bigger->slots[idx].store(i.get(), std::memory_order_relaxed);
+    }
+    bigger->count = m_entries.size();
+    table = bigger.get();
+    m_tables.push_back(std::move(bigger));
+    m_table.store(table, std::memory_order_release);
+  }
+  size_t idx = entry->hash & table->mask;
+  while (table->slots[idx].load(std::memory_order_relaxed)) {
+    idx = (idx + 1) & table->mask;
+  }
+  table->slots[idx].store(entry.get(), std::memory_order_release);
+  ++table->count;
+  m_entries.push_back(std::move(entry));
+}
+
 Logger::ptr LogManager::getLogger(const std::string &name) {
+  size_t hash = std::hash<std::string>()(name);
+  Logger::ptr logger = lookup(name, hash);
+  if (logger) {
+    return logger;
+  }
+
   MutexType::Lock lock(m_mutex);
   auto it = m_loggers.find(name);
   if (it != m_loggers.end()) {
     return it->second;
   }
 
-  Logger::ptr logger(new Logger(name));
-  logger->m_root = m_root;
+  logger.reset(new Logger(name));
+  logger->m_level = LogLevel::UNKNOW;  // 默认跟随父日志器的级别
+  // 父日志器是名称上最近的已存在的祖先 a.b.c依次找a.b和a
+  Logger::ptr parent = m_root;
+  for (size_t pos = name.rfind('.'); pos != std::string::npos && pos > 0; pos = name.rfind('.', pos - 1)) {
+    auto p = m_loggers.find(name.substr(0, pos));
+    if (p != m_loggers.end()) {
+      parent = p->second;
+      break;
+    }
+  }
+  Mutex::Lock ll(GetHierarchyMutex());
+  logger->setParent(parent);
+  // 已经存在的后代中 原来挂在同一个父日志器下的改挂到新日志器下
+  std::string prefix = name + ".";
+  for (auto i = m_loggers.lower_bound(prefix); i != m_loggers.end() && i->first.compare(0, prefix.size(), prefix) == 0;
+       ++i) {
+    if (i->second->m_parent == parent) {
+      i->second->setParent(logger);
+    }
+  }
   m_loggers[name] = logger;
+  insert(logger);
   return logger;
 }
 }  // namespace sylar
\ No newline at end of file
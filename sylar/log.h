@@ -1,25 +1,65 @@
 #ifndef __SYLAR_LOG_H__
 #define __SYLAR_LOG_H__
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <list>
 #include <map>
 #include <memory>
 #include <sstream>
 #include <stdarg.h>
+#include <string.h>
 #include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <type_traits>
 #include <vector>
 
-#include "thread.h"
+#include "binlog.h"
+#include "queue.h"
 #include "singleton.h"
+#include "thread.h"
+#include "util.h"
+
+// 编译期的日志级别下限 低于它的日志语句在编译时整体去掉 不再判断logger的级别
+// 例如release构建时加上 -DSYLAR_LOG_MIN_LEVEL=2 去掉所有DEBUG日志 取值同LogLevel::Level
+#ifndef SYLAR_LOG_MIN_LEVEL
+#define SYLAR_LOG_MIN_LEVEL 0
+#endif
+
+// 日志宏因级别不够跳过的调用是否计入日志器的filtered统计
+// 默认不统计 被关掉的日志语句只有一次级别比较 打开后每次多一次原子加
+#ifndef SYLAR_LOG_COUNT_FILTERED
+#define SYLAR_LOG_COUNT_FILTERED 0
+#endif
+
+#if SYLAR_LOG_COUNT_FILTERED
+#define SYLAR_LOG_FILTERED(logger, level) \
+  if (level >= SYLAR_LOG_MIN_LEVEL) logger->countFiltered()
+#else
+#define SYLAR_LOG_FILTERED(logger, level)
+#endif
+
+// 当前调用点的静态描述 文件名 行号 函数名都在编译期确定 级别由事件单独保存 可以是运行时的值
+#define SYLAR_LOG_SITE()                                                                                             \
+  ({                                                                                                                 \
+    static constexpr sylar::LogSite s_sylar_log_site = {__FILE__, sylar::LogBasename(__FILE__),                      \
+                                                        sylar::LogStrlen(sylar::LogBasename(__FILE__)), __LINE__,    \
+                                                        __func__};                                                   \
+    &s_sylar_log_site;                                                                                               \
+  })
 
 // 只有高于设置的Level的日志才会被输出
 #define SYLAR_LOG_LEVEL(logger, level)                                                                               \
-  if (logger->getLevel() <= level)                                                                                   \
-  sylar::LogEventWrap(sylar::LogEvent::ptr(new sylar::LogEvent(logger, level, __FILE__, __LINE__, 0,                 \
-                                                               sylar::GetThreadId(), sylar::GetFiberId(), time(0)))) \
-    .getSS()
+  if (level < SYLAR_LOG_MIN_LEVEL || logger->getLevel() > level) {                                                   \
+    SYLAR_LOG_FILTERED(logger, level);                                                                               \
+  } else                                                                                                             \
+    sylar::LogEventWrap(sylar::LogEvent::Create(logger, SYLAR_LOG_SITE(), level)).getSS()
 
 #define SYLAR_LOG_DEBUG(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::DEBUG)
 #define SYLAR_LOG_INFO(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::INFO)
@@ -27,12 +67,16 @@
 #define SYLAR_LOG_ERROR(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::ERROR)
 #define SYLAR_LOG_FATAL(logger) SYLAR_LOG_LEVEL(logger, sylar::LogLevel::FATAL)
 
+// 日志器开启二进制模式时 只记录调用点id和参数 调用点在第一次执行时注册
 #define SYLAR_LOG_FMT_LEVEL(logger, level, fmt, ...)                                                                 \
-  if (logger->getLevel() <= level)                                                                                   \
-  sylar::LogEventWrap(sylar::LogEvent::ptr(new sylar::LogEvent(logger, level, __FILE__, __LINE__, 0,                 \
-                                                               sylar::GetThreadId(), sylar::GetFiberId(), time(0)))) \
-    .getEvent()                                                                                                      \
-    ->format(fmt, __VA_ARGS__)
+  if (level < SYLAR_LOG_MIN_LEVEL || logger->getLevel() > level) {                                                   \
+    SYLAR_LOG_FILTERED(logger, level);                                                                               \
+  } else if (logger->isBinary()) {                                                                                   \
+    static const sylar::BinLogSite *s_sylar_binlog_site = sylar::BinLogSite::Register(                               \
+      __FILE__, __LINE__, __func__, fmt, decltype(sylar::BinLogArgsOf(__VA_ARGS__))::Types());                       \
+    logger->logBinary(level, s_sylar_binlog_site, __VA_ARGS__);                                                      \
+  } else                                                                                                             \
+    sylar::LogEventWrap(sylar::LogEvent::Create(logger, SYLAR_LOG_SITE(), level)).getEvent()->formatArgs(fmt, __VA_ARGS__)
 
 #define SYLAR_LOG_FMT_DEBUG(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::DEBUG, fmt, __VA_ARGS__)
 #define SYLAR_LOG_FMT_INFO(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::INFO, fmt, __VA_ARGS__)
@@ -40,13 +84,65 @@
 #define SYLAR_LOG_FMT_ERROR(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::ERROR, fmt, __VA_ARGS__)
 #define SYLAR_LOG_FMT_FATAL(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::FATAL, fmt, __VA_ARGS__)
 
+// {}风格的格式化 SYLAR_LOG_FORMAT_INFO(logger, "{} took {}us", name, us)
+// 每个参数按自身类型输出(与<<相同) 占位符和参数的个数在编译期检查 fmt必须是字符串字面量
+#define SYLAR_LOG_FORMAT_LEVEL(logger, level, fmt, ...)                                                              \
+  if (level < SYLAR_LOG_MIN_LEVEL || logger->getLevel() > level) {                                                   \
+    SYLAR_LOG_FILTERED(logger, level);                                                                               \
+    static_assert(sylar::LogPlaceholderCount(fmt) == decltype(sylar::LogArgsOf(__VA_ARGS__))::value,                 \
+                  "number of {} in log format does not match the arguments");                                        \
+  } else                                                                                                             \
+    sylar::LogEventWrap(sylar::LogEvent::Create(logger, SYLAR_LOG_SITE(), level)).getSS().format(fmt, ##__VA_ARGS__)
+
+#define SYLAR_LOG_FORMAT_DEBUG(logger, fmt, ...) \
+  SYLAR_LOG_FORMAT_LEVEL(logger, sylar::LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#define SYLAR_LOG_FORMAT_INFO(logger, fmt, ...) \
+  SYLAR_LOG_FORMAT_LEVEL(logger, sylar::LogLevel::INFO, fmt, ##__VA_ARGS__)
+#define SYLAR_LOG_FORMAT_WARN(logger, fmt, ...) \
+  SYLAR_LOG_FORMAT_LEVEL(logger, sylar::LogLevel::WARN, fmt, ##__VA_ARGS__)
+#define SYLAR_LOG_FORMAT_ERROR(logger, fmt, ...) \
+  SYLAR_LOG_FORMAT_LEVEL(logger, sylar::LogLevel::ERROR, fmt, ##__VA_ARGS__)
+#define SYLAR_LOG_FORMAT_FATAL(logger, fmt, ...) \
+  SYLAR_LOG_FORMAT_LEVEL(logger, sylar::LogLevel::FATAL, fmt, ##__VA_ARGS__)
+
+// 按调用点采样或限流 state是调用点静态状态的类型 其余参数传给state.check
+// 级别不够时不碰采样状态 被丢弃的调用只有一次relaxed原子操作 不创建事件
+// 限流类的采样在丢弃之后再次输出时 先输出一行"suppressed N messages"的汇总
+#define SYLAR_LOG_SAMPLED(logger, level, state, ...)                                                                 \
+  if (level < SYLAR_LOG_MIN_LEVEL || logger->getLevel() > level) {                                                   \
+    SYLAR_LOG_FILTERED(logger, level);                                                                               \
+  } else if (sylar::LogSample sylar_log_sample = ({                                                                  \
+               static state s_sylar_log_state;                                                                       \
+               s_sylar_log_state.check(__VA_ARGS__);                                                                 \
+             })) {                                                                                                   \
+  } else                                                                                                             \
+    sylar::LogEventWrap(sylar::LogSampledEvent(logger, SYLAR_LOG_SITE(), level, sylar_log_sample.suppressed)).getSS()
+
+// 每n次输出一次(第1次 第n+1次...)
+#define SYLAR_LOG_EVERY_N(logger, level, n) SYLAR_LOG_SAMPLED(logger, level, sylar::LogEveryN, n)
+// 只输出前n次
+#define SYLAR_LOG_FIRST_N(logger, level, n) SYLAR_LOG_SAMPLED(logger, level, sylar::LogFirstN, n)
+// 每ms毫秒最多输出一次
+#define SYLAR_LOG_EVERY_MS(logger, level, ms) SYLAR_LOG_SAMPLED(logger, level, sylar::LogEveryMs, ms)
+// 令牌桶限流 平均每秒rate次 最多连续burst次
+#define SYLAR_LOG_RATE_LIMIT(logger, level, rate, burst) \
+  SYLAR_LOG_SAMPLED(logger, level, sylar::LogRateLimit, rate, burst)
+
 #define SYLAR_LOG_ROOT() sylar::LoggerMgr::getInstance()->getRoot()
 #define SYLAR_LOG_NAME(name) sylar::LoggerMgr::getInstance()->getLogger(name)
+// 每个调用点只查找一次 之后直接使用缓存的日志器 适合在频繁执行的代码里取日志器
+// SYLAR_LOG_INFO(SYLAR_LOG_STATIC("system")) << ...
+#define SYLAR_LOG_STATIC(name)                                                                                       \
+  (*({                                                                                                               \
+    static const sylar::Logger::ptr s_sylar_static_logger = SYLAR_LOG_NAME(name);                                   \
+    &s_sylar_static_logger;                                                                                          \
+  }))
 
 namespace sylar {
 
 class Logger;
 class LogManager;
+class LogAsyncWorker;
 
 // 日志等级
 class LogLevel {
@@ -58,39 +154,358 @@ class LogLevel {
   static std::string toString(const LogLevel::Level &level);
 };
 
+// 异步队列满时的处理方式
+class LogOverflow {
+ public:
+  enum Policy {
+    BLOCK = 0,             // 生产线程等到队列有空位 不丢日志
+    DROP_NEWEST = 1,       // 丢弃当前这条
+    DROP_OLDEST = 2,       // 丢弃队列中最早的一条 给当前这条腾位置
+    DROP_BELOW_LEVEL = 3,  // 低于指定级别的丢弃 其余的等待
+    SPILL = 4              // 在生产线程格式化后写入溢出文件 不经过appender
+  };
+
+  static Policy FromString(const std::string &str);
+  static const char *ToString(Policy policy);
+};
+
+// 编译期取路径中的文件名部分
+constexpr const char *LogBasenameImpl(const char *p, const char *last) {
+  return *p == '\0' ? last : LogBasenameImpl(p + 1, *p == '/' ? p + 1 : last);
+}
+constexpr const char *LogBasename(const char *path) { return LogBasenameImpl(path, path); }
+constexpr uint32_t LogStrlen(const char *p) { return *p ? 1 + LogStrlen(p + 1) : 0; }
+
+// 日志调用点 由SYLAR_LOG_SITE在每个日志宏展开处生成一个静态常量 事件中只保存指向它的指针
+struct LogSite {
+  const char *file;       // 源文件路径 __FILE__
+  const char *basename;   // 文件名部分 %f输出它
+  uint32_t basenameSize;  // 文件名长度
+  int32_t line;           // 行号
+  const char *function;   // 所在函数
+};
+
+// {}风格格式串中的占位符个数 {{和}}是转义的花括号 不算占位符
+constexpr const char *LogPlaceholderEnd(const char *p) {
+  return *p == '\0' ? p : *p == '}' ? p + 1 : LogPlaceholderEnd(p + 1);
+}
+constexpr size_t LogPlaceholderCount(const char *p) {
+  return *p == '\0' ? 0
+         : (p[0] == '{' && p[1] == '{') || (p[0] == '}' && p[1] == '}')
+           ? LogPlaceholderCount(p + 2)
+           : (*p == '{' ? 1 + LogPlaceholderCount(LogPlaceholderEnd(p)) : LogPlaceholderCount(p + 1));
+}
+
+// 参数个数 只在decltype中使用 不会对参数求值
+template <class... Args>
+struct LogArgCount {
+  static const size_t value = sizeof...(Args);
+};
+
+template <class... Args>
+LogArgCount<Args...> LogArgsOf(const Args &...);
+
+// 日志内容流 内容写在对象内部的定长缓冲里 只有超长时才转到堆上
+// 常用的整数 浮点 字符串类型直接转成字符写入 不经过iostream的locale机制
+// 其他类型(自定义了operator<<的类型)退化为借助std::ostringstream输出
+class LogStream {
+ public:
+  static const size_t kInlineSize = 1024;
+
+  LogStream() : m_data(m_inline), m_size(0), m_capacity(kInlineSize) {}
+  ~LogStream();
+
+  const char *data() const { return m_data; }
+  size_t size() const { return m_size; }
+  void clear() { m_size = 0; }
+
+  void append(const char *str, size_t len) {
+    if (m_size + len > m_capacity) {
+      grow(len);
+    }
+    memcpy(m_data + m_size, str, len);
+    m_size += len;
+  }
+  // 预留至少len字节的可写空间 返回写入位置 写完后用commit提交实际长度
+  char *reserve(size_t len) {
+    if (m_size + len > m_capacity) {
+      grow(len);
+    }
+    return m_data + m_size;
+  }
+  void commit(size_t len) { m_size += len; }
+
+  LogStream &operator<<(bool v);
+  LogStream &operator<<(char v);
+  LogStream &operator<<(signed char v) { return *this << (char)v; }
+  LogStream &operator<<(unsigned char v) { return *this << (char)v; }
+  LogStream &operator<<(short v) { return *this << (long long)v; }
+  LogStream &operator<<(unsigned short v) { return *this << (unsigned long long)v; }
+  LogStream &operator<<(int v) { return *this << (long long)v; }
+  LogStream &operator<<(unsigned int v) { return *this << (unsigned long long)v; }
+  LogStream &operator<<(long v) { return *this << (long long)v; }
+  LogStream &operator<<(unsigned long v) { return *this << (unsigned long long)v; }
+  LogStream &operator<<(long long v);
+  LogStream &operator<<(unsigned long long v);
+  LogStream &operator<<(float v) { return *this << (double)v; }
+  LogStream &operator<<(double v);
+  LogStream &operator<<(long double v);
+  LogStream &operator<<(const void *v);
+  LogStream &operator<<(const char *v);
+  LogStream &operator<<(char *v) { return *this << (const char *)v; }
+  LogStream &operator<<(const std::string &v) {
+    append(v.data(), v.size());
+    return *this;
+  }
+  // std::endl std::ends std::flush
+  LogStream &operator<<(std::ostream &(*pf)(std::ostream &));
+  // std::hex std::oct std::dec 只影响整数的输出
+  LogStream &operator<<(std::ios_base &(*pf)(std::ios_base &));
+
+  template <class T>
+  LogStream &operator<<(const T &v) {
+    std::ostringstream ss;
+    ss << v;
+    const std::string &str = ss.str();
+    append(str.data(), str.size());
+    return *this;
+  }
+
+  // {}风格的格式化 每个{}依次输出一个参数 {:x}整数按十六进制 {:.N}浮点数保留N位小数(N不超过17)
+  // 多余的参数被忽略 多余的占位符原样输出
+  template <class... Args>
+  LogStream &format(const char *fmt, const Args &...args) {
+    formatNext(fmt, args...);
+    return *this;
+  }
+
+  // 剩余的可写空间 不需要扩容
+  size_t available() const { return m_capacity - m_size; }
+
+  // 给事件附加键值对 只有json格式会输出 SYLAR_LOG_INFO(logger).field("uid", uid) << "login"
+  // 键和值在附加时就转成json片段 ,"key":value
+  LogStream &field(const char *key, const char *value);
+  LogStream &field(const char *key, const std::string &value);
+  LogStream &field(const char *key, bool value);
+  LogStream &field(const char *key, double value);
+  template <class T>
+  typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, LogStream &>::type field(
+    const char *key, T value) {
+    return fieldInt(key, value);
+  }
+  template <class T>
+  typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value, LogStream &>::type field(
+    const char *key, T value) {
+    return fieldUint(key, value);
+  }
+  const std::string &getFields() const { return m_fields; }
+
+ private:
+  LogStream(const LogStream &) = delete;
+  LogStream &operator=(const LogStream &) = delete;
+
+  void grow(size_t len);
+
+  struct FormatSpec {
+    const char *begin = nullptr;  // 占位符的起始位置
+    bool hex = false;             // {:x}
+    int precision = -1;           // {:.N}
+  };
+  // 输出下一个占位符之前的内容 返回占位符之后的位置 没有占位符时返回nullptr
+  const char *nextPlaceholder(const char *fmt, FormatSpec &spec);
+  void appendHex(unsigned long long v);
+  void appendFixed(double v, int precision);
+  void appendFieldKey(const char *key);
+  LogStream &fieldInt(const char *key, long long value);
+  LogStream &fieldUint(const char *key, unsigned long long value);
+
+  void formatNext(const char *fmt);
+  template <class T, class... Rest>
+  void formatNext(const char *fmt, const T &v, const Rest &...rest) {
+    FormatSpec spec;
+    fmt = nextPlaceholder(fmt, spec);
+    if (fmt) {
+      formatArg(spec, v);
+      formatNext(fmt, rest...);
+    }
+  }
+
+  template <class T>
+  typename std::enable_if<std::is_integral<T>::value>::type formatArg(const FormatSpec &spec, T v) {
+    if (spec.hex) {
+      appendHex((unsigned long long)v);
+    } else {
+      *this << v;
+    }
+  }
+  template <class T>
+  typename std::enable_if<std::is_floating_point<T>::value>::type formatArg(const FormatSpec &spec, T v) {
+    if (spec.precision >= 0) {
+      appendFixed(v, spec.precision);
+    } else {
+      *this << v;
+    }
+  }
+  template <class T>
+  typename std::enable_if<!std::is_arithmetic<T>::value>::type formatArg(const FormatSpec &, const T &v) {
+    *this << v;
+  }
+
+ private:
+  char *m_data;
+  size_t m_size;
+  size_t m_capacity;
+  int m_base = 10;       // 整数的进制
+  std::string m_fields;  // 附加的键值对 已经是json片段
+  char m_inline[kInlineSize];
+};
+
+// printf的可变参数只能传平凡类型 std::string传入c_str() 与二进制模式一样按%s输出 其他类型在编译期报错
+template <class T>
+inline const T &LogVarArg(const T &v) {
+  static_assert(std::is_trivially_copyable<T>::value, "SYLAR_LOG_FMT_* arguments must be trivial types or std::string");
+  return v;
+}
+
+inline const char *LogVarArg(const std::string &v) { return v.c_str(); }
+
 // 日志事件
 class LogEvent {
  public:
   typedef std::shared_ptr<LogEvent> ptr;
-  LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level, const char *file, int32_t line, uint32_t elapse,
+  // site的生命周期要长于事件 日志宏中是静态常量
+  LogEvent(std::shared_ptr<Logger> logger, const LogSite *site, LogLevel::Level level, uint32_t elapse,
            uint32_t threadId, uint32_t fiberId, uint64_t time);
 
-  const char *getFile() const { return m_file; }
-  int32_t getLine() const { return m_line; }
+  // 从线程缓存的内存池中创建事件 对象和引用计数控制块在同一块内存里 稳态下不会分配内存
+  static LogEvent::ptr Create(std::shared_ptr<Logger> logger, const LogSite *site, LogLevel::Level level,
+                              uint32_t elapse, uint32_t threadId, uint32_t fiberId, uint64_t time);
+  // 用当前的线程id 协程id和GetFastTimeUS的时间创建事件 日志宏使用
+  static LogEvent::ptr Create(std::shared_ptr<Logger> logger, const LogSite *site, LogLevel::Level level);
+
+  const LogSite *getSite() const { return m_site; }
+  const char *getFile() const { return m_site->file; }
+  const char *getBasename() const { return m_site->basename; }
+  int32_t getLine() const { return m_site->line; }
+  const char *getFunction() const { return m_site->function; }
   uint32_t getElapse() const { return m_elapse; }
   uint32_t getThreadId() const { return m_threadId; }
   uint32_t getFiberId() const { return m_fiberId; }
-  uint64_t getTime() const { return m_time; }
-  std::string getContent() const { return m_ss.str(); }
-  std::stringstream &getSS() { return m_ss; }
+  uint64_t getTime() const { return m_time / 1000000; }  // 秒
+  uint64_t getTimeUs() const { return m_time; }          // 微秒
+  std::string getContent() const { return std::string(m_ss.data(), m_ss.size()); }
+  const char *getContentData() const { return m_ss.data(); }
+  size_t getContentSize() const { return m_ss.size(); }
+  const std::string &getFields() const { return m_ss.getFields(); }
+  LogStream &getSS() { return m_ss; }
 
-  std::shared_ptr<Logger> getLogger() const { return m_logger; }
+  const std::shared_ptr<Logger> &getLogger() const { return m_logger; }
   LogLevel::Level getLevel() const { return m_level; }
 
+  // printf风格 直接格式化到内容缓冲 类型安全的格式化用LogStream::format
   void format(const char *fmt, ...);
   void format(const char *fmt, va_list vl);
+  // SYLAR_LOG_FMT_*使用 参数经LogVarArg转换后再传给可变参数
+  template <class... Args>
+  void formatArgs(const char *fmt, const Args &...args) {
+    format(fmt, LogVarArg(args)...);
+  }
 
  private:
-  const char *m_file = nullptr;  // 文件名
-  int32_t m_line = 0;            // 行号
-  uint32_t m_elapse = 0;         // 程序启动到现在的毫秒
-  uint32_t m_threadId = 0;       // 线程ID
-  uint32_t m_fiberId = 0;        // 协程ID
-  uint64_t m_time;               // 时间戳
-  std::stringstream m_ss;        // 内容
+  const LogSite *m_site;    // 调用点 文件名 行号 函数名
+  uint32_t m_elapse = 0;    // 程序启动到现在的毫秒
+  uint32_t m_threadId = 0;  // 线程ID
+  uint32_t m_fiberId = 0;   // 协程ID
+  LogLevel::Level m_level;  // 日志级别 放在这里正好填上m_time前的对齐空隙
+  uint64_t m_time;          // 时间戳(微秒)
+  LogStream m_ss;           // 内容
 
   std::shared_ptr<Logger> m_logger;
-  LogLevel::Level m_level;
+};
+
+// 采样宏使用 suppressed不为0时先输出一行汇总 再返回这次日志的事件
+LogEvent::ptr LogSampledEvent(std::shared_ptr<Logger> logger, const LogSite *site, LogLevel::Level level,
+                              uint64_t suppressed);
+
+// 采样的判定结果 转成bool为true表示丢弃这次日志
+struct LogSample {
+  bool drop;
+  uint64_t suppressed;  // 上次输出之后被丢弃的次数
+
+  explicit operator bool() const { return drop; }
+};
+
+// 以下是采样宏在每个调用点的静态状态 构造函数都是constexpr 静态对象不需要初始化守卫
+class LogEveryN {
+ public:
+  constexpr LogEveryN() : m_count(0) {}
+  LogSample check(uint64_t n) {
+    uint64_t count = m_count.fetch_add(1, std::memory_order_relaxed);
+    return LogSample{n > 1 && count % n != 0, 0};
+  }
+
+ private:
+  std::atomic<uint64_t> m_count;
+};
+
+class LogFirstN {
+ public:
+  constexpr LogFirstN() : m_count(0) {}
+  LogSample check(uint64_t n) {
+    // 超过n次之后只读不写 避免所有线程争抢同一个缓存行
+    if (m_count.load(std::memory_order_relaxed) >= n) {
+      return LogSample{true, 0};
+    }
+    return LogSample{m_count.fetch_add(1, std::memory_order_relaxed) >= n, 0};
+  }
+
+ private:
+  std::atomic<uint64_t> m_count;
+};
+
+class LogEveryMs {
+ public:
+  constexpr LogEveryMs() : m_next(0), m_suppressed(0) {}
+  LogSample check(uint64_t ms) {
+    uint64_t now = GetCoarseMonotonicUS();
+    uint64_t next = m_next.load(std::memory_order_relaxed);
+    if (now < next || !m_next.compare_exchange_strong(next, now + ms * 1000, std::memory_order_relaxed)) {
+      m_suppressed.fetch_add(1, std::memory_order_relaxed);
+      return LogSample{true, 0};
+    }
+    return LogSample{false, m_suppressed.exchange(0, std::memory_order_relaxed)};
+  }
+
+ private:
+  std::atomic<uint64_t> m_next;  // 下一次允许输出的时间(微秒)
+  std::atomic<uint64_t> m_suppressed;
+};
+
+// GCRA算法实现的令牌桶 只需要维护一个理论到达时间 一次CAS完成取令牌
+class LogRateLimit {
+ public:
+  constexpr LogRateLimit() : m_tat(0), m_suppressed(0) {}
+  LogSample check(uint64_t rate, uint64_t burst) {
+    uint64_t now = GetCoarseMonotonicUS();
+    uint64_t interval = rate ? 1000000 / rate : UINT64_MAX / 4;
+    uint64_t limit = now + interval * (burst ? burst - 1 : 0);
+    uint64_t tat = m_tat.load(std::memory_order_relaxed);
+    while (true) {
+      uint64_t start = tat > now ? tat : now;
+      if (start > limit) {
+        m_suppressed.fetch_add(1, std::memory_order_relaxed);
+        return LogSample{true, 0};
+      }
+      if (m_tat.compare_exchange_weak(tat, start + interval, std::memory_order_relaxed)) {
+        break;
+      }
+    }
+    return LogSample{false, m_suppressed.exchange(0, std::memory_order_relaxed)};
+  }
+
+ private:
+  std::atomic<uint64_t> m_tat;  // 桶里的令牌全部补满的时间(微秒)
+  std::atomic<uint64_t> m_suppressed;
 };
 
 class LogEventWrap {  // LogEvent包装器
@@ -98,14 +513,17 @@ class LogEventWrap {  // LogEvent包装器
   LogEventWrap(LogEvent::ptr event);
   ~LogEventWrap();  // 用来在析构时执行logger->log()
 
-  std::ostream &getSS();
-  std::shared_ptr<LogEvent> getEvent();
+  LogStream &getSS();
+  const std::shared_ptr<LogEvent> &getEvent();
 
  private:
   LogEvent::ptr m_event;
 };
 
 // 日志格式器
+// pattern为json时输出NDJSON 见initJson
+// 格式串在init时编译成一组平铺的指令 字面量都拼在m_literals中按偏移引用
+// format时用switch逐条解释执行 直接写入调用方提供的缓冲 不做内存分配也不拷贝智能指针
 class LogFormatter {
  public:
   typedef std::shared_ptr<LogFormatter> ptr;
@@ -113,27 +531,376 @@ class LogFormatter {
 
   std::string format(std::shared_ptr<Logger> logger, LogLevel::Level level,
                      LogEvent::ptr event);  // 将LogEvent格式化成string输出
- public:
-  class FormatItem {
-   public:
-    typedef std::shared_ptr<FormatItem> ptr;
-    virtual ~FormatItem() {}  // 虚析构
-    virtual void format(std::ostream &os, std::shared_ptr<Logger> logger, LogLevel::Level level,
-                        LogEvent::ptr event) = 0;  // 纯虚函数 存在纯虚函数就是抽象类 被继承
+  // 输出长度的上界 调用方据此准备缓冲
+  size_t getMaxSize(const LogEvent &event) const;
+  // 格式化到调用方提供的缓冲 buf至少要有getMaxSize()字节 返回实际写入的长度
+  size_t format(char *buf, LogLevel::Level level, const LogEvent &event) const;
+  // 追加到out末尾 out的容量会被复用 稳态下不分配内存
+  void format(std::string &out, LogLevel::Level level, const LogEvent &event) const;
+
+  // 格式化的逆过程 从一行日志中取出时间 级别和日志器名称 供查询工具按条件过滤
+  // 变长字段取到下一个字面量为止 行的内容不符合格式时返回false(例如多行消息的后续行)
+  struct Fields {
+    uint64_t time = 0;  // 微秒 格式中没有%d时为0
+    LogLevel::Level level = LogLevel::UNKNOW;
+    std::string name;
   };
+  bool parse(const char *begin, const char *end, Fields &fields) const;
 
   bool isError() const { return m_error; }
   const std::string &getPattern() { return m_pattern; }
+  // 每个formatter对象唯一 Logger据此判断多个appender能否共用一次格式化的结果
+  uint64_t getId() const { return m_id; }
 
   // 日志格式的解析
   void init();
 
+ private:
+  enum OpCode {
+    OP_LITERAL = 0,        // 字面量 包括%T %n
+    OP_MESSAGE = 1,        // %m
+    OP_LEVEL = 2,          // %p
+    OP_NAME = 3,           // %c
+    OP_THREAD_ID = 4,      // %t
+    OP_FIBER_ID = 5,       // %F
+    OP_ELAPSE = 6,         // %r 程序启动后的毫秒数
+    OP_DATETIME = 7,       // %d{...} 除strftime的格式外 %3N %6N %9N 输出毫秒 微秒 纳秒
+    OP_FILENAME = 8,       // %f 只输出文件名部分
+    OP_LINE = 9,           // %l
+    OP_JSON_MESSAGE = 10,  // json格式 转义后的消息
+    OP_JSON_NAME = 11,     // json格式 转义后的日志器名称
+    OP_FIELDS = 12         // json格式 事件附加的键值对
+  };
+
+  struct Op {
+    uint8_t code;
+    uint8_t width;    // 定长字段的最大输出字节数 0表示变长字段
+    uint16_t length;  // 字面量/时间格式的长度
+    uint32_t offset;  // 字面量/时间格式在m_literals中的偏移
+  };
+
+  void addLiteral(const std::string &str);
+  void addDateTime(const std::string &fmt);
+  void addOp(uint8_t code, uint8_t width, const std::string &arg = "");
+  // pattern为json或json{时间格式}时 每条日志输出一行json 键名和标点都预先拼成字面量
+  void initJson(const std::string &datetime);
+
  private:
   std::string m_pattern;
-  std::vector<FormatItem::ptr> m_items;
+  std::string m_literals;  // 所有字面量和时间格式串 时间格式以'\0'结尾供strftime使用
+  std::vector<Op> m_ops;
+  size_t m_fixedSize = 0;  // 字面量和定长字段的最大长度之和
+  uint64_t m_id;           // 唯一id 作为线程局部时间缓存的key
   bool m_error = false;
 };
 
+// 日志文件的稀疏时间索引 写在 日志文件名.idx 中 随日志文件一起切分和删除
+// 日志每写出block_size字节左右记一条 内容是这一段的偏移 长度 时间范围 出现过的级别和日志器
+// 多线程缓冲模式下相邻段的时间范围会有交叠 每条另外记到此为止的最大时间 查询时按它二分查找起点
+// 索引只在对应的日志内容写出之后才写入 不会指向文件中还不存在的内容 不是线程安全的 由LogFile的使用者加锁
+class LogIndex {
+ public:
+  typedef std::shared_ptr<LogIndex> ptr;
+  static const uint32_t kVersion = 1;
+
+  // 一段日志的概要 没有记录任何事件(empty)表示内容未知 查询时总是命中
+  struct Summary {
+    uint64_t minTime = UINT64_MAX;  // 微秒
+    uint64_t maxTime = 0;
+    uint64_t loggers = 0;           // 日志器名称的布隆过滤 见LoggerBits
+    uint32_t levels = 0;            // 出现过的级别 1 << level
+
+    bool empty() const { return !levels; }
+    void add(uint64_t time, LogLevel::Level level, uint64_t logger_bits) {
+      minTime = std::min(minTime, time);
+      maxTime = std::max(maxTime, time);
+      loggers |= logger_bits;
+      levels |= 1u << level;
+    }
+    void merge(const Summary &oth);
+    void clear() { *this = Summary(); }
+  };
+
+  // 索引文件是一个Header后面跟着若干条Entry 按offset递增
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t blockSize;
+  };
+  struct Entry {
+    uint64_t offset;   // 这一段在日志文件中的偏移
+    uint64_t length;
+    uint64_t minTime;  // 微秒
+    uint64_t maxTime;
+    uint64_t runMax;   // 从文件开头到这一段为止的最大时间 单调不减
+    uint64_t loggers;
+    uint32_t levels;
+    uint32_t reserved;
+  };
+
+  // 查询条件 只有时间范围是按二分查找的 级别和日志器逐段检查
+  struct Query {
+    uint64_t begin = 0;  // 微秒 闭区间
+    uint64_t end = UINT64_MAX;
+    uint32_t levels = ~0u;
+    uint64_t loggers = 0;  // NameBit(日志器名称) 0表示不限 子孙日志器的段也能匹配
+  };
+
+  // filename是日志文件名 file_size是日志文件当前的大小 新段从这里开始
+  LogIndex(const std::string &filename, uint32_t block_size, uint64_t file_size);
+  ~LogIndex();
+
+  // 日志文件从offset开始写入了len字节 summary为空表示内容未知 按现在的时间记 级别和日志器全部命中
+  void add(uint64_t offset, uint64_t len, const Summary *summary);
+  // 把已经结束的段写入索引文件 对应的日志内容写出之后调用
+  void flush();
+  // 日志文件被重新打开 大小为0时是新文件 旧的索引作废
+  void reopen(uint64_t file_size);
+  // 日志文件被改名为archived 当前段结束 索引文件随之改名为 archived.idx
+  void rotate(const std::string &archived);
+  uint32_t getBlockSize() const { return m_blockSize; }
+
+  static std::string IndexName(const std::string &filename) { return filename + ".idx"; }
+  // 单个名称在布隆过滤中的位
+  static uint64_t NameBit(const std::string &name);
+  // 日志器名称及其各级祖先(按.分隔)的位 查询祖先名称时也能命中子孙日志器的记录
+  static uint64_t LoggerBits(const std::string &name);
+  // 返回filename中可能含有满足条件的日志的区间[first, second) 按偏移递增且相邻的已合并
+  // 索引没有覆盖的部分(最后一段还没记入索引的内容等)总是包含在内
+  // 没有可用的索引时返回false ranges是整个文件
+  static bool Search(const std::string &filename, uint64_t file_size, const Query &query,
+                     std::vector<std::pair<uint64_t, uint64_t>> &ranges);
+
+ private:
+  // 已有的索引和file_size对得上时接着写 否则清空重写
+  void open(uint64_t file_size);
+  // 结束当前段 记一条Entry
+  void finish();
+
+ private:
+  std::string m_filename;  // 索引文件名
+  int m_fd = -1;
+  uint32_t m_blockSize;
+  uint64_t m_blockStart = 0;  // 当前段的起止偏移 相等表示还没有内容
+  uint64_t m_blockEnd = 0;
+  uint64_t m_runMax = 0;
+  Summary m_summary;
+  std::string m_pending;  // 已经结束还没写入文件的Entry
+};
+
+// 日志文件 FileAppender和RotatingFileAppender共用 不是线程安全的 由appender加锁
+// 每秒用stat比较一次inode 文件被删除或移走时才重新打开 不再无条件地每秒reopen
+// 可选按大小或按小时/天切分 切分后的文件名是 原文件名.时间后缀 超过保留个数时删除最旧的
+class LogFile {
+ public:
+  typedef std::shared_ptr<LogFile> ptr;
+  enum Interval { NONE = 0, HOURLY = 1, DAILY = 2 };
+
+  // 同步写入时用户态缓冲的大小 和std::ofstream的默认缓冲相当
+  static const size_t kBufferSize = 8192;
+
+  explicit LogFile(const std::string &filename);
+  ~LogFile();
+
+  // max_size 单个文件的最大字节数 0表示不按大小切分
+  // max_files 保留的历史文件个数 0表示不删除
+  void setRotate(uint64_t max_size, Interval interval, uint32_t max_files);
+  uint64_t getMaxSize() const { return m_maxSize; }
+  Interval getInterval() const { return m_interval; }
+  uint32_t getMaxFiles() const { return m_maxFiles; }
+  const std::string &getFilename() const { return m_filename; }
+
+  // 直接写入文件 双缓冲模式的后台线程使用 summaries为空或者与iov一一对应 用于时间索引
+  void write(const struct iovec *iov, int iovcnt, const LogIndex::Summary *summaries = nullptr);
+  // 先写入用户态缓冲 攒满kBufferSize再写入文件 同步模式使用
+  // 缓冲没有定时刷新 调用方要自己flush appender只在异步日志的后台线程里攒批 其余情况写完就flush
+  void append(const char *data, size_t len, const LogIndex::Summary *summary = nullptr);
+  void flush();
+  bool reopen();
+  // 开启时间索引 block_size为0时关闭
+  void setIndex(uint32_t block_size);
+  uint32_t getIndexBlockSize() const { return m_index ? m_index->getBlockSize() : 0; }
+
+  static Interval IntervalFromString(const std::string &str);
+  static const char *IntervalToString(Interval interval);
+  // 包含t的时间段的起点 按天时取当地时间的零点
+  static time_t PeriodStart(Interval interval, time_t t);
+  static time_t PeriodEnd(Interval interval, time_t start);
+  // 把filename改名为 filename.时间后缀 interval为NONE时后缀精确到秒 archived返回新的文件名
+  static bool Archive(const std::string &filename, Interval interval, time_t t, std::string *archived = nullptr);
+  // 只保留最新的max_files个历史文件 连同它们的索引
+  static void Purge(const std::string &filename, uint32_t max_files);
+
+ private:
+  // 写入len字节之前调用 按需重新打开或者切分文件
+  void check(size_t len);
+  void flushBuffer();
+  // t是被关闭的时间段的起点(按时间切分)或者当前时间(按大小切分) 用来生成后缀
+  void rotate(time_t t, bool by_size);
+
+ private:
+  std::string m_filename;
+  int m_fd = -1;
+  dev_t m_dev = 0;
+  ino_t m_ino = 0;
+  uint64_t m_size = 0;       // 当前文件的大小 包括还在缓冲中的
+  time_t m_lastCheck = 0;    // 上次检查inode的时间(秒)
+  time_t m_periodStart = 0;  // 当前文件所属时间段的起点
+  time_t m_periodEnd = 0;    // 到这个时间就切分
+  uint64_t m_maxSize = 0;
+  Interval m_interval = NONE;
+  uint32_t m_maxFiles = 0;
+  std::string m_buffer;
+  std::unique_ptr<LogIndex> m_index;  // 为空表示不建索引
+};
+
+// 按线程双缓冲的日志写入器
+// 生产线程只把格式化好的字节memcpy进本线程的固定大小缓冲 写满后换一块空缓冲继续写
+// 写满的缓冲交给后台线程 后台线程把攒下的缓冲一次writev给输出回调
+class LogBufferWriter : public std::enable_shared_from_this<LogBufferWriter> {
+ public:
+  typedef std::shared_ptr<LogBufferWriter> ptr;
+  typedef Mutex MutexType;
+  // 输出回调 在后台线程(或flush的调用线程)中串行执行
+  // summaries与iov一一对应 是每块缓冲中日志的概要
+  typedef std::function<void(const struct iovec *iov, int iovcnt, const LogIndex::Summary *summaries)>
+    OutputCallback;
+
+  LogBufferWriter(const std::string &name, size_t buffer_size, uint64_t flush_interval, OutputCallback cb);
+  ~LogBufferWriter();
+
+  void start();
+  // 停止后台线程 返回前所有缓冲都已输出
+  void stop();
+  // summary不为空时合并到所在缓冲的概要中
+  void append(const char *data, size_t len, const LogIndex::Summary *summary = nullptr);
+  // 收集所有线程的缓冲(包括没写满的)并立即输出
+  void flush();
+
+  size_t getBufferSize() const { return m_bufferSize; }
+  uint64_t getFlushInterval() const { return m_flushInterval; }
+
+ private:
+  struct Buffer {
+    Buffer(size_t cap) : data(new char[cap]), size(0), capacity(cap) {}
+    ~Buffer() { delete[] data; }
+    char *data;
+    size_t size;
+    size_t capacity;
+    LogIndex::Summary summary;
+  };
+
+  // 每个线程独占的缓冲 锁只在后台线程收集未写满的缓冲时才会有竞争
+  struct ThreadBuffer {
+    typedef std::shared_ptr<ThreadBuffer> ptr;
+    ~ThreadBuffer() { delete current; }
+    CASLock mutex;
+    Buffer *current = nullptr;
+  };
+
+  ThreadBuffer *getThreadBuffer();
+  Buffer *acquireBuffer(size_t min_size);
+  // 把写满的缓冲交给后台线程 待写缓冲过多时阻塞生产线程
+  void handOff(Buffer *buf);
+  void run();
+  // collect_partial为true时连同各线程没写满的缓冲一起输出
+  void collect(bool collect_partial);
+
+ private:
+  uint64_t m_id;
+  std::string m_name;
+  size_t m_bufferSize;
+  uint64_t m_flushInterval;
+  OutputCallback m_cb;
+  MutexType m_mutex;                         // 保护下面的各个列表
+  std::vector<ThreadBuffer::ptr> m_threads;  // 所有写过日志的线程的缓冲
+  std::vector<Buffer *> m_full;              // 写满待输出的缓冲
+  std::vector<Buffer *> m_free;              // 输出完可复用的缓冲
+  MutexType m_outputMutex;                   // 保证输出回调串行执行
+  Thread::ptr m_thread;
+  Semaphore m_semaphore;
+  std::atomic<bool> m_stopping{false};
+};
+
+// 日志的流式压缩 每次输出压缩成一个独立的帧(zstd frame / lz4 frame)
+// 多个帧直接拼接仍然是合法的压缩文件 可以用zstdcat lz4cat查看 进程中途退出时只丢失最后一个没写完的帧
+// 支持哪些算法由编译时找到的库决定 都没有时不压缩
+class LogCompressor {
+ public:
+  typedef std::shared_ptr<LogCompressor> ptr;
+  enum Codec { NONE = 0, ZSTD = 2, LZ4 = 3, AUTO = 4 };
+
+  // AUTO 按zstd lz4的顺序选第一个可用的
+  static Codec CodecFromString(const std::string &str);
+  static const char *CodecToString(Codec codec);
+  // level为0时用算法的默认级别 编译时没有对应的库时返回nullptr
+  static LogCompressor::ptr Create(Codec codec, int level = 0);
+
+  virtual ~LogCompressor() {}
+  // 把iov中的内容压缩成一帧 追加到out后面
+  virtual bool compress(const struct iovec *iov, int iovcnt, std::string &out) = 0;
+  Codec getCodec() const { return m_codec; }
+  int getLevel() const { return m_level; }
+
+ protected:
+  LogCompressor(Codec codec, int level) : m_codec(codec), m_level(level) {}
+
+ protected:
+  Codec m_codec;
+  int m_level;
+};
+
+// 日志器和appender的运行统计
+// 每个线程固定写其中一个槽位 槽位按缓存行对齐 不同线程的计数不会互相争抢缓存行 读取时把所有槽位加起来
+class LogMetrics {
+ public:
+  enum Counter {
+    EVENTS = 0,    // 接受的事件数
+    FILTERED = 1,  // 因级别被过滤的事件数
+    DROPPED = 2,   // 异步队列满时被丢弃的事件数 appender压缩失败时丢弃的行数
+    BYTES = 3,     // 写出的字节数
+    SPILLED = 4,   // 异步队列满时写入溢出文件的事件数
+    COUNTER_NUM = 5
+  };
+  static const size_t kSlots = 16;
+  // 写入耗时的分布 第i个桶是[2^i, 2^(i+1))纳秒 最后一个桶包括更长的
+  static const size_t kLatencyBuckets = 32;
+
+  // 某一时刻所有槽位之和 各个计数不是同一瞬间读到的 只是近似值
+  struct Snapshot {
+    uint64_t counters[COUNTER_NUM] = {};
+    uint64_t latency[kLatencyBuckets] = {};
+
+    uint64_t get(Counter c) const { return counters[c]; }
+    uint64_t getLatencySamples() const;
+    // 耗时的p分位(0~1) 返回所在桶的上界(纳秒) 没有样本时返回0
+    uint64_t getLatencyPercentile(double p) const;
+  };
+
+  LogMetrics();
+  ~LogMetrics();
+  LogMetrics(const LogMetrics &) = delete;
+  LogMetrics &operator=(const LogMetrics &) = delete;
+
+  void add(Counter c, uint64_t v = 1) { slot().counters[c].fetch_add(v, std::memory_order_relaxed); }
+  void addLatency(uint64_t ns);
+  Snapshot snapshot() const;
+  // 本线程是否要对这次写入计时 每个线程每16次写入采样一次 计时本身的开销不会压在每一条日志上
+  static bool SampleLatency();
+
+ private:
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> counters[COUNTER_NUM];
+    std::atomic<uint64_t> latency[kLatencyBuckets];
+  };
+
+  Slot &slot() { return m_slots[SlotIndex()]; }
+  static size_t SlotIndex();
+
+ private:
+  Slot *m_slots;  // kSlots个 按缓存行对齐分配
+};
+
 // 日志输出地
 class LogAppender {
   friend Logger;
@@ -147,29 +914,56 @@ class LogAppender {
   virtual void log(std::shared_ptr<Logger> logger, LogLevel::Level level,
                    LogEvent::ptr event) = 0;  // 纯虚函数，子类必须实现
   virtual std::string toYamlString() = 0;
+  virtual void flush() {}  // 把缓冲中的日志刷到输出地 异步模式每批处理完后调用
+  // 输出已经用本appender的formatter格式化好的内容 多个appender共用同一个formatter时由Logger调用
+  // 返回false表示不支持 Logger会改为调用log
+  virtual bool write(LogLevel::Level level, const char *data, size_t len) { return false; }
+  // 同上 另外带着格式化前的事件 需要事件时间等信息的appender(例如建时间索引的FileAppender)重写
+  virtual bool writeEvent(LogLevel::Level level, const LogEvent &event, const char *data, size_t len) {
+    return write(level, data, len);
+  }
+
+  // 统计后调用write(有event时调用writeEvent) 子类的log格式化完也通过它输出 自定义appender不经过这里时只统计被过滤的事件
+  bool append(LogLevel::Level level, const char *data, size_t len, const LogEvent *event = nullptr);
 
   void setFormatter(LogFormatter::ptr formatter);
   LogFormatter::ptr getFormatter();
+  // 写日志时使用 不加锁也不复制shared_ptr 被替换下来的formatter保留到appender析构 正在格式化的线程不受影响
+  LogFormatter *getRawFormatter() const { return m_rawFormatter.load(std::memory_order_acquire); }
   void setLevel(LogLevel::Level level) { m_level = level; }
   LogLevel::Level getLevel() const { return m_level; }
+  LogMetrics::Snapshot getMetrics() const { return m_metrics.snapshot(); }
 
  protected:                                   // 设置成protected方便子类继承
   LogLevel::Level m_level = LogLevel::DEBUG;  // 当前appender针对哪类日志
   LogFormatter::ptr m_formatter;              // event的日志格式
   MutexType m_mutex;  
   bool m_hasFormatter = false;
+  LogMetrics m_metrics;
+
+ private:
+  // 持有m_mutex时调用 同时更新m_formatter和m_rawFormatter
+  void storeFormatter(const LogFormatter::ptr &formatter);
+
+ private:
+  std::atomic<LogFormatter *> m_rawFormatter{nullptr};
+  std::vector<LogFormatter::ptr> m_oldFormatters;  // 替换下来的formatter 只在重新配置时增长
 };
 
 // 日志器
 class Logger : public std::enable_shared_from_this<Logger> {  // 用来获取指向自己的智能指针
   friend LogManager;
+  friend LogAsyncWorker;
 
  public:
   typedef std::shared_ptr<Logger> ptr;
   typedef CASLock MutexType;
+  // appender集合的只读快照 写日志时无锁读取 修改时复制一份新的再整体替换
+  typedef std::vector<LogAppender::ptr> AppenderList;
 
   Logger(const std::string &name = "root");
-  void log(LogLevel::Level level, LogEvent::ptr event);
+  ~Logger();
+  void log(LogLevel::Level level, const LogEvent::ptr &event);
 
   void debug(LogEvent::ptr event);
   void info(LogEvent::ptr event);
@@ -180,32 +974,159 @@ class Logger : public std::enable_shared_from_this<Logger> {  // 用来获取指
   void addAppender(LogAppender::ptr appender);
   void delAppender(LogAppender::ptr appender);
   void clearAppenders();
+  // 整体替换appender集合 写日志的线程看到的要么是旧集合要么是新集合
+  void setAppenders(const AppenderList &appenders);
+  std::shared_ptr<const AppenderList> getAppenders() const { return std::atomic_load(&m_appenders); }
+  void flush();
+
+  // 异步模式: 日志事件放入有界无锁队列 由后台线程按批次格式化并写入appender
+  // queue_size 队列容量 batch_size 每批最多处理的事件数 flush_interval 队列空闲时的最长刷新间隔(毫秒)
+  // overflow 队列满时的处理方式 overflow_level是DROP_BELOW_LEVEL时保留的最低级别 spill_file是SPILL的溢出文件
+  void setAsync(size_t queue_size, size_t batch_size, uint64_t flush_interval,
+                LogOverflow::Policy overflow = LogOverflow::BLOCK, LogLevel::Level overflow_level = LogLevel::ERROR,
+                const std::string &spill_file = "");
+  // 关闭异步模式 会等待队列中已有的日志全部输出
+  void stopAsync();
+  bool isAsync();
+
+  // 二进制模式: SYLAR_LOG_FMT_*不再格式化 只把调用点id和参数的原始字节写入file 用sylar_logdecode还原
+  // 流式的SYLAR_LOG_*不受影响 仍然输出到appender
+  void setBinary(const std::string &file, size_t buffer_size, uint64_t flush_interval);
+  void stopBinary();
+  bool isBinary() const { return m_binary.load(std::memory_order_relaxed) != nullptr; }
+  BinLogWriter::ptr getBinary();
+
+  template <class... Args>
+  void logBinary(LogLevel::Level level, const BinLogSite *site, const Args &...args) {
+    BinLogWriter *writer = m_binary.load(std::memory_order_acquire);
+    if (writer && level >= m_effectiveLevel.load(std::memory_order_relaxed)) {
+      writer->log(level, site, args...);  // EVENTS由writer的后台线程统计
+    }
+  }
 
   std::string toYamlString();
 
-  LogLevel::Level getLevel() const { return m_level; }
-  void setLevel(LogLevel::Level level) { m_level = level; }
+  // 生效的级别 自己没有设置级别时继承父日志器的 日志宏只和它比较一次
+  LogLevel::Level getLevel() const { return m_effectiveLevel.load(std::memory_order_relaxed); }
+  // UNKNOW表示不单独设置 跟随父日志器
+  void setLevel(LogLevel::Level level);
   const std::string &getName() const { return m_name; }
+  // 名称在日志文件索引中的布隆过滤位 见LogIndex::LoggerBits
+  uint64_t getIndexBits() const { return m_indexBits; }
+  Logger::ptr getParent() const { return m_parent; }
+
+  // 日志宏因级别跳过时调用 见SYLAR_LOG_COUNT_FILTERED
+  void countFiltered() { m_metrics.add(LogMetrics::FILTERED); }
+  LogMetrics::Snapshot getMetrics() const { return m_metrics.snapshot(); }
+  // 异步队列中等待输出的事件数和队列容量 同步模式时都是0
+  void getQueueDepth(size_t &depth, size_t &capacity);
 
   void setFormatter(const LogFormatter::ptr val);
   void setFormatter(const std::string &val);
   LogFormatter::ptr getFormatter();
 
  private:
-  std::string m_name;                       // 日志名称
-  LogLevel::Level m_level;                  // 日志器的日志级别
-  std::list<LogAppender::ptr> m_appenders;  // Appender集合
+  // 把事件交给输出目标的appender
+  void dispatch(LogLevel::Level level, const LogEvent::ptr &event);
+  // 重新计算自己和所有后代的生效级别和输出目标 级别 appender或者父子关系变化后调用 需要持有层级锁
+  void resolve();
+  void setParent(const Logger::ptr &parent);
+  // 多个appender时 每个不同的formatter只格式化一次 结果通过LogAppender::write共用
+  void dispatchShared(const AppenderList &appenders, LogLevel::Level level, const LogEvent::ptr &event);
+
+ private:
+  std::string m_name;                               // 日志名称 用.分隔层级 如net.http
+  uint64_t m_indexBits;
+  LogLevel::Level m_level;                          // 设置的日志级别 UNKNOW表示继承
+  std::atomic<LogLevel::Level> m_effectiveLevel;    // 生效的日志级别 resolve时写入 写日志时无锁读取
+  std::shared_ptr<const AppenderList> m_appenders;  // Appender集合 通过atomic_load/atomic_store读写
   LogFormatter::ptr m_formatter;
-  Logger::ptr m_root;
-  MutexType m_mutex;
+  Logger::ptr m_parent;                             // 名称上最近的已存在的祖先 没有时是root
+  std::vector<Logger *> m_children;                 // 以自己为父日志器的日志器
+  // 输出目标 自己有appender时是自己 否则是最近一个有appender的祖先 写日志时只跳转这一次
+  std::atomic<Logger *> m_sink;
+  MutexType m_mutex;                                // 只用来串行化修改操作 写日志的路径不加锁
+  std::shared_ptr<LogAsyncWorker> m_async;          // 异步模式的后台队列 为空表示同步输出 同样原子读写
+  std::atomic<BinLogWriter *> m_binary{nullptr};    // 当前的二进制日志 写日志时无锁读取
+  // 用过的二进制日志都保留到日志器销毁 其他线程可能还在使用刚被替换掉的那个
+  std::vector<BinLogWriter::ptr> m_binaryWriters;
+  LogMetrics m_metrics;
+};
+
+// 异步日志的后台队列 多个线程无锁写入 一个后台线程批量消费
+class LogAsyncWorker : public std::enable_shared_from_this<LogAsyncWorker> {
+ public:
+  typedef std::shared_ptr<LogAsyncWorker> ptr;
+
+  LogAsyncWorker(const std::string &name, size_t queue_size, size_t batch_size, uint64_t flush_interval,
+                 LogOverflow::Policy overflow, LogLevel::Level overflow_level, const std::string &spill_file);
+
+  void start();
+  // 停止后台线程 返回前队列中的事件都已输出
+  void stop();
+  void push(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event);
+
+  size_t getQueueSize() const { return m_queue.capacity(); }
+  size_t getQueueDepth() const { return m_queue.size(); }
+  size_t getBatchSize() const { return m_batchSize; }
+  uint64_t getFlushInterval() const { return m_flushInterval; }
+  LogOverflow::Policy getOverflow() const { return m_overflow; }
+  LogLevel::Level getOverflowLevel() const { return m_overflowLevel; }
+  const std::string &getSpillFile() const { return m_spillFile; }
+
+ private:
+  struct Item {
+    Logger::ptr logger;
+    LogLevel::Level level = LogLevel::UNKNOW;
+    LogEvent::ptr event;
+  };
+
+  void run();
+  void wakeup();
+  // 队列满时按m_overflow处理 返回false表示当前事件没有入队
+  bool overflow(Item &item);
+  // 队列满时睡眠等待 后台线程每处理完一批就叫醒等待的线程
+  void waitPush(Item &item);
+  void spill(const Item &item);
+
+ private:
+  std::string m_name;
+  BoundedQueue<Item> m_queue;
+  size_t m_batchSize;
+  uint64_t m_flushInterval;
+  LogOverflow::Policy m_overflow;
+  LogLevel::Level m_overflowLevel;
+  std::string m_spillFile;
+  Mutex m_spillMutex;
+  std::unique_ptr<LogFile> m_spill;  // 溢出文件 第一次溢出时才打开
+  Thread::ptr m_thread;
+  Semaphore m_semaphore;
+  std::atomic<bool> m_sleeping{false};
+  std::atomic<bool> m_stopping{false};
+  Semaphore m_spaceSemaphore;           // 队列腾出空间的通知
+  std::atomic<uint32_t> m_waiters{0};  // 在waitPush中等待空间的线程数
 };
 
 // 输出到控制台的Appender
 class StdoutAppender : public LogAppender {
  public:
   typedef std::shared_ptr<StdoutAppender> ptr;
+
+  // 直接用write(2)写标准输出 不经过std::cout
+  // buffer_size大于0且标准输出不是终端时 按线程缓冲 由后台线程按大小或flush_interval(毫秒)批量writev
+  StdoutAppender(size_t buffer_size = 0, uint64_t flush_interval = 1000);
+  ~StdoutAppender();
   void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;  // 重写实现父类的纯虚函数
+  bool write(LogLevel::Level level, const char *data, size_t len) override;
   std::string toYamlString() override;
+  void flush() override;
+
+ private:
+  void writeBuffers(const struct iovec *iov, int iovcnt);
+
+ private:
+  Mutex m_writeMutex;  // 保证一行不会被其他线程的输出打断
+  LogBufferWriter::ptr m_writer;
 };
 
 // 输出到文件的Appender
@@ -213,17 +1134,226 @@ class FileAppender : public LogAppender {
  public:
   typedef std::shared_ptr<FileAppender> ptr;
 
-  FileAppender(const std::string &filename);
+  // buffer_size大于0时开启按线程双缓冲模式 日志由后台线程按块写入文件
+  // flush_interval 双缓冲模式下后台线程的最长写入间隔(毫秒)
+  // compress 在后台线程中把每次写入的块压缩后再写文件 需要双缓冲模式 buffer_size为0时使用256K
+  FileAppender(const std::string &filename, size_t buffer_size = 0, uint64_t flush_interval = 1000,
+               LogCompressor::Codec compress = LogCompressor::NONE, int compress_level = 0);
+  ~FileAppender();
   void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;  // 重写实现父类的纯虚函数
+  bool write(LogLevel::Level level, const char *data, size_t len) override;
+  bool writeEvent(LogLevel::Level level, const LogEvent &event, const char *data, size_t len) override;
   std::string toYamlString() override;
+  void flush() override;
 
   // 重新打开文件
   bool reopen();
+  bool isBuffered() const { return !!m_writer; }
+  // 在 文件名.idx 中建时间索引 每写出block_size字节左右记一条 0表示关闭 sylar_logq据此只读取命中的部分
+  // 压缩时一次写入的整块是一段
+  void setIndex(uint32_t block_size);
+  uint32_t getIndexBlockSize();
+
+ protected:
+  // 双缓冲模式的输出回调 在写入线程中执行
+  void writeBuffers(const struct iovec *iov, int iovcnt, const LogIndex::Summary *summaries);
+  bool output(const char *data, size_t len, const LogIndex::Summary *summary);
+
+ protected:
+  std::string m_filename;
+  Mutex m_fileMutex;              // 保护m_file 写文件可能阻塞 不用自旋锁
+  LogFile m_file;
+  LogBufferWriter::ptr m_writer;  // 为空表示同步写入
+  LogCompressor::ptr m_compressor;
+  std::string m_compressed;       // 压缩输出 在m_fileMutex下使用
+  std::atomic<bool> m_indexed{false};
+};
+
+// 按大小或时间切分的文件Appender
+class RotatingFileAppender : public FileAppender {
+ public:
+  typedef std::shared_ptr<RotatingFileAppender> ptr;
+
+  RotatingFileAppender(const std::string &filename, uint64_t max_size, LogFile::Interval interval,
+                       uint32_t max_files, size_t buffer_size = 0, uint64_t flush_interval = 1000,
+                       LogCompressor::Codec compress = LogCompressor::NONE, int compress_level = 0);
+  std::string toYamlString() override;
+};
+
+// 内存映射文件Appender 文件按窗口预先分配并映射 写日志只是原子地移动窗口内的写入位置再memcpy 不进入内核
+// 进程崩溃时已经写进映射的内容仍在页缓存中 由内核写回文件
+// 窗口写满的那个线程负责映射下一个窗口 切换时顺带检查是否需要切分文件(与RotatingFileAppender规则相同)
+// 写入时每秒检查一次文件是否被删除或移走 文件打不开时丢弃日志并计入DROPPED 每秒重试一次
+// 文件末尾会有预分配但未使用的0 正常关闭或切分时截掉
+// 当前窗口的写入位置放在共享映射的状态文件(文件名.mmap)中 崩溃后重新打开时据此截到实际长度
+class MmapFileAppender : public LogAppender {
+ public:
+  typedef std::shared_ptr<MmapFileAppender> ptr;
+
+  // window_size 每次映射的字节数 会向上取整到页大小 不超过max_size
+  MmapFileAppender(const std::string &filename, size_t window_size = 16 * 1024 * 1024, uint64_t max_size = 0,
+                   LogFile::Interval interval = LogFile::NONE, uint32_t max_files = 0);
+  ~MmapFileAppender();
+  void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+  bool write(LogLevel::Level level, const char *data, size_t len) override;
+  std::string toYamlString() override;
+
+  static std::string StateName(const std::string &filename) { return filename + ".mmap"; }
+
+ private:
+  struct Window {
+    char *map = nullptr;                    // mmap返回的地址 映射从页边界开始
+    size_t mapSize = 0;
+    char *base = nullptr;                   // 窗口第一个字节的地址
+    uint64_t offset = 0;                    // 窗口在文件中的偏移
+    uint64_t size = 0;                      // 窗口可写的字节数
+    std::atomic<uint64_t> *used = nullptr;  // 已经分配出去的字节数 超过size表示窗口已满 指向状态文件中的槽或localUsed
+    std::atomic<uint64_t> localUsed{0};     // 没有空闲的槽时使用
+    int slot = -1;                          // 占用的状态文件的槽 解除映射时归还
+    std::atomic<uint32_t> writers{0};       // 登记了要访问窗口的线程数 为0才能解除映射
+  };
+
+  // 状态文件的内容 一页大小 头部之后是各个窗口的写入位置
+  struct State;
+
+  // 关闭窗口w 它的有效内容到end为止 然后映射下一个窗口 需要时先切分文件
+  void switchWindow(Window *w, uint64_t end, size_t need);
+  // 每秒一次 检查文件是否被移走 文件没有打开时重新打开 返回当前窗口是否需要关闭
+  bool checkFile(Window *w, size_t need, time_t now);
+  // 文件打开或者映射失败时输出一次错误 恢复后清除
+  void setError(bool failed);
+  // 以下都在持有m_switchMutex时调用
+  bool openFile(size_t need = 0);
+  // 根据状态文件算出上次写到的位置
+  uint64_t recoverEnd(int fd, const struct stat &st);
+  // 映射从offset开始至少need字节的新窗口
+  Window *mapWindow(uint64_t offset, size_t need);
+  // 解除已经没有线程在写的旧窗口的映射
+  void unmapRetired();
+  // 文件已经截断到实际长度 崩溃后不需要恢复
+  void markClean();
+
+ private:
+  std::string m_filename;
+  size_t m_windowSize;
+  uint64_t m_maxSize;
+  LogFile::Interval m_interval;
+  uint32_t m_maxFiles;
+  int m_fd = -1;
+  dev_t m_dev = 0;
+  ino_t m_ino = 0;
+  time_t m_periodStart = 0;
+  std::atomic<time_t> m_periodEnd{0};              // 按时间切分时 到这个时间就关闭当前窗口
+  std::atomic<time_t> m_lastCheck{0};              // 上次检查文件的时间(秒)
+  std::atomic<Window *> m_window{nullptr};         // 当前窗口 为空表示文件打不开 日志被丢弃
+  std::vector<std::unique_ptr<Window>> m_windows;  // 所有窗口对象都保留到析构 映射在不再使用后解除
+  State *m_state = nullptr;                        // 状态文件的映射 打不开时为空 崩溃后只能从末尾跳过0
+  uint64_t m_freeSlots = 0;                        // 状态文件中空闲的槽
+  bool m_openError = false;                        // 打开失败已经报告过 恢复前不再重复输出
+  Mutex m_switchMutex;
+};
+
+// 飞行记录器 每个线程一个预先分配的环形缓冲 只保留最近ring_size字节的日志 写日志只是一次memcpy
+// SYLAR_ASSERT失败 或者收到SIGSEGV SIGBUS SIGFPE SIGILL SIGABRT时 把缓冲内容追加到filename
+// 致命信号在备用栈上处理 栈溢出时也能导出 指定了dump_signal时收到该信号也导出 然后调用它原来的处理函数
+// 每次只导出上次导出之后的新内容 导出过程只用异步信号安全的函数 不分配内存也不加锁
+// 同时登记的appender最多16个 超出的只能调用dump导出
+class RingBufferAppender : public LogAppender {
+ public:
+  typedef std::shared_ptr<RingBufferAppender> ptr;
+
+  // ring_size 每个线程的缓冲大小 向上取整为2的幂
+  // dump_signal 收到后导出的信号(例如SIGUSR1) 0表示不接管任何信号
+  RingBufferAppender(const std::string &filename, size_t ring_size = 1024 * 1024, int dump_signal = 0);
+  ~RingBufferAppender();
+  void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+  bool write(LogLevel::Level level, const char *data, size_t len) override;
+  std::string toYamlString() override;
+
+  // 导出本appender的缓冲 reason写在导出内容的开头 正在导出时直接返回
+  void dump(const char *reason);
+  size_t getRingSize() const { return m_ringSize; }
+  const std::string &getFilename() const { return m_filename; }
+  int getDumpSignal() const { return m_dumpSignal; }
+  // 是否登记成功 没有登记的appender在崩溃和收到信号时不会导出
+  bool isRegistered() const { return m_registered; }
+
+  // 导出所有RingBufferAppender 信号处理函数和SYLAR_ASSERT调用
+  static void DumpAll(const char *reason);
+
+ private:
+  struct Ring {
+    typedef std::shared_ptr<Ring> ptr;
+    Ring(size_t size);
+    ~Ring() { delete[] data; }
+
+    char *data;
+    std::atomic<uint64_t> head{0};  // 累计写入的字节数 只有所属线程修改
+    uint64_t dumped = 0;            // 已经导出到的位置 只在导出时访问
+    uint32_t threadId = 0;          // 最后使用这个缓冲的线程
+    Ring *next = nullptr;           // 导出时遍历用的链表 只增不减
+  };
+
+  // 线程退出后它的缓冲留给新线程复用 其中的内容仍然可以导出
+  Ring *getThreadRing();
+  static void InstallSignalHandlers(int dump_signal);
+
+ private:
+  uint64_t m_id;
+  std::string m_filename;
+  size_t m_ringSize;
+  int m_dumpSignal;
+  bool m_registered = false;
+  Mutex m_ringMutex;               // 保护m_rings
+  std::vector<Ring::ptr> m_rings;  // 持有所有缓冲
+  std::atomic<Ring *> m_ringList{nullptr};
+  std::atomic<bool> m_dumping{false};
+  char *m_scratch;  // 导出时拷贝缓冲内容用 预先分配
+};
+
+// 按CPU分片的文件Appender 每条日志写入当前CPU对应的分片文件filename.0 filename.1 ...
+// 不同CPU上的线程不争抢同一个文件的锁和缓冲
+// 每条记录前加上16位十六进制的写入时间(微秒)和一个空格 Merge(sylar_logmerge)按它合并成一份按时间排序的日志
+class ShardedFileAppender : public LogAppender {
+ public:
+  typedef std::shared_ptr<ShardedFileAppender> ptr;
+  static const size_t kKeySize = 17;
+
+  // shards 分片数 0表示CPU个数
+  ShardedFileAppender(const std::string &filename, uint32_t shards = 0);
+  void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+  bool write(LogLevel::Level level, const char *data, size_t len) override;
+  std::string toYamlString() override;
+  void flush() override;
+  bool reopen();
+
+  size_t getShards() const { return m_shards.size(); }
+  static std::string ShardName(const std::string &filename, size_t idx);
+  // 把各个分片按记录的时间归并输出 时间相同的按分片的顺序 keep_key为false时去掉时间前缀
+  // 不以时间前缀开头的行属于上一条记录(多行日志)
+  static bool Merge(const std::vector<std::string> &files, std::ostream &os, bool keep_key = false);
+
+ private:
+  struct Shard {
+    Shard(const std::string &filename) : file(filename) {}
+    Mutex mutex;
+    LogFile file;
+    char pad[64];  // 相邻分片的锁不落在同一个缓存行
+  };
 
  private:
   std::string m_filename;
-  std::ofstream m_filestream;
-  uint64_t m_lastTime = 0;
+  std::vector<std::unique_ptr<Shard>> m_shards;
+};
+
+// 一个日志器及其appender的统计
+struct LogMetricsReport {
+  std::string name;
+  LogMetrics::Snapshot metrics;
+  size_t queueDepth = 0;  // 异步队列中等待输出的事件数
+  size_t queueSize = 0;   // 异步队列容量 0表示同步模式
+  // appender的类型(有文件时加上文件名)和统计
+  std::vector<std::pair<std::string, LogMetrics::Snapshot>> appenders;
 };
 
 // 日志管理器
@@ -231,17 +1361,48 @@ class LogManager {
  public:
   typedef CASLock MutexType;
   LogManager();
+  ~LogManager();
+  // 已经存在的日志器不加锁查找 只有第一次创建时才加锁
   Logger::ptr getLogger(const std::string &name);
   Logger::ptr getRoot() const { return m_root; }
 
   std::string toYamlString();
 
+  // 所有日志器的统计 读取时汇总各线程的计数
+  std::vector<LogMetricsReport> getMetrics();
+  std::string metricsToYamlString();
+  // 一行JSON 方便直接输出给监控采集
+  std::string metricsToJsonString();
+
   void init();
 
  private:
-  std::map<std::string, Logger::ptr> m_loggers;
+  struct LoggerEntry {
+    std::string name;
+    size_t hash;
+    Logger::ptr logger;
+  };
+
+  // 开放寻址的哈希表 槽位只会从空变成指向某个entry 查找的线程不加锁
+  struct LoggerTable {
+    explicit LoggerTable(size_t capacity);
+    size_t mask;
+    size_t count = 0;
+    std::unique_ptr<std::atomic<LoggerEntry *>[]> slots;
+  };
+
+  Logger::ptr lookup(const std::string &name, size_t hash) const;
+  // 需要持有m_mutex 装填超过一半时换一张两倍大的表
+  void insert(const Logger::ptr &logger);
+
+ private:
+  std::map<std::string, Logger::ptr> m_loggers;  // 按名称排序 用于遍历
   Logger::ptr m_root;
-  MutexType m_mutex;
+  MutexType m_mutex;                             // 串行化日志器的创建
+  std::atomic<LoggerTable *> m_table{nullptr};   // 当前的查找表
+  // 用过的表和entry都保留到析构 查找的线程可能还在读旧表
+  std::vector<std::unique_ptr<LoggerTable>> m_tables;
+  std::vector<std::unique_ptr<LoggerEntry>> m_entries;
 };
 
 typedef sylar::Singleton<LogManager> LoggerMgr;
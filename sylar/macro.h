@@ -7,6 +7,7 @@
   if (!(x)) {                                                                      \
     SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Assertion: " << #x << "\nBackTrace:\n"   \
                                       << sylar::BacktraceTostring(100, 2, "    "); \
+    sylar::RingBufferAppender::DumpAll("assert");                                  \
     assert(x);                                                                     \
   }
 
@@ -15,5 +16,6 @@
     SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Assertion:" << #x << "\n"                \
                                       << w << "\nBackTrace:\n"                     \
                                       << sylar::BacktraceTostring(100, 2, "    "); \
+    sylar::RingBufferAppender::DumpAll("assert");                                  \
     assert(x);                                                                     \
   }
@@ -0,0 +1,118 @@
+#ifndef __SYLAR_QUEUE_H__
+#define __SYLAR_QUEUE_H__
+
+#include <atomic>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <utility>
+
+namespace sylar {
+
+// 有界无锁队列 环形数组 + 每个槽位的序号(Dmitry Vyukov的算法)
+// 支持多生产者多消费者 生产者之间只竞争一次CAS 满了直接返回false 不会阻塞
+template <class T>
+class BoundedQueue {
+ public:
+  typedef std::shared_ptr<BoundedQueue> ptr;
+
+  // 容量向上取整为2的幂 方便用位运算取下标
+  explicit BoundedQueue(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    m_mask = size - 1;
+    m_cells = new Cell[size];
+    for (size_t i = 0; i < size; ++i) {
+      m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    m_enqueuePos.store(0, std::memory_order_relaxed);
+    m_dequeuePos.store(0, std::memory_order_relaxed);
+  }
+
+  ~BoundedQueue() { delete[] m_cells; }
+
+  bool push(const T &val) {
+    T tmp(val);
+    return push(std::move(tmp));
+  }
+
+  bool push(T &&val) {
+    Cell *cell;
+    size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &m_cells[pos & m_mask];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {  // 槽位空闲 抢占写入位置
+        if (m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {  // 槽位还没被消费 队列已满
+        return false;
+      } else {  // 被其他生产者抢先了
+        pos = m_enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+    cell->data = std::move(val);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T &val) {
+    Cell *cell;
+    size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &m_cells[pos & m_mask];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (diff == 0) {
+        if (m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {  // 队列为空
+        return false;
+      } else {
+        pos = m_dequeuePos.load(std::memory_order_relaxed);
+      }
+    }
+    val = std::move(cell->data);
+    cell->data = T();  // 及时释放槽位持有的资源(如智能指针)
+    cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  // 并发下只是近似值
+  size_t size() const {
+    size_t enq = m_enqueuePos.load(std::memory_order_relaxed);
+    size_t deq = m_dequeuePos.load(std::memory_order_relaxed);
+    return enq > deq ? enq - deq : 0;
+  }
+
+  bool empty() const { return size() == 0; }
+  size_t capacity() const { return m_mask + 1; }
+
+ private:
+  BoundedQueue(const BoundedQueue &) = delete;
+  BoundedQueue &operator=(const BoundedQueue &) = delete;
+
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T data;
+  };
+
+  // 生产者和消费者的下标放在不同的缓存行 避免伪共享
+  char m_pad0[64];
+  Cell *m_cells;
+  size_t m_mask;
+  char m_pad1[64];
+  std::atomic<size_t> m_enqueuePos;
+  char m_pad2[64];
+  std::atomic<size_t> m_dequeuePos;
+  char m_pad3[64];
+};
+
+}  // namespace sylar
+
+#endif  // __SYLAR_QUEUE_H__
@@ -1,6 +1,7 @@
 #ifndef __SYLAR_SYLAR__
 #define __SYLAR_SYLAR__
 
+#include "binlog.h"
 #include "config.h"
 #include "log.h"
 #include "macro.h"
@@ -1,5 +1,8 @@
 #include "thread.h"
 
+#include <errno.h>
+#include <time.h>
+
 #include "log.h"
 #include "util.h"
 
@@ -25,6 +28,24 @@ void Semaphore::wait() {
   }
 }
 
+bool Semaphore::timedWait(uint64_t ms) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += ms / 1000;
+  ts.tv_nsec += (ms % 1000) * 1000000;
+  if (ts.tv_nsec >= 1000000000) {
+    ts.tv_sec += 1;
+    ts.tv_nsec -= 1000000000;
+  }
+  if (sem_timedwait(&m_semaphore, &ts)) {
+    if (errno == ETIMEDOUT || errno == EINTR) {
+      return false;
+    }
+    throw std::logic_error("sem_timedwait error");
+  }
+  return true;
+}
+
 void Semaphore::notify() {
   if (sem_post(&m_semaphore)) {  // 信号量加1 returns 0 on success; on error, the value of the semaphore is left
                                  // unchanged, -1 is returned
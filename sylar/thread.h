@@ -6,6 +6,7 @@
 #include <memory>
 #include <pthread.h>
 #include <semaphore.h>
+#include <string>
 #include <thread>
 
 namespace sylar {
@@ -16,6 +17,8 @@ class Semaphore {
   ~Semaphore();
 
   void wait();
+  // 最多等待ms毫秒 超时返回false
+  bool timedWait(uint64_t ms);
   void notify();
 
  private:
@@ -1,13 +1,35 @@
 #include "util.h"
 
+#include <errno.h>
 #include <execinfo.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
 
 #include "log.h"
 
 namespace sylar {
 sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
-pid_t GetThreadId() { return syscall(SYS_gettid); }
+// 线程id缓存在线程局部变量里 不必每条日志都进一次内核
+static thread_local pid_t t_thread_id = 0;
+// fork出的子进程中 调用fork的线程的id变了
+static int s_thread_id_atfork = pthread_atfork(nullptr, nullptr, []() { t_thread_id = 0; });
+
+pid_t GetThreadId() {
+  if (!t_thread_id) {
+    t_thread_id = syscall(SYS_gettid);
+  }
+  return t_thread_id;
+}
 uint32_t GetFiberId() { return 0; }
 
 void Backtrace(std::vector<std::string> &vec, int size, int skip) {
@@ -34,4 +56,154 @@ std::string BacktraceTostring(int size, int skip, const std::string &prefix) {
   }
   return ss.str();
 }
+
+uint64_t GetCurrentMS() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return tv.tv_sec * 1000ul + tv.tv_usec / 1000;
+}
+
+uint64_t GetCurrentUS() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return tv.tv_sec * 1000000ul + tv.tv_usec;
+}
+
+static uint64_t RealtimeUS() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// TSC换算到系统时间的参数 用seqlock发布 读的一方不加锁也不写共享变量
+// 每隔约1秒由某个读者用clock_gettime重新采样 按过去一段时间的实际走时修正频率
+struct TscClock {
+  std::atomic<uint32_t> seq{0};
+  std::atomic<uint64_t> baseTsc{0};
+  std::atomic<uint64_t> baseUs{0};
+  std::atomic<uint64_t> limit{0};  // 距离baseTsc超过这么多tick就重新同步 0表示还没有校准
+  std::atomic<double> usPerTick{0};
+  std::atomic<bool> syncing{false};
+  uint64_t sampleTsc = 0;  // 上一次采样 只在syncing时访问
+  uint64_t sampleUs = 0;
+  bool enabled = false;
+
+  TscClock() {
+    // 只有不变TSC(频率恒定 深度睡眠不停)才能用来计时
+    unsigned int eax, ebx, ecx, edx;
+    enabled = __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8));
+  }
+
+  // 超过同步间隔时由一个线程重新采样 其他线程继续用旧参数推算
+  uint64_t resync(uint64_t tsc, uint64_t base_tsc, uint64_t base_us, double rate) {
+    if (syncing.exchange(true, std::memory_order_acquire)) {
+      return rate ? base_us + (uint64_t)((tsc - base_tsc) * rate) : RealtimeUS();
+    }
+    uint64_t now = RealtimeUS();
+    tsc = __rdtsc();
+    // 两次采样至少间隔10毫秒才能算出足够准确的频率
+    if (sampleTsc && tsc > sampleTsc && now >= sampleUs + 10000) {
+      rate = (double)(now - sampleUs) / (tsc - sampleTsc);
+      // 同步间隔从10毫秒开始每次翻4倍 直到1秒 刚启动时频率的误差不会累积太久
+      uint64_t interval = std::min((tsc - sampleTsc) * 4, (uint64_t)(1000000 / rate));
+      uint32_t s = seq.load(std::memory_order_relaxed);
+      seq.store(s + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      baseTsc.store(tsc, std::memory_order_relaxed);
+      baseUs.store(now, std::memory_order_relaxed);
+      usPerTick.store(rate, std::memory_order_relaxed);
+      limit.store(interval, std::memory_order_relaxed);
+      seq.store(s + 2, std::memory_order_release);
+      sampleTsc = tsc;
+      sampleUs = now;
+    } else if (!sampleTsc || now < sampleUs) {
+      sampleTsc = tsc;
+      sampleUs = now;
+    }
+    syncing.store(false, std::memory_order_release);
+    return now;
+  }
+};
+
+static TscClock s_tsc_clock;
+#endif
+
+static uint64_t s_start_us = RealtimeUS();
+
+uint64_t GetFastTimeUS() {
+#if defined(__x86_64__) || defined(__i386__)
+  if (s_tsc_clock.enabled) {
+    uint64_t tsc = __rdtsc();
+    uint32_t seq;
+    uint64_t base_tsc, base_us, limit;
+    double rate;
+    do {
+      seq = s_tsc_clock.seq.load(std::memory_order_acquire);
+      base_tsc = s_tsc_clock.baseTsc.load(std::memory_order_relaxed);
+      base_us = s_tsc_clock.baseUs.load(std::memory_order_relaxed);
+      limit = s_tsc_clock.limit.load(std::memory_order_relaxed);
+      rate = s_tsc_clock.usPerTick.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((seq & 1) || seq != s_tsc_clock.seq.load(std::memory_order_relaxed));
+    uint64_t delta = tsc - base_tsc;
+    if (delta < limit) {
+      return base_us + (uint64_t)(delta * rate);
+    }
+    return s_tsc_clock.resync(tsc, base_tsc, base_us, rate);
+  }
+#endif
+  return RealtimeUS();
+}
+
+uint32_t GetElapsedMS(uint64_t now_us) { return now_us > s_start_us ? (now_us - s_start_us) / 1000 : 0; }
+
+uint64_t GetProcessStartUS() { return s_start_us; }
+
+uint64_t GetCoarseMonotonicUS() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+}
+
+bool WriteAll(int fd, const struct iovec *iov, int iovcnt) {
+  // 直接在调用方的iov上前进 不拷贝 写日志的路径上不分配内存
+  // 某一块只写了一部分时 先用write把这块剩下的写完 再继续writev后面的
+  const struct iovec *end = iov + iovcnt;
+  while (iov < end) {
+    if (iov->iov_len == 0) {
+      ++iov;
+      continue;
+    }
+    int cnt = std::min((int)(end - iov), IOV_MAX);
+    ssize_t n = writev(fd, iov, cnt);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    while (iov < end && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      ++iov;
+    }
+    if (n > 0) {
+      const char *p = (const char *)iov->iov_base + n;
+      size_t left = iov->iov_len - n;
+      while (left > 0) {
+        ssize_t w = write(fd, p, left);
+        if (w < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          return false;
+        }
+        p += w;
+        left -= w;
+      }
+      ++iov;
+    }
+  }
+  return true;
+}
 }  // namespace sylar
\ No newline at end of file
@@ -1,10 +1,11 @@
 #ifndef __SYLAR_UTIL_H__
-#define __SYALR_UTIL_H__
+#define __SYLAR_UTIL_H__
 
 #include <stdint.h>
 #include <string>
 #include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <vector>
 
@@ -13,6 +14,21 @@ pid_t GetThreadId();
 uint32_t GetFiberId();
 void Backtrace(std::vector<std::string> &vec, int size, int skip);
 std::string BacktraceTostring(int size, int skip, const std::string &prefix);
+
+uint64_t GetCurrentMS();
+uint64_t GetCurrentUS();
+// 日志时间戳用的时钟(微秒 UTC) x86上TSC恒定时由TSC换算 每秒与系统时钟同步一次 比clock_gettime便宜
+// 其他平台退化为clock_gettime
+uint64_t GetFastTimeUS();
+// 进程启动到now_us的毫秒数 now_us取自GetFastTimeUS
+uint32_t GetElapsedMS(uint64_t now_us);
+// 进程启动的时间(微秒 UTC) GetElapsedMS以它为起点
+uint64_t GetProcessStartUS();
+// 单调时钟(微秒) 精度只有内核的tick(1~4毫秒) 但读取几乎没有开销 适合限流之类的粗略计时
+uint64_t GetCoarseMonotonicUS();
+
+// 把iov全部写入fd 处理EINTR和部分写入 一次最多IOV_MAX块 出错返回false
+bool WriteAll(int fd, const struct iovec *iov, int iovcnt);
 }  // namespace sylar
 
-#endif  // __SYALR_UTIL_H__
\ No newline at end of file
+#endif  // __SYLAR_UTIL_H__
\ No newline at end of file
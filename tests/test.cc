@@ -1,6 +1,12 @@
 #include "../sylar/log.h"
 #include "../sylar/util.h"
 
+// 级别可以是运行时的值
+void log_at(sylar::Logger::ptr logger, sylar::LogLevel::Level level) {
+    SYLAR_LOG_LEVEL(logger, level) << "Hello logger at " << sylar::LogLevel::ToString(level);
+    SYLAR_LOG_FMT_LEVEL(logger, level, "Hello logger fmt at %s", sylar::LogLevel::ToString(level));
+}
+
 int main(int argc, char ** argv) {
     sylar::Logger::ptr logger(new sylar::Logger);
     // logger->addAppender(sylar::LogAppender::ptr(new sylar::StdoutAppender));
@@ -19,8 +25,16 @@ int main(int argc, char ** argv) {
     SYLAR_LOG_ERROR(logger) << "Hello logger error";
 
     SYLAR_LOG_FMT_ERROR(logger, "Hello logger fmt %s, %d", "haha", 156);
+    SYLAR_LOG_FORMAT_ERROR(logger, "Hello logger format {}, {}, {:.2}", "haha", 156, 3.14159);
+    log_at(logger, sylar::LogLevel::INFO);
+    log_at(logger, sylar::LogLevel::FATAL);
+    for (int i = 0; i < 10; ++i) {
+        SYLAR_LOG_EVERY_N(logger, sylar::LogLevel::ERROR, 4) << "Hello logger every 4, i=" << i;
+    }
 
     auto logger_s = sylar::LoggerMgr::getInstance()->getLogger("xxx");
     SYLAR_LOG_ERROR(logger_s) << "xxxxx";
+
+    std::cout << sylar::LoggerMgr::getInstance()->metricsToYamlString() << std::endl;
     return 0;
 }
\ No newline at end of file
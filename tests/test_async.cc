@@ -0,0 +1,199 @@
+#include <unistd.h>
+
+#include "sylar/sylar.h"
+
+static const char *s_file = "async_test.log";
+
+static int CountLines(const char *file) {
+  std::ifstream ifs(file);
+  std::string line;
+  int lines = 0;
+  while (std::getline(ifs, line)) {
+    ++lines;
+  }
+  return lines;
+}
+
+static sylar::Logger::ptr NewLogger() {
+  sylar::Logger::ptr logger(new sylar::Logger("async"));
+  sylar::FileAppender::ptr appender(new sylar::FileAppender(s_file));
+  appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%p%T%m%n")));
+  logger->addAppender(appender);
+  return logger;
+}
+
+// 用户释放最后一个引用时队列中还有事件 后台线程仍要把它们全部输出 不能访问已经释放的logger
+void test_release() {
+  unlink(s_file);
+  sylar::Logger::ptr logger = NewLogger();
+  logger->setAsync(1024, 4, 1000);
+  for (int i = 0; i < 10; ++i) {
+    SYLAR_LOG_INFO(logger) << "release " << i;
+  }
+  logger.reset();
+  // logger在后台线程中析构 文件随之关闭
+  int lines = 0;
+  for (int i = 0; i < 100 && (lines = CountLines(s_file)) < 10; ++i) {
+    usleep(20 * 1000);
+  }
+  std::cout << "release: " << lines << " lines" << std::endl;
+  if (lines != 10) {
+    exit(1);
+  }
+}
+
+// stopAsync返回前队列中的事件都已输出
+void test_stop() {
+  unlink(s_file);
+  sylar::Logger::ptr logger = NewLogger();
+  logger->setAsync(64, 8, 1000);
+  for (int i = 0; i < 10000; ++i) {
+    SYLAR_LOG_INFO(logger) << "stop " << i;
+  }
+  logger->stopAsync();
+  logger->flush();
+  int lines = CountLines(s_file);
+  std::cout << "stop: " << lines << " lines" << std::endl;
+  if (lines != 10000 || logger->isAsync()) {
+    exit(1);
+  }
+}
+
+// 队列一直有积压时 后台线程也要按flush_interval刷新 不能等到队列空了才写出
+void test_flush_interval() {
+  unlink(s_file);
+  sylar::Logger::ptr logger = NewLogger();
+  logger->setAsync(1024, 1, 50);
+  uint64_t end = sylar::GetCurrentMS() + 500;
+  int lines = 0;
+  while (sylar::GetCurrentMS() < end) {
+    for (int i = 0; i < 100; ++i) {
+      SYLAR_LOG_INFO(logger) << "busy " << i;
+    }
+    lines = CountLines(s_file);
+    if (lines > 0) {
+      break;
+    }
+  }
+  logger->stopAsync();
+  std::cout << "flush interval: " << lines << " lines on disk while busy" << std::endl;
+  if (lines == 0) {
+    exit(1);
+  }
+}
+
+// 后台线程写入时卡住 直到放行 用来把队列填满
+class GateAppender : public sylar::LogAppender {
+ public:
+  typedef std::shared_ptr<GateAppender> ptr;
+  void log(sylar::Logger::ptr logger, sylar::LogLevel::Level level, sylar::LogEvent::ptr event) override {
+    m_entered = true;
+    while (!m_open) {
+      usleep(1000);
+    }
+    sylar::Mutex::Lock lock(m_lock);
+    m_lines.push_back(event->getContent());
+  }
+  std::string toYamlString() override { return ""; }
+
+  void waitEntered() {
+    while (!m_entered) {
+      usleep(1000);
+    }
+  }
+  void open() { m_open = true; }
+  std::vector<std::string> lines() {
+    sylar::Mutex::Lock lock(m_lock);
+    return m_lines;
+  }
+
+ private:
+  std::atomic<bool> m_entered{false};
+  std::atomic<bool> m_open{false};
+  sylar::Mutex m_lock;
+  std::vector<std::string> m_lines;
+};
+
+// 第一条事件卡在appender里 队列装满后再写extra条 返回appender收到的内容
+static std::vector<std::string> Overflow(sylar::LogOverflow::Policy policy, int extra, uint64_t &dropped,
+                                         uint64_t &spilled) {
+  sylar::Logger::ptr logger(new sylar::Logger("overflow"));
+  GateAppender::ptr gate(new GateAppender);
+  logger->addAppender(gate);
+  logger->setAsync(8, 1, 1000, policy, sylar::LogLevel::ERROR, s_file);
+  size_t depth = 0, capacity = 0;
+  logger->getQueueDepth(depth, capacity);
+  SYLAR_LOG_INFO(logger) << "first";
+  gate->waitEntered();
+  // BLOCK和DROP_BELOW_LEVEL的ERROR会等待 由另一个线程稍后放行
+  sylar::Thread opener(
+    [gate]() {
+      usleep(200 * 1000);
+      gate->open();
+    },
+    "opener");
+  for (int i = 0; i < (int)capacity + extra; ++i) {
+    SYLAR_LOG_INFO(logger) << "info " << i;
+  }
+  SYLAR_LOG_ERROR(logger) << "error";
+  opener.join();
+  logger->stopAsync();
+  dropped = logger->getMetrics().get(sylar::LogMetrics::DROPPED);
+  spilled = logger->getMetrics().get(sylar::LogMetrics::SPILLED);
+  return gate->lines();
+}
+
+// 队列满时各个策略丢弃或者溢出的是哪些事件
+void test_overflow() {
+  const int extra = 5;
+  const int capacity = 8;
+  uint64_t dropped = 0, spilled = 0;
+
+  // BLOCK 一条不丢
+  std::vector<std::string> lines = Overflow(sylar::LogOverflow::BLOCK, extra, dropped, spilled);
+  std::cout << "block: " << lines.size() << " lines, dropped " << dropped << std::endl;
+  if (lines.size() != 1 + capacity + extra + 1 || dropped != 0) {
+    exit(1);
+  }
+
+  // DROP_NEWEST 队列满之后的都丢掉 留下最早的
+  lines = Overflow(sylar::LogOverflow::DROP_NEWEST, extra, dropped, spilled);
+  std::cout << "drop newest: " << lines.size() << " lines, dropped " << dropped << std::endl;
+  if (lines.size() != 1 + capacity || dropped != extra + 1 || lines[1] != "info 0" ||
+      lines.back() != "info " + std::to_string(capacity - 1)) {
+    exit(1);
+  }
+
+  // DROP_OLDEST 挤掉队列中最早的 留下最新的
+  lines = Overflow(sylar::LogOverflow::DROP_OLDEST, extra, dropped, spilled);
+  std::cout << "drop oldest: " << lines.size() << " lines, dropped " << dropped << std::endl;
+  if (lines.size() != 1 + capacity || dropped != extra + 1 || lines.back() != "error" ||
+      lines[1] != "info " + std::to_string(extra + 1)) {
+    exit(1);
+  }
+
+  // DROP_BELOW_LEVEL INFO被丢掉 ERROR等到有空位
+  lines = Overflow(sylar::LogOverflow::DROP_BELOW_LEVEL, extra, dropped, spilled);
+  std::cout << "drop below level: " << lines.size() << " lines, dropped " << dropped << std::endl;
+  if (lines.size() != 1 + capacity + 1 || dropped != extra || lines.back() != "error") {
+    exit(1);
+  }
+
+  // SPILL 放不下的格式化后写入溢出文件
+  unlink(s_file);
+  lines = Overflow(sylar::LogOverflow::SPILL, extra, dropped, spilled);
+  int spill_lines = CountLines(s_file);
+  std::cout << "spill: " << lines.size() << " lines, spilled " << spilled << " file " << spill_lines << std::endl;
+  if (lines.size() != 1 + capacity || spilled != extra + 1 || spill_lines != extra + 1) {
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  test_release();
+  test_stop();
+  test_flush_interval();
+  test_overflow();
+  unlink(s_file);
+  return 0;
+}
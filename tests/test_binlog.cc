@@ -0,0 +1,115 @@
+#include <time.h>
+#include <unistd.h>
+
+#include "sylar/sylar.h"
+
+static const char *s_file = "binlog_test.bin";
+static const int s_count = 1000000;
+
+sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("binlog");
+
+// 只统计当前线程的CPU时间 不含后台线程写文件的开销
+static uint64_t ThreadCpuNS() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+// 二进制模式下每次调用的耗时 解码后的内容应与文本模式一致
+void test_binlog() {
+  unlink(s_file);
+  g_logger->setFormatter("%d{%Y-%m-%d %H:%M:%S.%6N}%T%t%T[%p]%T[%c]%T%f:%l%T%m%n");
+  g_logger->setBinary(s_file, 256 * 1024, 1000);
+
+  std::string name = "sylar";
+  const char *null_str = nullptr;
+  usleep(10 * 1000);
+  uint32_t elapse = sylar::GetElapsedMS(sylar::GetFastTimeUS());
+  SYLAR_LOG_FMT_INFO(g_logger, "int=%d neg=%i uint=%u hex=%#x char=%c", 42, -7, 3000000000u, 255, 'z');
+  SYLAR_LOG_FMT_WARN(g_logger, "long=%ld ull=%llu size=%zu", -1234567890123l, 18446744073709551615ull,
+                     sizeof(int));
+  SYLAR_LOG_FMT_ERROR(g_logger, "double=%.3f exp=%e str=[%-8s] std=%s null=%s", 3.14159, 1e10, "ab",
+                      name, null_str);
+  SYLAR_LOG_FMT_DEBUG(g_logger, "width=[%*d] prec=[%.*f] pct=100%% ptr=%p", 6, 42, 2, 2.71828,
+                      (void *)0x1234);
+
+  uint64_t begin = sylar::GetCurrentUS();
+  uint64_t cpu_begin = ThreadCpuNS();
+  for (int i = 0; i < s_count; ++i) {
+    SYLAR_LOG_FMT_INFO(g_logger, "request id=%d cost=%.2fms user=%s", i, i * 0.01, "guest");
+  }
+  uint64_t cpu_cost = ThreadCpuNS() - cpu_begin;
+  uint64_t cost = sylar::GetCurrentUS() - begin;
+  g_logger->stopBinary();
+  std::cout << "binary log: " << cost * 1000.0 / s_count << " ns/op, producer cpu " << cpu_cost * 1.0 / s_count
+            << " ns/op" << std::endl;
+  // 记录数由后台线程写出时统计
+  uint64_t events = g_logger->getMetrics().get(sylar::LogMetrics::EVENTS);
+  if (events != s_count + 4) {
+    std::cout << "events: " << events << std::endl;
+    exit(1);
+  }
+
+  std::ifstream ifs(s_file, std::ios::in | std::ios::binary);
+  std::stringstream ss;
+  sylar::BinLogReader reader;
+  if (!reader.decode(ifs, ss)) {
+    std::cout << "decode failed" << std::endl;
+    exit(1);
+  }
+  std::string line;
+  int lines = 0;
+  while (std::getline(ss, line)) {
+    if (lines < 4) {
+      std::cout << line << std::endl;
+    }
+    ++lines;
+  }
+  std::cout << "decoded lines: " << lines << std::endl;
+  if (lines != s_count + 4) {
+    exit(1);
+  }
+
+  // %r由段头中记录的进程启动时间还原
+  std::ifstream elapse_ifs(s_file, std::ios::in | std::ios::binary);
+  std::stringstream elapse_ss;
+  sylar::BinLogReader elapse_reader("%r%n");
+  uint32_t decoded = 0;
+  if (!elapse_reader.decode(elapse_ifs, elapse_ss) || !(elapse_ss >> decoded)) {
+    exit(1);
+  }
+  std::cout << "elapse: " << elapse << "ms decoded " << decoded << "ms" << std::endl;
+  if (decoded < elapse || decoded > elapse + 1000) {
+    exit(1);
+  }
+}
+
+// 文本模式下std::string参数按%s输出它的内容
+void test_text() {
+  const char *file = "binlog_text.log";
+  unlink(file);
+  std::string name = "sylar";
+  const char *null_str = nullptr;
+  {
+    sylar::Logger::ptr logger(new sylar::Logger("binlog.text"));
+    sylar::LogAppender::ptr appender(new sylar::FileAppender(file));
+    appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+    logger->addAppender(appender);
+    SYLAR_LOG_FMT_ERROR(logger, "double=%.3f exp=%e str=[%-8s] std=%s null=%s", 3.14159, 1e10, "ab", name,
+                        null_str);
+  }
+  std::ifstream ifs(file);
+  std::string line;
+  std::getline(ifs, line);
+  std::cout << "text: " << line << std::endl;
+  unlink(file);
+  if (line != "double=3.142 exp=1.000000e+10 str=[ab      ] std=sylar null=(null)") {
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  test_text();
+  test_binlog();
+  return 0;
+}
@@ -0,0 +1,103 @@
+#include <unistd.h>
+
+#include "sylar/sylar.h"
+
+#ifdef SYLAR_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef SYLAR_HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+static const char *s_file = "compress_test.log";
+static const int s_count = 100000;
+
+static std::string ReadFile(const char *file) {
+  std::ifstream ifs(file, std::ios::in | std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+}
+
+#if !defined(SYLAR_HAVE_ZSTD) && !defined(SYLAR_HAVE_LZ4)
+#error "test_compress needs zstd or lz4"
+#endif
+
+// 文件由多个独立的帧拼接而成 逐帧解压
+static bool Decompress(sylar::LogCompressor::Codec codec, const std::string &in, std::string &out) {
+  char buf[64 * 1024];
+#ifdef SYLAR_HAVE_ZSTD
+  if (codec == sylar::LogCompressor::ZSTD) {
+    ZSTD_DStream *ds = ZSTD_createDStream();
+    ZSTD_initDStream(ds);
+    ZSTD_inBuffer input = {in.data(), in.size(), 0};
+    size_t rt = 0;
+    while (input.pos < input.size) {
+      ZSTD_outBuffer output = {buf, sizeof(buf), 0};
+      rt = ZSTD_decompressStream(ds, &output, &input);
+      if (ZSTD_isError(rt)) {
+        break;
+      }
+      out.append(buf, output.pos);
+    }
+    ZSTD_freeDStream(ds);
+    return !ZSTD_isError(rt) && rt == 0;
+  }
+#endif
+#ifdef SYLAR_HAVE_LZ4
+  if (codec == sylar::LogCompressor::LZ4) {
+    LZ4F_dctx *ctx = nullptr;
+    LZ4F_createDecompressionContext(&ctx, LZ4F_VERSION);
+    const char *p = in.data();
+    const char *end = p + in.size();
+    size_t rt = 0;
+    while (p < end) {
+      size_t out_size = sizeof(buf);
+      size_t in_size = end - p;
+      rt = LZ4F_decompress(ctx, buf, &out_size, p, &in_size, nullptr);
+      if (LZ4F_isError(rt)) {
+        break;
+      }
+      out.append(buf, out_size);
+      p += in_size;
+    }
+    LZ4F_freeDecompressionContext(ctx);
+    return !LZ4F_isError(rt) && rt == 0;
+  }
+#endif
+  return false;
+}
+
+// 写入的日志解压后应与原文一致
+static void RoundTrip(sylar::LogCompressor::Codec codec) {
+  unlink(s_file);
+  std::string expect;
+  {
+    sylar::Logger::ptr logger(new sylar::Logger("compress"));
+    sylar::LogAppender::ptr appender(new sylar::FileAppender(s_file, 64 * 1024, 100, codec));
+    appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%p%T%m%n")));
+    logger->addAppender(appender);
+    for (int i = 0; i < s_count; ++i) {
+      SYLAR_LOG_INFO(logger) << "request id=" << i << " user=guest status=200";
+      expect += "INFO\trequest id=" + std::to_string(i) + " user=guest status=200\n";
+    }
+  }
+  std::string compressed = ReadFile(s_file);
+  std::string content;
+  bool ok = Decompress(codec, compressed, content);
+  std::cout << sylar::LogCompressor::CodecToString(codec) << ": " << expect.size() << " -> " << compressed.size()
+            << " bytes" << std::endl;
+  if (!ok || content != expect) {
+    std::cout << "round trip failed" << std::endl;
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+#ifdef SYLAR_HAVE_ZSTD
+  RoundTrip(sylar::LogCompressor::ZSTD);
+#endif
+#ifdef SYLAR_HAVE_LZ4
+  RoundTrip(sylar::LogCompressor::LZ4);
+#endif
+  unlink(s_file);
+  return 0;
+}
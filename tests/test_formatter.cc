@@ -0,0 +1,371 @@
+#include <sys/time.h>
+
+#include "sylar/sylar.h"
+
+// 旧版格式器: 每个字段一个堆上的多态对象 虚函数逐个写入stringstream 智能指针按值传递
+namespace legacy {
+class FormatItem {
+ public:
+  typedef std::shared_ptr<FormatItem> ptr;
+  virtual ~FormatItem() {}
+  virtual void format(std::ostream &os, sylar::Logger::ptr logger, sylar::LogLevel::Level level,
+                      sylar::LogEvent::ptr event) = 0;
+};
+
+#define XX(name, expr)                                                                                     \
+  class name : public FormatItem {                                                                         \
+   public:                                                                                                 \
+    void format(std::ostream &os, sylar::Logger::ptr logger, sylar::LogLevel::Level level,                 \
+                sylar::LogEvent::ptr event) override {                                                     \
+      expr;                                                                                                \
+    }                                                                                                      \
+  };
+
+XX(MessageItem, os << event->getContent())
+XX(LevelItem, os << sylar::LogLevel::ToString(level))
+XX(NameItem, os << event->getLogger()->getName())
+XX(ThreadIdItem, os << event->getThreadId())
+XX(FiberIdItem, os << event->getFiberId())
+XX(FilenameItem, os << event->getBasename())
+XX(LineItem, os << event->getLine())
+XX(NewLineItem, os << std::endl)
+XX(TabItem, os << "\t")
+#undef XX
+
+class DateTimeItem : public FormatItem {
+ public:
+  void format(std::ostream &os, sylar::Logger::ptr logger, sylar::LogLevel::Level level,
+              sylar::LogEvent::ptr event) override {
+    struct tm tm;
+    time_t time = event->getTime();
+    localtime_r(&time, &tm);
+    char buf[64];
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+    os << buf;
+  }
+};
+
+class StringItem : public FormatItem {
+ public:
+  StringItem(const std::string &str) : m_str(str) {}
+  void format(std::ostream &os, sylar::Logger::ptr logger, sylar::LogLevel::Level level,
+              sylar::LogEvent::ptr event) override {
+    os << m_str;
+  }
+
+ private:
+  std::string m_str;
+};
+
+// 对应 %d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%T%m%n
+class Formatter {
+ public:
+  Formatter() {
+    m_items.push_back(FormatItem::ptr(new DateTimeItem));
+    m_items.push_back(FormatItem::ptr(new TabItem));
+    m_items.push_back(FormatItem::ptr(new ThreadIdItem));
+    m_items.push_back(FormatItem::ptr(new TabItem));
+    m_items.push_back(FormatItem::ptr(new FiberIdItem));
+    m_items.push_back(FormatItem::ptr(new TabItem));
+    m_items.push_back(FormatItem::ptr(new StringItem("[")));
+    m_items.push_back(FormatItem::ptr(new LevelItem));
+    m_items.push_back(FormatItem::ptr(new StringItem("]")));
+    m_items.push_back(FormatItem::ptr(new TabItem));
+    m_items.push_back(FormatItem::ptr(new StringItem("[")));
+    m_items.push_back(FormatItem::ptr(new NameItem));
+    m_items.push_back(FormatItem::ptr(new StringItem("]")));
+    m_items.push_back(FormatItem::ptr(new TabItem));
+    m_items.push_back(FormatItem::ptr(new FilenameItem));
+    m_items.push_back(FormatItem::ptr(new StringItem(":")));
+    m_items.push_back(FormatItem::ptr(new LineItem));
+    m_items.push_back(FormatItem::ptr(new TabItem));
+    m_items.push_back(FormatItem::ptr(new TabItem));
+    m_items.push_back(FormatItem::ptr(new MessageItem));
+    m_items.push_back(FormatItem::ptr(new NewLineItem));
+  }
+
+  std::string format(sylar::Logger::ptr logger, sylar::LogLevel::Level level, sylar::LogEvent::ptr event) {
+    std::stringstream ss;
+    for (auto &i : m_items) {
+      i->format(ss, logger, level, event);
+    }
+    return ss.str();
+  }
+
+ private:
+  std::vector<FormatItem::ptr> m_items;
+};
+}  // namespace legacy
+
+static uint64_t NowUS() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  return tv.tv_sec * 1000000ul + tv.tv_usec;
+}
+
+static const char *s_pattern = "%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%T%m%n";
+static const int s_count = 1000000;
+
+void test_formatter() {
+  sylar::Logger::ptr logger(new sylar::Logger("bench"));
+  sylar::LogEvent::ptr event(new sylar::LogEvent(logger, SYLAR_LOG_SITE(), sylar::LogLevel::INFO, 0,
+                                                 sylar::GetThreadId(), sylar::GetFiberId(), sylar::GetCurrentUS()));
+  event->getSS() << "user login success, uid=" << 10086 << " cost=" << 3.25 << "ms";
+
+  legacy::Formatter old_fmt;
+  sylar::LogFormatter new_fmt(s_pattern);
+
+  std::string old_str = old_fmt.format(logger, sylar::LogLevel::INFO, event);
+  std::string new_str = new_fmt.format(logger, sylar::LogLevel::INFO, event);
+  std::cout << "legacy:   " << old_str << "compiled: " << new_str;
+  if (old_str != new_str) {
+    std::cout << "output mismatch" << std::endl;
+    exit(1);
+  }
+
+  size_t bytes = 0;
+  uint64_t begin = NowUS();
+  for (int i = 0; i < s_count; ++i) {
+    bytes += old_fmt.format(logger, sylar::LogLevel::INFO, event).size();
+  }
+  uint64_t old_cost = NowUS() - begin;
+
+  std::string buf;
+  begin = NowUS();
+  for (int i = 0; i < s_count; ++i) {
+    buf.clear();
+    new_fmt.format(buf, sylar::LogLevel::INFO, *event);
+    bytes += buf.size();
+  }
+  uint64_t new_cost = NowUS() - begin;
+
+  std::cout << "legacy formatter:   " << old_cost * 1000.0 / s_count << " ns/op" << std::endl;
+  std::cout << "compiled formatter: " << new_cost * 1000.0 / s_count << " ns/op" << std::endl;
+  std::cout << "bytes: " << bytes << std::endl;
+}
+
+// 保存收到的内容
+class CaptureAppender : public sylar::LogAppender {
+ public:
+  typedef std::shared_ptr<CaptureAppender> ptr;
+  void log(sylar::Logger::ptr logger, sylar::LogLevel::Level level, sylar::LogEvent::ptr event) override {
+    std::string buf;
+    getFormatter()->format(buf, level, *event);
+    write(level, buf.data(), buf.size());
+  }
+  bool write(sylar::LogLevel::Level level, const char *data, size_t len) override {
+    lines.push_back(std::string(data, len));
+    return true;
+  }
+  std::string toYamlString() override { return ""; }
+
+  std::vector<std::string> lines;
+};
+
+// 输出时又往另一个日志器写日志 检查手里的内容有没有被内层的格式化改掉
+class NestingAppender : public CaptureAppender {
+ public:
+  bool write(sylar::LogLevel::Level level, const char *data, size_t len) override {
+    std::string before(data, len);
+    SYLAR_LOG_INFO(inner) << "nested " << before.size();
+    clobbered = clobbered || std::string(data, len) != before;
+    return CaptureAppender::write(level, data, len);
+  }
+
+  sylar::Logger::ptr inner;
+  bool clobbered = false;
+};
+
+static CaptureAppender::ptr AddCapture(sylar::Logger::ptr logger, const std::string &pattern) {
+  CaptureAppender::ptr appender(new CaptureAppender);
+  appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter(pattern)));
+  logger->addAppender(appender);
+  return appender;
+}
+
+// 多个appender共用格式化结果时 appender里再写日志不能覆盖外层正在输出的内容
+void test_reentrant() {
+  sylar::Logger::ptr outer(new sylar::Logger("outer"));
+  sylar::Logger::ptr inner(new sylar::Logger("inner"));
+  std::shared_ptr<NestingAppender> nesting(new NestingAppender);
+  nesting->inner = inner;
+  nesting->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+  outer->addAppender(nesting);
+  CaptureAppender::ptr after = AddCapture(outer, "%m%n");
+  CaptureAppender::ptr inner1 = AddCapture(inner, "%m%n");
+  CaptureAppender::ptr inner2 = AddCapture(inner, "[%m]%n");
+  SYLAR_LOG_INFO(outer) << "outer";
+  std::cout << "reentrant: " << nesting->lines[0] << after->lines[0] << inner1->lines[0] << inner2->lines[0];
+  if (nesting->clobbered || nesting->lines[0] != "outer\n" || after->lines[0] != "outer\n" ||
+      inner1->lines[0] != "nested 6\n" || inner2->lines[0] != "[nested 6]\n") {
+    exit(1);
+  }
+}
+
+// 用json格式格式化一条事件 content原样作为消息
+static std::string FormatJson(const std::string &pattern, sylar::Logger::ptr logger, const std::string &content,
+                              uint64_t time = 0) {
+  sylar::LogEvent::ptr event(
+    new sylar::LogEvent(logger, SYLAR_LOG_SITE(), sylar::LogLevel::INFO, 0, 1, 0, time ? time : 1000000));
+  event->getSS().append(content.data(), content.size());
+  sylar::LogFormatter fmt(pattern);
+  std::string buf;
+  fmt.format(buf, sylar::LogLevel::INFO, *event);
+  return buf;
+}
+
+// 逐字节转义 作为对照
+static std::string EscapeSlow(const std::string &str) {
+  std::string out;
+  for (unsigned char c : str) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += (char)c;
+    } else if (c == '\b') {
+      out += "\\b";
+    } else if (c == '\f') {
+      out += "\\f";
+    } else if (c == '\n') {
+      out += "\\n";
+    } else if (c == '\r') {
+      out += "\\r";
+    } else if (c == '\t') {
+      out += "\\t";
+    } else if (c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      out += buf;
+    } else {
+      out += (char)c;
+    }
+  }
+  return out;
+}
+
+// 取出一行json中的msg 没有附加字段时msg后面紧跟着"}\n
+static std::string JsonMessage(const std::string &line) {
+  size_t begin = line.find("\"msg\":\"") + 7;
+  return line.substr(begin, line.size() - begin - 3);
+}
+
+// 需要转义的字节出现在8字节字里的每一个位置 以及字前后的余下部分 结果与逐字节转义一致
+void test_json_escape() {
+  sylar::Logger::ptr logger(new sylar::Logger("json"));
+  const char specials[] = {'\0', '\x01', '\b', '\t', '\n', '\f', '\r', '\x1f', '"', '\\'};
+  int cases = 0;
+  for (char c : specials) {
+    for (size_t prefix = 0; prefix < 24; ++prefix) {
+      for (size_t suffix : {0, 1, 7, 8, 9}) {
+        std::string content = std::string(prefix, 'a') + c + std::string(suffix, 'b');
+        std::string msg = JsonMessage(FormatJson("json", logger, content));
+        if (msg != EscapeSlow(content)) {
+          std::cout << "json escape: prefix=" << prefix << " byte=" << (int)c << " got " << msg << std::endl;
+          exit(1);
+        }
+        ++cases;
+      }
+    }
+  }
+  // 一个字里有多个需要转义的字节 空格和0x7f不转义
+  std::string mixed("\"\\\n\x7f \x1f\"\\abcdefgh\"\"\"\"\"\"\"\"\x20\x21", 28);
+  if (JsonMessage(FormatJson("json", logger, mixed)) != EscapeSlow(mixed)) {
+    std::cout << "json escape: mixed word" << std::endl;
+    exit(1);
+  }
+  // 日志器名称同样转义
+  sylar::Logger::ptr quoted(new sylar::Logger("a\"b\\c"));
+  std::string line = FormatJson("json", quoted, "x");
+  if (line.find("\"logger\":\"a\\\"b\\\\c\"") == std::string::npos) {
+    std::cout << "json escape: " << line;
+    exit(1);
+  }
+  std::cout << "json escape: " << cases << " cases" << std::endl;
+}
+
+// 大于0x7f的字节(UTF-8)不论落在字的哪个位置都原样输出
+void test_json_utf8() {
+  sylar::Logger::ptr logger(new sylar::Logger("json"));
+  const std::string text = "\xe4\xb8\xad\xe6\x96\x87 caf\xc3\xa9 \xf0\x9f\x98\x80 \xff\x80";
+  for (size_t prefix = 0; prefix < 8; ++prefix) {
+    std::string content = std::string(prefix, 'a') + text + "\n" + text;
+    std::string expect = std::string(prefix, 'a') + text + "\\n" + text;
+    std::string msg = JsonMessage(FormatJson("json", logger, content));
+    if (msg != expect) {
+      std::cout << "json utf8: prefix=" << prefix << " got " << msg << std::endl;
+      exit(1);
+    }
+  }
+  std::cout << "json utf8: " << text << std::endl;
+}
+
+// field()的各种类型 附加在msg之后
+void test_json_fields() {
+  sylar::Logger::ptr logger(new sylar::Logger("json"));
+  sylar::LogEvent::ptr event(new sylar::LogEvent(logger, SYLAR_LOG_SITE(), sylar::LogLevel::INFO, 0, 1, 0, 1000000));
+  event->getSS() << "fields";
+  event->getSS()
+    .field("str", "a\"b\n")
+    .field("null", (const char *)nullptr)
+    .field("string", std::string("\xe4\xb8\xad\\"))
+    .field("yes", true)
+    .field("no", false)
+    .field("double", 1.5)
+    .field("nan", std::nan(""))
+    .field("inf", HUGE_VAL)
+    .field("int", -42)
+    .field("short", (short)-7)
+    .field("min", std::numeric_limits<int64_t>::min())
+    .field("uint", 42u)
+    .field("max", std::numeric_limits<uint64_t>::max())
+    .field("char", (unsigned char)200);
+  sylar::LogFormatter fmt("json");
+  std::string line;
+  fmt.format(line, sylar::LogLevel::INFO, *event);
+  std::string expect =
+    "\"msg\":\"fields\",\"str\":\"a\\\"b\\n\",\"null\":null,\"string\":\"\xe4\xb8\xad\\\\\",\"yes\":true,"
+    "\"no\":false,\"double\":1.5,\"nan\":null,\"inf\":null,\"int\":-42,\"short\":-7,"
+    "\"min\":-9223372036854775808,\"uint\":42,\"max\":18446744073709551615,\"char\":200}\n";
+  std::cout << "json fields: " << line;
+  if (line.size() < expect.size() || line.compare(line.size() - expect.size(), expect.size(), expect) != 0) {
+    exit(1);
+  }
+  // 其他格式不输出附加字段
+  std::string text;
+  sylar::LogFormatter("%m%n").format(text, sylar::LogLevel::INFO, *event);
+  if (text != "fields\n") {
+    exit(1);
+  }
+}
+
+// json{...}指定时间格式 整行的键和顺序固定
+void test_json_time() {
+  sylar::Logger::ptr logger(new sylar::Logger("json"));
+  const uint64_t time = 1700000000123456ull;
+  time_t sec = time / 1000000;
+  struct tm tm;
+  localtime_r(&sec, &tm);
+  char date[64];
+  strftime(date, sizeof(date), "%Y/%m/%d %H:%M:%S", &tm);
+  std::string line = FormatJson("json{%Y/%m/%d %H:%M:%S.%3N}", logger, "hello", time);
+  std::string expect = std::string("{\"time\":\"") + date +
+                       ".123\",\"level\":\"INFO\",\"logger\":\"json\",\"thread\":1,\"fiber\":0,\"file\":\"" +
+                       "test_formatter.cc\",\"line\":";
+  std::cout << "json time: " << line;
+  if (line.compare(0, expect.size(), expect) != 0 || JsonMessage(line) != "hello") {
+    exit(1);
+  }
+  // 花括号不完整时不是json格式
+  if (FormatJson("json{%Y", logger, "hello").find("\"msg\"") != std::string::npos) {
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  test_formatter();
+  test_reentrant();
+  test_json_escape();
+  test_json_utf8();
+  test_json_fields();
+  test_json_time();
+  return 0;
+}
@@ -0,0 +1,181 @@
+#include "sylar/sylar.h"
+
+// 保存收到的内容
+class CaptureAppender : public sylar::LogAppender {
+ public:
+  typedef std::shared_ptr<CaptureAppender> ptr;
+  void log(sylar::Logger::ptr logger, sylar::LogLevel::Level level, sylar::LogEvent::ptr event) override {
+    std::string buf;
+    getFormatter()->format(buf, level, *event);
+    write(level, buf.data(), buf.size());
+  }
+  bool write(sylar::LogLevel::Level level, const char *data, size_t len) override {
+    sylar::Mutex::Lock lock(m_lock);
+    m_lines.push_back(std::string(data, len));
+    return true;
+  }
+  std::string toYamlString() override { return ""; }
+
+  // 取出收到的内容并清空
+  std::vector<std::string> take() {
+    sylar::Mutex::Lock lock(m_lock);
+    std::vector<std::string> lines;
+    lines.swap(m_lines);
+    return lines;
+  }
+
+ private:
+  sylar::Mutex m_lock;
+  std::vector<std::string> m_lines;
+};
+
+static CaptureAppender::ptr NewCapture() {
+  CaptureAppender::ptr appender(new CaptureAppender);
+  appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%c %m%n")));
+  return appender;
+}
+
+static void Expect(const std::string &name, const std::vector<std::string> &lines,
+                   const std::vector<std::string> &expect) {
+  std::cout << name << ": " << lines.size() << " lines" << std::endl;
+  if (lines != expect) {
+    for (auto &i : lines) {
+      std::cout << "  " << i;
+    }
+    exit(1);
+  }
+}
+
+// 子日志器先于祖先创建 祖先创建后子日志器改挂到它下面 继承它的级别并输出到它的appender
+void test_reparent() {
+  sylar::Logger::ptr child = SYLAR_LOG_NAME("reparent.a.b");
+  CaptureAppender::ptr root = NewCapture();
+  SYLAR_LOG_ROOT()->addAppender(root);
+  SYLAR_LOG_INFO(child) << "before";
+  Expect("before parent", root->take(), {"reparent.a.b before\n"});
+
+  sylar::Logger::ptr parent = SYLAR_LOG_NAME("reparent.a");
+  CaptureAppender::ptr sink = NewCapture();
+  parent->addAppender(sink);
+  parent->setLevel(sylar::LogLevel::WARN);
+  SYLAR_LOG_INFO(child) << "filtered";
+  SYLAR_LOG_WARN(child) << "after";
+  if (child->getLevel() != sylar::LogLevel::WARN) {
+    exit(1);
+  }
+  Expect("after parent", sink->take(), {"reparent.a.b after\n"});
+  Expect("root after parent", root->take(), {});
+  SYLAR_LOG_ROOT()->delAppender(root);
+}
+
+// 级别逐级继承 自己设置了级别时不受祖先影响 恢复成UNKNOW后重新继承
+void test_level() {
+  sylar::Logger::ptr top = SYLAR_LOG_NAME("level");
+  sylar::Logger::ptr mid = SYLAR_LOG_NAME("level.mid");
+  sylar::Logger::ptr leaf = SYLAR_LOG_NAME("level.mid.leaf");
+  top->setLevel(sylar::LogLevel::ERROR);
+  if (mid->getLevel() != sylar::LogLevel::ERROR || leaf->getLevel() != sylar::LogLevel::ERROR) {
+    exit(1);
+  }
+  mid->setLevel(sylar::LogLevel::INFO);
+  if (leaf->getLevel() != sylar::LogLevel::INFO || top->getLevel() != sylar::LogLevel::ERROR) {
+    exit(1);
+  }
+  mid->setLevel(sylar::LogLevel::UNKNOW);
+  std::cout << "level: " << sylar::LogLevel::ToString(leaf->getLevel()) << std::endl;
+  if (leaf->getLevel() != sylar::LogLevel::ERROR) {
+    exit(1);
+  }
+}
+
+// 没有appender的日志器输出到最近的有appender的祖先 祖先的appender清空后再往上找
+void test_sink() {
+  sylar::Logger::ptr top = SYLAR_LOG_NAME("sink");
+  sylar::Logger::ptr mid = SYLAR_LOG_NAME("sink.mid");
+  sylar::Logger::ptr leaf = SYLAR_LOG_NAME("sink.mid.leaf");
+  CaptureAppender::ptr top_sink = NewCapture();
+  CaptureAppender::ptr mid_sink = NewCapture();
+  top->addAppender(top_sink);
+  mid->addAppender(mid_sink);
+  SYLAR_LOG_INFO(leaf) << "nearest";
+  Expect("nearest sink", mid_sink->take(), {"sink.mid.leaf nearest\n"});
+  Expect("farther sink", top_sink->take(), {});
+  mid->clearAppenders();
+  SYLAR_LOG_INFO(leaf) << "next";
+  Expect("next sink", top_sink->take(), {"sink.mid.leaf next\n"});
+}
+
+// 从配置中删除的日志器恢复成继承 它的子日志器照常输出
+void test_config_delete() {
+  sylar::Logger::ptr child = SYLAR_LOG_NAME("deleted.child");
+  CaptureAppender::ptr sink = NewCapture();
+  child->addAppender(sink);
+  sylar::Config::LoadFromYaml(YAML::Load(
+    "logs:\n  - name: deleted\n    level: ERROR\n    appenders:\n      - type: StdoutAppender\n"));
+  SYLAR_LOG_INFO(child) << "filtered";
+  SYLAR_LOG_ERROR(child) << "configured";
+  sylar::Config::LoadFromYaml(YAML::Load("logs: []"));
+  SYLAR_LOG_INFO(child) << "deleted";
+  Expect("config delete", sink->take(), {"deleted.child configured\n", "deleted.child deleted\n"});
+  if (SYLAR_LOG_NAME("deleted")->getLevel() != SYLAR_LOG_ROOT()->getLevel()) {
+    exit(1);
+  }
+}
+
+// 多个线程同时创建和查找日志器 查找表扩容多次 每个名称始终只对应一个日志器
+void test_table_threads() {
+  const int threads = 4;
+  const int names = 3000;
+  std::vector<std::vector<sylar::Logger *>> seen(threads, std::vector<sylar::Logger *>(names));
+  std::vector<sylar::Thread::ptr> workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.push_back(sylar::Thread::ptr(new sylar::Thread(
+      [t, &seen]() {
+        // 每个线程从不同的位置开始 创建和查找交错进行
+        for (int k = 0; k < names; ++k) {
+          int i = (k + t * names / threads) % names;
+          sylar::Logger::ptr logger = SYLAR_LOG_NAME("table." + std::to_string(i % 10) + "." + std::to_string(i));
+          seen[t][i] = logger.get();
+          int back = (i * 7) % (k + 1);
+          int j = (back + t * names / threads) % names;
+          if (seen[t][j] &&
+              SYLAR_LOG_NAME("table." + std::to_string(j % 10) + "." + std::to_string(j)).get() != seen[t][j]) {
+            std::cout << "table: lookup changed for " << j << std::endl;
+            exit(1);
+          }
+        }
+      },
+      "table_" + std::to_string(t))));
+  }
+  for (auto &i : workers) {
+    i->join();
+  }
+  std::set<sylar::Logger *> distinct;
+  for (int i = 0; i < names; ++i) {
+    std::string name = "table." + std::to_string(i % 10) + "." + std::to_string(i);
+    sylar::Logger::ptr logger = SYLAR_LOG_NAME(name);
+    for (int t = 0; t < threads; ++t) {
+      if (seen[t][i] != logger.get()) {
+        std::cout << "table: " << name << " resolved to different loggers" << std::endl;
+        exit(1);
+      }
+    }
+    if (logger->getName() != name) {
+      exit(1);
+    }
+    distinct.insert(logger.get());
+  }
+  std::cout << "table threads: " << distinct.size() << " loggers" << std::endl;
+  if (distinct.size() != (size_t)names) {
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  test_reparent();
+  test_level();
+  test_sink();
+  test_config_delete();
+  test_table_threads();
+  return 0;
+}
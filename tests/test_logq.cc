@@ -0,0 +1,94 @@
+#include <libgen.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sylar/sylar.h"
+
+static const char *s_file = "logq_test.log";
+static const char *s_pattern = "%d{%Y-%m-%d %H:%M:%S}%T[%p]%T[%c]%T%m%n";
+static const int s_count = 20000;
+
+// 每秒一条 每10条一条ERROR 交替写入q.db和q.http 返回第一条的时间(秒)
+static time_t WriteLog() {
+  unlink(s_file);
+  unlink(sylar::LogIndex::IndexName(s_file).c_str());
+  time_t base = time(0) - s_count;
+  sylar::FileAppender::ptr appender(new sylar::FileAppender(s_file));
+  appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter(s_pattern)));
+  appender->setIndex(4096);
+  sylar::Logger::ptr db(new sylar::Logger("q.db"));
+  sylar::Logger::ptr http(new sylar::Logger("q.http"));
+  db->addAppender(appender);
+  http->addAppender(appender);
+  for (int i = 0; i < s_count; ++i) {
+    sylar::Logger::ptr logger = i % 2 ? http : db;
+    sylar::LogLevel::Level level = i % 10 ? sylar::LogLevel::INFO : sylar::LogLevel::ERROR;
+    sylar::LogEvent::ptr event = sylar::LogEvent::Create(logger, SYLAR_LOG_SITE(), level, 0, sylar::GetThreadId(), 0,
+                                                         (base + i) * 1000000ull);
+    event->getSS() << "seq=" << i;
+    logger->log(level, event);
+  }
+  appender->flush();
+  return base;
+}
+
+// 索引查找只返回覆盖时间范围的少数几段
+void test_search(time_t base) {
+  sylar::LogIndex::Query query;
+  query.begin = (base + 10000) * 1000000ull;
+  query.end = (base + 10099) * 1000000ull + 999999;
+  struct stat st;
+  stat(s_file, &st);
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  bool indexed = sylar::LogIndex::Search(s_file, st.st_size, query, ranges);
+  uint64_t bytes = 0;
+  for (auto &i : ranges) {
+    bytes += i.second - i.first;
+  }
+  std::cout << "search: " << ranges.size() << " ranges, " << bytes << " of " << st.st_size << " bytes" << std::endl;
+  if (!indexed || ranges.empty() || bytes * 20 > (uint64_t)st.st_size) {
+    exit(1);
+  }
+}
+
+// sylar_logq按时间 级别 日志器查询 输出恰好是满足条件的行
+void test_logq(const std::string &logq, time_t base) {
+  std::string cmd = logq + " -v -p '" + s_pattern + "' -s " + std::to_string(base + 10000) + " -e " +
+                    std::to_string(base + 10999) + " -l ERROR -c q.db " + s_file + " 2>&1";
+  FILE *fp = popen(cmd.c_str(), "r");
+  if (!fp) {
+    exit(1);
+  }
+  std::vector<int> seqs;
+  std::string stats;
+  char line[1024];
+  while (fgets(line, sizeof(line), fp)) {
+    const char *p = strstr(line, "seq=");
+    if (p) {
+      seqs.push_back(atoi(p + 4));
+    } else {
+      stats += line;
+    }
+  }
+  int rt = pclose(fp);
+  std::cout << "logq: " << seqs.size() << " lines, " << stats;
+  // ERROR是每10条一条 都是偶数 属于q.db
+  if (rt != 0 || seqs.size() != 100 || stats.find("indexed") == std::string::npos) {
+    exit(1);
+  }
+  for (size_t i = 0; i < seqs.size(); ++i) {
+    if (seqs[i] != 10000 + (int)i * 10) {
+      exit(1);
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  time_t base = WriteLog();
+  test_search(base);
+  std::string dir = dirname(strdup(argv[0]));
+  test_logq(dir + "/sylar_logq", base);
+  unlink(s_file);
+  unlink(sylar::LogIndex::IndexName(s_file).c_str());
+  return 0;
+}
@@ -0,0 +1,207 @@
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "sylar/sylar.h"
+
+static const char *s_dir = "mmap_test";
+static const int s_threads = 4;
+static const int s_count = 5000;
+
+// 目录下的文件名 按名称排序
+static std::vector<std::string> ListFiles() {
+  std::vector<std::string> files;
+  DIR *d = opendir(s_dir);
+  while (d) {
+    struct dirent *ent = readdir(d);
+    if (!ent) {
+      closedir(d);
+      break;
+    }
+    if (ent->d_name[0] != '.') {
+      files.push_back(ent->d_name);
+    }
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+static void ResetDir() {
+  mkdir(s_dir, 0755);
+  for (auto &i : ListFiles()) {
+    unlink((std::string(s_dir) + "/" + i).c_str());
+  }
+}
+
+static std::string ReadFile(const std::string &file) {
+  std::ifstream ifs(file, std::ios::in | std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+}
+
+static uint64_t FileSize(const std::string &file) {
+  struct stat st;
+  return stat(file.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+static sylar::Logger::ptr NewLogger(sylar::LogAppender::ptr appender) {
+  sylar::Logger::ptr logger(new sylar::Logger("mmap"));
+  appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+  logger->addAppender(appender);
+  return logger;
+}
+
+// 多个线程同时写 窗口很小 频繁切换 每一行都完整 每个线程的顺序不变 关闭后没有多余的0
+void test_threads() {
+  ResetDir();
+  std::string file = std::string(s_dir) + "/threads.log";
+  {
+    sylar::Logger::ptr logger = NewLogger(sylar::LogAppender::ptr(new sylar::MmapFileAppender(file, 4096)));
+    std::vector<sylar::Thread::ptr> threads;
+    for (int i = 0; i < s_threads; ++i) {
+      threads.push_back(sylar::Thread::ptr(new sylar::Thread(
+        [logger, i]() {
+          for (int j = 0; j < s_count; ++j) {
+            SYLAR_LOG_INFO(logger) << "thread=" << i << " seq=" << j;
+          }
+        },
+        "mmap_" + std::to_string(i))));
+    }
+    for (auto &i : threads) {
+      i->join();
+    }
+  }
+  std::string content = ReadFile(file);
+  std::stringstream ss(content);
+  std::string line;
+  std::vector<int> next(s_threads, 0);
+  int lines = 0;
+  while (std::getline(ss, line)) {
+    int thread = -1, seq = -1;
+    if (sscanf(line.c_str(), "thread=%d seq=%d", &thread, &seq) != 2 || thread < 0 || thread >= s_threads ||
+        seq != next[thread]) {
+      std::cout << "bad line: " << line << std::endl;
+      exit(1);
+    }
+    ++next[thread];
+    ++lines;
+  }
+  std::cout << "threads: " << lines << " lines, " << content.size() << " bytes" << std::endl;
+  if (lines != s_threads * s_count || content.find('\0') != std::string::npos) {
+    exit(1);
+  }
+}
+
+// 按大小切分 窗口大于max_size时也不会越过 只保留max_files个历史文件
+void test_size_rotate() {
+  ResetDir();
+  std::string file = std::string(s_dir) + "/size.log";
+  const uint64_t max_size = 6000;
+  const uint32_t max_files = 3;
+  {
+    sylar::Logger::ptr logger = NewLogger(sylar::LogAppender::ptr(
+      new sylar::MmapFileAppender(file, 64 * 1024, max_size, sylar::LogFile::NONE, max_files)));
+    for (int i = 0; i < 2000; ++i) {
+      SYLAR_LOG_INFO(logger) << "size rotate line " << i;
+    }
+  }
+  std::vector<std::string> files = ListFiles();
+  int logs = 0;
+  for (auto &i : files) {
+    std::string path = std::string(s_dir) + "/" + i;
+    if (path == sylar::MmapFileAppender::StateName(file)) {
+      continue;
+    }
+    ++logs;
+    if (FileSize(path) > max_size || ReadFile(path).find('\0') != std::string::npos) {
+      std::cout << "bad file: " << i << " " << FileSize(path) << " bytes" << std::endl;
+      exit(1);
+    }
+  }
+  std::cout << "size rotate: " << logs << " files" << std::endl;
+  if (logs != max_files + 1) {
+    exit(1);
+  }
+}
+
+// 正常关闭时截掉预分配的部分 文件长度就是写入的字节数
+void test_close() {
+  ResetDir();
+  std::string file = std::string(s_dir) + "/close.log";
+  std::string expect;
+  {
+    sylar::Logger::ptr logger = NewLogger(sylar::LogAppender::ptr(new sylar::MmapFileAppender(file)));
+    for (int i = 0; i < 10; ++i) {
+      SYLAR_LOG_INFO(logger) << "close " << i;
+      expect += "close " + std::to_string(i) + "\n";
+    }
+    std::cout << "close: " << FileSize(file) << " bytes while open" << std::endl;
+    if (FileSize(file) <= expect.size()) {
+      exit(1);
+    }
+  }
+  std::cout << "close: " << FileSize(file) << " bytes after close" << std::endl;
+  if (ReadFile(file) != expect) {
+    exit(1);
+  }
+}
+
+// 进程没有析构appender就退出 文件末尾留着预分配的0
+// 重新打开时截到实际写入的位置 内容本身以0结尾也不会被截掉
+void test_unclean_exit() {
+  ResetDir();
+  std::string file = std::string(s_dir) + "/crash.log";
+  std::string expect;
+  for (int i = 0; i < 100; ++i) {
+    expect += "crash " + std::to_string(i) + "\n";
+  }
+  expect += std::string("binary\0\0\0", 9);
+  pid_t pid = fork();
+  if (pid == 0) {
+    sylar::MmapFileAppender *appender = new sylar::MmapFileAppender(file, 4096);
+    appender->write(sylar::LogLevel::INFO, expect.data(), expect.size() - 9);
+    appender->write(sylar::LogLevel::INFO, expect.data() + expect.size() - 9, 9);
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  uint64_t crashed = FileSize(file);
+  {
+    sylar::MmapFileAppender appender(file, 4096);
+    appender.write(sylar::LogLevel::INFO, "again\n", 6);
+  }
+  std::string recovered = ReadFile(file);
+  std::cout << "unclean exit: " << crashed << " bytes after exit, " << recovered.size() << " after reopen"
+            << std::endl;
+  if (crashed <= expect.size() || recovered != expect + "again\n") {
+    exit(1);
+  }
+}
+
+// 文件被外部移走后 一秒内的检查发现并在原路径重新创建
+void test_moved() {
+  ResetDir();
+  std::string file = std::string(s_dir) + "/moved.log";
+  std::string moved = file + ".old";
+  sylar::Logger::ptr logger = NewLogger(sylar::LogAppender::ptr(new sylar::MmapFileAppender(file)));
+  SYLAR_LOG_INFO(logger) << "before";
+  rename(file.c_str(), moved.c_str());
+  usleep(1100 * 1000);
+  SYLAR_LOG_INFO(logger) << "after";
+  logger.reset();
+  std::cout << "moved: [" << ReadFile(moved) << "] [" << ReadFile(file) << "]" << std::endl;
+  if (ReadFile(moved) != "before\n" || ReadFile(file) != "after\n") {
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  test_threads();
+  test_size_rotate();
+  test_close();
+  test_unclean_exit();
+  test_moved();
+  ResetDir();
+  rmdir(s_dir);
+  return 0;
+}
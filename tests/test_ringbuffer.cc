@@ -0,0 +1,109 @@
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "sylar/sylar.h"
+
+static const char *s_file = "ringbuffer_test.log";
+
+static std::string ReadFile(const char *file) {
+  std::ifstream ifs(file);
+  return std::string((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+}
+
+static sylar::Logger::ptr NewLogger(sylar::RingBufferAppender::ptr appender) {
+  sylar::Logger::ptr logger(new sylar::Logger("ring"));
+  appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+  logger->addAppender(appender);
+  return logger;
+}
+
+// 缓冲只保留最近的内容 每次导出只有上次导出之后的新内容
+void test_dump() {
+  unlink(s_file);
+  sylar::RingBufferAppender::ptr appender(new sylar::RingBufferAppender(s_file, 4096));
+  sylar::Logger::ptr logger = NewLogger(appender);
+  for (int i = 0; i < 1000; ++i) {
+    SYLAR_LOG_INFO(logger) << "line " << i;
+  }
+  appender->dump("first");
+  SYLAR_LOG_INFO(logger) << "after first";
+  appender->dump("second");
+  std::string content = ReadFile(s_file);
+  size_t second = content.find("==== ring buffer dump: second ====");
+  std::cout << "dump: " << content.size() << " bytes" << std::endl;
+  if (content.find("==== ring buffer dump: first ====") != 0 || content.find("\nline 999\n") == std::string::npos ||
+      content.find("\nline 0\n") != std::string::npos || second == std::string::npos ||
+      content.find("after first\n", second) == std::string::npos ||
+      content.find("line 999", second) != std::string::npos) {
+    exit(1);
+  }
+}
+
+static volatile sig_atomic_t s_app_signals = 0;
+static void AppHandler(int) { ++s_app_signals; }
+
+// 导出信号要显式指定 应用程序原来的处理函数照常被调用
+void test_dump_signal() {
+  unlink(s_file);
+  signal(SIGUSR2, AppHandler);
+  sylar::RingBufferAppender::ptr appender(new sylar::RingBufferAppender(s_file, 4096, SIGUSR2));
+  sylar::Logger::ptr logger = NewLogger(appender);
+  SYLAR_LOG_INFO(logger) << "before signal";
+  raise(SIGUSR2);
+  std::string content = ReadFile(s_file);
+  std::cout << "dump signal: app handler called " << s_app_signals << " times" << std::endl;
+  if (s_app_signals != 1 || content.find("==== ring buffer dump: SIGUSR2 ====") != 0 ||
+      content.find("before signal\n") == std::string::npos) {
+    exit(1);
+  }
+}
+
+static volatile int s_depth = 1 << 30;
+
+static int Recurse(int n) {
+  volatile char buf[1024];
+  buf[0] = (char)n;
+  return n < s_depth ? Recurse(n + 1) + buf[0] : buf[0];
+}
+
+// 栈溢出时在备用栈上导出
+void test_stack_overflow() {
+  unlink(s_file);
+  pid_t pid = fork();
+  if (pid == 0) {
+    sylar::RingBufferAppender::ptr appender(new sylar::RingBufferAppender(s_file, 4096));
+    sylar::Logger::ptr logger = NewLogger(appender);
+    SYLAR_LOG_INFO(logger) << "before overflow";
+    _exit(Recurse(0));
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  std::string content = ReadFile(s_file);
+  std::cout << "stack overflow: child " << (WIFSIGNALED(status) ? strsignal(WTERMSIG(status)) : "exited") << std::endl;
+  if (!WIFSIGNALED(status) || content.find("==== ring buffer dump: SIGSEGV ====") != 0 ||
+      content.find("before overflow\n") == std::string::npos) {
+    exit(1);
+  }
+}
+
+// 登记表满了的appender不会在崩溃时导出 要能知道
+void test_registry_full() {
+  std::vector<sylar::RingBufferAppender::ptr> appenders;
+  for (int i = 0; i < 17; ++i) {
+    appenders.push_back(sylar::RingBufferAppender::ptr(new sylar::RingBufferAppender(s_file, 4096)));
+  }
+  std::cout << "registry full: last registered " << appenders.back()->isRegistered() << std::endl;
+  if (!appenders[15]->isRegistered() || appenders[16]->isRegistered()) {
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  test_dump();
+  test_dump_signal();
+  test_stack_overflow();
+  test_registry_full();
+  unlink(s_file);
+  return 0;
+}
@@ -0,0 +1,136 @@
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "sylar/sylar.h"
+
+static const char *s_dir = "rotate_test";
+
+// 目录下的文件名 按名称排序
+static std::vector<std::string> ListFiles() {
+  std::vector<std::string> files;
+  DIR *d = opendir(s_dir);
+  while (d) {
+    struct dirent *ent = readdir(d);
+    if (!ent) {
+      closedir(d);
+      break;
+    }
+    if (ent->d_name[0] != '.') {
+      files.push_back(ent->d_name);
+    }
+  }
+  std::sort(files.begin(), files.end());
+  return files;
+}
+
+static void ResetDir() {
+  mkdir(s_dir, 0755);
+  for (auto &i : ListFiles()) {
+    unlink((std::string(s_dir) + "/" + i).c_str());
+  }
+}
+
+static uint64_t FileSize(const std::string &file) {
+  struct stat st;
+  return stat(file.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+static sylar::Logger::ptr NewLogger(sylar::LogAppender::ptr appender) {
+  sylar::Logger::ptr logger(new sylar::Logger("rotate"));
+  appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%p%T%m%n")));
+  logger->addAppender(appender);
+  return logger;
+}
+
+// 同步写入的FileAppender 每条日志写完就在文件里 不等缓冲写满
+void test_write_through() {
+  ResetDir();
+  std::string file = std::string(s_dir) + "/plain.log";
+  sylar::Logger::ptr logger = NewLogger(sylar::LogAppender::ptr(new sylar::FileAppender(file)));
+  SYLAR_LOG_ERROR(logger) << "first";
+  uint64_t first = FileSize(file);
+  SYLAR_LOG_ERROR(logger) << "second";
+  uint64_t second = FileSize(file);
+  std::cout << "write through: " << first << " " << second << " bytes" << std::endl;
+  if (first == 0 || second <= first) {
+    exit(1);
+  }
+}
+
+// 按大小切分 当前文件不超过max_size 只保留max_files个历史文件
+// 同前缀但不是切分出来的文件不计数 也不删除
+void test_size_rotate() {
+  ResetDir();
+  std::string file = std::string(s_dir) + "/size.log";
+  const uint64_t max_size = 4096;
+  const uint32_t max_files = 3;
+  const char *others[] = {".bak", ".spill", ".0", ".20240101.bak", ".2024010112x"};
+  for (auto i : others) {
+    std::ofstream(file + i) << "keep" << std::endl;
+  }
+  sylar::Logger::ptr logger = NewLogger(
+    sylar::LogAppender::ptr(new sylar::RotatingFileAppender(file, max_size, sylar::LogFile::NONE, max_files)));
+  for (int i = 0; i < 2000; ++i) {
+    SYLAR_LOG_INFO(logger) << "size rotate line " << i;
+  }
+  logger->flush();
+  std::vector<std::string> files = ListFiles();
+  std::cout << "size rotate: " << files.size() << " files, current " << FileSize(file) << " bytes" << std::endl;
+  size_t count = sizeof(others) / sizeof(others[0]);
+  if (files.size() != max_files + 1 + count || FileSize(file) > max_size) {
+    exit(1);
+  }
+  for (auto i : others) {
+    if (FileSize(file + i) != strlen("keep\n")) {
+      exit(1);
+    }
+  }
+  for (auto &i : files) {
+    if (FileSize(std::string(s_dir) + "/" + i) > max_size) {
+      exit(1);
+    }
+  }
+}
+
+// 按天切分 昨天留下的文件在今天第一次写入时改名为带昨天日期的文件
+void test_time_rotate() {
+  ResetDir();
+  std::string file = std::string(s_dir) + "/daily.log";
+  {
+    std::ofstream ofs(file);
+    ofs << "yesterday" << std::endl;
+  }
+  time_t yesterday = time(0) - 86400;
+  struct utimbuf times = {yesterday, yesterday};
+  utime(file.c_str(), &times);
+
+  sylar::Logger::ptr logger =
+    NewLogger(sylar::LogAppender::ptr(new sylar::RotatingFileAppender(file, 0, sylar::LogFile::DAILY, 0)));
+  SYLAR_LOG_INFO(logger) << "today";
+  logger->flush();
+
+  struct tm tm;
+  time_t start = sylar::LogFile::PeriodStart(sylar::LogFile::DAILY, yesterday);
+  localtime_r(&start, &tm);
+  char suffix[16];
+  strftime(suffix, sizeof(suffix), "%Y%m%d", &tm);
+  std::string archived = file + "." + suffix;
+  std::ifstream ifs(archived);
+  std::string line;
+  std::getline(ifs, line);
+  std::cout << "time rotate: " << archived << " [" << line << "]" << std::endl;
+  if (line != "yesterday" || FileSize(file) != strlen("INFO\ttoday\n")) {
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  test_write_through();
+  test_size_rotate();
+  test_time_rotate();
+  ResetDir();
+  rmdir(s_dir);
+  return 0;
+}
@@ -0,0 +1,94 @@
+#include <unistd.h>
+
+#include "sylar/sylar.h"
+
+static const char *s_file = "sharded_test.log";
+static const int s_shards = 4;
+static const int s_threads = 4;
+static const int s_count = 5000;
+
+static void RemoveShards() {
+  for (int i = 0; i < s_shards; ++i) {
+    unlink(sylar::ShardedFileAppender::ShardName(s_file, i).c_str());
+  }
+}
+
+static std::vector<std::string> ShardNames() {
+  std::vector<std::string> files;
+  for (int i = 0; i < s_shards; ++i) {
+    files.push_back(sylar::ShardedFileAppender::ShardName(s_file, i));
+  }
+  return files;
+}
+
+static std::string Key(uint64_t t) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%016lx ", (unsigned long)t);
+  return buf;
+}
+
+// 手工构造的分片 按时间归并 时间相同的按分片顺序 续行跟着所属的记录
+void test_merge_order() {
+  RemoveShards();
+  std::vector<std::string> files = ShardNames();
+  std::ofstream(files[0]) << Key(1) << "a1\n" << Key(3) << "a3\n" << Key(5) << "a5\n  a5 continued\n";
+  std::ofstream(files[1]) << Key(2) << "b2\n" << Key(3) << "b3\n" << Key(4) << "b4\n";
+  std::ofstream empty(files[2]);
+  std::ofstream(files[3]) << Key(0) << "d0\n";
+  std::stringstream ss;
+  bool ok = sylar::ShardedFileAppender::Merge(files, ss);
+  std::cout << "merge order:" << std::endl << ss.str();
+  if (!ok || ss.str() != "d0\na1\nb2\na3\nb3\nb4\na5\n  a5 continued\n") {
+    exit(1);
+  }
+}
+
+// 多线程写入后合并 总数不变 时间前缀不减
+void test_merge_threads() {
+  RemoveShards();
+  {
+    sylar::Logger::ptr logger(new sylar::Logger("sharded"));
+    sylar::LogAppender::ptr appender(new sylar::ShardedFileAppender(s_file, s_shards));
+    appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+    logger->addAppender(appender);
+    std::vector<sylar::Thread::ptr> threads;
+    for (int i = 0; i < s_threads; ++i) {
+      threads.push_back(sylar::Thread::ptr(new sylar::Thread(
+        [logger, i]() {
+          for (int j = 0; j < s_count; ++j) {
+            SYLAR_LOG_INFO(logger) << "thread=" << i << " seq=" << j;
+          }
+        },
+        "sharded_" + std::to_string(i))));
+    }
+    for (auto &i : threads) {
+      i->join();
+    }
+  }
+  std::stringstream ss;
+  if (!sylar::ShardedFileAppender::Merge(ShardNames(), ss, true)) {
+    exit(1);
+  }
+  std::string line, last;
+  int lines = 0;
+  while (std::getline(ss, line)) {
+    std::string key = line.substr(0, sylar::ShardedFileAppender::kKeySize);
+    if (line.size() <= key.size() || key < last) {
+      std::cout << "out of order: " << line << std::endl;
+      exit(1);
+    }
+    last = key;
+    ++lines;
+  }
+  std::cout << "merge threads: " << lines << " lines" << std::endl;
+  if (lines != s_threads * s_count) {
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  test_merge_order();
+  test_merge_threads();
+  RemoveShards();
+  return 0;
+}
@@ -0,0 +1,66 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sylar/sylar.h"
+
+static const char *s_file = "stdout_test.log";
+static const int s_threads = 4;
+static const int s_count = 5000;
+
+// 多个线程同时输出 标准输出重定向到文件 每一行都要完整 不能被其他线程的输出打断
+static void run(size_t buffer_size) {
+  int saved = dup(STDOUT_FILENO);
+  int fd = open(s_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  dup2(fd, STDOUT_FILENO);
+  close(fd);
+  {
+    sylar::Logger::ptr logger(new sylar::Logger("stdout"));
+    sylar::LogAppender::ptr appender(new sylar::StdoutAppender(buffer_size, 100));
+    appender->setFormatter(sylar::LogFormatter::ptr(new sylar::LogFormatter("%m%n")));
+    logger->addAppender(appender);
+    std::vector<sylar::Thread::ptr> threads;
+    for (int i = 0; i < s_threads; ++i) {
+      threads.push_back(sylar::Thread::ptr(new sylar::Thread(
+        [logger, i]() {
+          for (int j = 0; j < s_count; ++j) {
+            SYLAR_LOG_INFO(logger) << "thread=" << i << " seq=" << j << " payload=" << std::string(40, 'a' + i);
+          }
+        },
+        "stdout_" + std::to_string(i))));
+    }
+    for (auto &i : threads) {
+      i->join();
+    }
+    logger->flush();
+  }
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+
+  // 每个线程的行按顺序出现
+  std::vector<int> next(s_threads, 0);
+  std::ifstream ifs(s_file);
+  std::string line;
+  int lines = 0;
+  while (std::getline(ifs, line)) {
+    int thread = -1, seq = -1;
+    char payload[64] = {0};
+    if (sscanf(line.c_str(), "thread=%d seq=%d payload=%63s", &thread, &seq, payload) != 3 || thread < 0 ||
+        thread >= s_threads || seq != next[thread] || std::string(payload) != std::string(40, 'a' + thread)) {
+      std::cout << "bad line: " << line << std::endl;
+      exit(1);
+    }
+    ++next[thread];
+    ++lines;
+  }
+  std::cout << "stdout buffer_size=" << buffer_size << ": " << lines << " lines" << std::endl;
+  if (lines != s_threads * s_count) {
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv) {
+  run(0);
+  run(64 * 1024);
+  unlink(s_file);
+  return 0;
+}
@@ -1,6 +1,8 @@
 #include "sylar/sylar.h"
 
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
@@ -9,7 +11,33 @@ void test_assert() {
   SYLAR_ASSERT_P(1 <= 0, "haha");
 }
 
+// 超过IOV_MAX块 夹杂空块 写入的内容应与拼接的结果一致
+void test_write_all() {
+  const char *file = "write_all_test.txt";
+  std::vector<std::string> parts;
+  std::vector<struct iovec> iov;
+  std::string expect;
+  for (int i = 0; i < 3000; ++i) {
+    parts.push_back(i % 7 ? std::to_string(i) + "," : "");
+  }
+  for (auto &i : parts) {
+    iov.push_back({(void *)i.data(), i.size()});
+    expect += i;
+  }
+  int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  bool ok = sylar::WriteAll(fd, &iov[0], iov.size());
+  close(fd);
+  std::ifstream ifs(file);
+  std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+  unlink(file);
+  std::cout << "write all: " << content.size() << " bytes" << std::endl;
+  if (!ok || content != expect) {
+    exit(1);
+  }
+}
+
 int main(int argc, char **argv) {
+  test_write_all();
   test_assert();
   return 0;
 }
\ No newline at end of file
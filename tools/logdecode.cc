@@ -0,0 +1,44 @@
+#include <unistd.h>
+
+#include "sylar/sylar.h"
+
+// 把二进制日志还原成文本
+// 用法: sylar_logdecode [-p pattern] file...  不指定文件时从标准输入读取
+static void usage(const char *prog) {
+  std::cerr << "usage: " << prog << " [-p pattern] [file...]" << std::endl
+            << "  -p pattern  override the LogFormatter pattern recorded in the file" << std::endl;
+}
+
+int main(int argc, char **argv) {
+  std::string pattern;
+  int opt;
+  while ((opt = getopt(argc, argv, "p:h")) != -1) {
+    switch (opt) {
+      case 'p':
+        pattern = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+
+  sylar::BinLogReader reader(pattern);
+  if (optind >= argc) {
+    return reader.decode(std::cin, std::cout) ? 0 : 2;
+  }
+  int rt = 0;
+  for (int i = optind; i < argc; ++i) {
+    std::ifstream ifs(argv[i], std::ios::in | std::ios::binary);
+    if (!ifs) {
+      std::cerr << argv[i] << ": open failed" << std::endl;
+      rt = 1;
+      continue;
+    }
+    if (!reader.decode(ifs, std::cout)) {
+      std::cerr << argv[i] << ": corrupted binary log" << std::endl;
+      rt = 2;
+    }
+  }
+  return rt;
+}
@@ -0,0 +1,49 @@
+#include <unistd.h>
+
+#include "sylar/sylar.h"
+
+// 把ShardedFileAppender的各个分片合并成一份按时间排序的日志
+// 用法: sylar_logmerge [-k] file.0 file.1 ...  或者 sylar_logmerge -n 分片数 file
+static void usage(const char *prog) {
+  std::cerr << "usage: " << prog << " [-k] [-n shards] file..." << std::endl
+            << "  -k         keep the hex timestamp prefix of each record" << std::endl
+            << "  -n shards  treat the single file argument as the base name of file.0 ... file.<shards-1>"
+            << std::endl;
+}
+
+int main(int argc, char **argv) {
+  bool keep_key = false;
+  int shards = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "kn:h")) != -1) {
+    switch (opt) {
+      case 'k':
+        keep_key = true;
+        break;
+      case 'n':
+        shards = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (optind >= argc || (shards > 0 && optind + 1 != argc)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  std::vector<std::string> files;
+  if (shards > 0) {
+    for (int i = 0; i < shards; ++i) {
+      files.push_back(sylar::ShardedFileAppender::ShardName(argv[optind], i));
+    }
+  } else {
+    files.assign(argv + optind, argv + argc);
+  }
+  if (!sylar::ShardedFileAppender::Merge(files, std::cout, keep_key)) {
+    std::cerr << "some shards could not be opened" << std::endl;
+    return 2;
+  }
+  return 0;
+}
@@ -0,0 +1,202 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sylar/sylar.h"
+
+// 按时间范围 级别和日志器查询日志文件
+// 有 文件名.idx 时先在索引中二分查找时间范围 只读取可能命中的段 再逐行按日志格式解析过滤
+// 用法: sylar_logq [-s 开始时间] [-e 结束时间] [-l 最低级别] [-c 日志器] [-p 日志格式] file...
+static const char *s_default_pattern = "%d{%Y-%m-%d %H:%M:%S}%T%t%T%F%T[%p]%T[%c]%T%f:%l%T%T%m%n";
+
+static void usage(const char *prog) {
+  std::cerr << "usage: " << prog << " [-s begin] [-e end] [-l level] [-c logger] [-p pattern] [-v] file..." << std::endl
+            << "  -s begin    \"YYYY-mm-dd HH:MM:SS\", \"YYYY-mm-dd\" or unix seconds" << std::endl
+            << "  -e end      same as -s, inclusive" << std::endl
+            << "  -l level    minimum level: DEBUG INFO WARN ERROR FATAL" << std::endl
+            << "  -c logger   logger name, also matches its descendants (a.b matches a.b.c)" << std::endl
+            << "  -p pattern  formatter pattern of the file, default " << s_default_pattern << std::endl
+            << "  -v          print how much of each file was read to stderr" << std::endl;
+}
+
+// 返回微秒 结束时间取到这一秒(只给日期时是这一天)的最后一微秒
+static bool ParseTime(const char *str, bool end, uint64_t &us) {
+  char *p = nullptr;
+  long long sec = strtoll(str, &p, 10);
+  if (*str && !*p) {
+    us = sec * 1000000ull + (end ? 999999 : 0);
+    return true;
+  }
+  struct tm tm;
+  memset(&tm, 0, sizeof(tm));
+  uint64_t tail = 999999;
+  const char *rt = strptime(str, "%Y-%m-%d %H:%M:%S", &tm);
+  if (!rt || *rt) {
+    memset(&tm, 0, sizeof(tm));
+    rt = strptime(str, "%Y-%m-%d", &tm);
+    if (!rt || *rt) {
+      return false;
+    }
+    tail = 86400 * 1000000ull - 1;
+  }
+  tm.tm_isdst = -1;
+  time_t t = mktime(&tm);
+  if (t == (time_t)-1) {
+    return false;
+  }
+  us = t * 1000000ull + (end ? tail : 0);
+  return true;
+}
+
+struct Filter {
+  uint64_t begin = 0;
+  uint64_t end = UINT64_MAX;
+  sylar::LogLevel::Level level = sylar::LogLevel::UNKNOW;
+  std::string logger;
+  bool verbose = false;
+};
+
+static bool Match(const Filter &filter, const sylar::LogFormatter::Fields &fields) {
+  // 格式中没有%d时time为0 只能按索引的粒度过滤时间 行内的时间可能只精确到秒 起点也按秒取整
+  if (fields.time && (fields.time < filter.begin - filter.begin % 1000000 || fields.time > filter.end)) {
+    return false;
+  }
+  if (fields.level < filter.level) {
+    return false;
+  }
+  if (!filter.logger.empty() && fields.name != filter.logger &&
+      (fields.name.size() <= filter.logger.size() || fields.name.compare(0, filter.logger.size(), filter.logger) ||
+       fields.name[filter.logger.size()] != '.')) {
+    return false;
+  }
+  return true;
+}
+
+static bool IsCompressed(const unsigned char *data, size_t size) {
+  static const unsigned char s_magics[][4] = {{0x1f, 0x8b}, {0x28, 0xb5, 0x2f, 0xfd}, {0x04, 0x22, 0x4d, 0x18}};
+  static const size_t s_lengths[] = {2, 4, 4};
+  for (size_t i = 0; i < 3; ++i) {
+    if (size >= s_lengths[i] && memcmp(data, s_magics[i], s_lengths[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool QueryFile(const std::string &file, const Filter &filter, const sylar::LogFormatter &formatter) {
+  int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    std::cerr << file << ": " << strerror(errno) << std::endl;
+    if (fd >= 0) {
+      close(fd);
+    }
+    return false;
+  }
+  size_t size = st.st_size;
+  if (!size) {
+    close(fd);
+    return true;
+  }
+  const char *data = (const char *)mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    std::cerr << file << ": mmap failed" << std::endl;
+    return false;
+  }
+  if (IsCompressed((const unsigned char *)data, size)) {
+    std::cerr << file << ": compressed segments are not supported, decompress it first" << std::endl;
+    munmap((void *)data, size);
+    return false;
+  }
+  madvise((void *)data, size, MADV_RANDOM);
+
+  sylar::LogIndex::Query query;
+  query.begin = filter.begin;
+  query.end = filter.end;
+  query.levels = ~0u << filter.level;
+  query.loggers = filter.logger.empty() ? 0 : sylar::LogIndex::NameBit(filter.logger);
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;
+  bool indexed = sylar::LogIndex::Search(file, size, query, ranges);
+
+  uint64_t scanned = 0;
+  sylar::LogFormatter::Fields fields;
+  for (auto &range : ranges) {
+    // 不符合格式的行是上一条多行日志的后续 跟随上一条是否输出
+    bool printing = false;
+    const char *p = data + range.first;
+    const char *end = data + range.second;
+    while (p < end) {
+      const char *nl = (const char *)memchr(p, '\n', data + size - p);
+      const char *next = nl ? nl + 1 : data + size;
+      if (formatter.parse(p, next, fields)) {
+        printing = Match(filter, fields);
+      }
+      if (printing) {
+        fwrite(p, 1, next - p, stdout);
+      }
+      scanned += next - p;
+      p = next;
+    }
+  }
+  munmap((void *)data, size);
+  if (filter.verbose) {
+    std::cerr << file << ": " << (indexed ? "indexed" : "no index") << ", read " << scanned << " of " << size
+              << " bytes in " << ranges.size() << " ranges" << std::endl;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  Filter filter;
+  std::string pattern = s_default_pattern;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:e:l:c:p:vh")) != -1) {
+    switch (opt) {
+      case 's':
+      case 'e':
+        if (!ParseTime(optarg, opt == 'e', opt == 's' ? filter.begin : filter.end)) {
+          std::cerr << "invalid time: " << optarg << std::endl;
+          return 1;
+        }
+        break;
+      case 'l':
+        filter.level = sylar::LogLevel::fromString(optarg);
+        if (filter.level == sylar::LogLevel::UNKNOW) {
+          std::cerr << "invalid level: " << optarg << std::endl;
+          return 1;
+        }
+        break;
+      case 'c':
+        filter.logger = optarg;
+        break;
+      case 'p':
+        pattern = optarg;
+        break;
+      case 'v':
+        filter.verbose = true;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (optind >= argc) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  sylar::LogFormatter formatter(pattern);
+  if (formatter.isError()) {
+    std::cerr << "invalid pattern: " << pattern << std::endl;
+    return 1;
+  }
+  int rt = 0;
+  for (int i = optind; i < argc; ++i) {
+    if (!QueryFile(argv[i], filter, formatter)) {
+      rt = 2;
+    }
+  }
+  return rt;
+}